@@ -0,0 +1,54 @@
+/* === bench/alloc.c - Allocation heavy evaluation ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Times an expression where every call builds a short lived tuple and
+ * partial application, so the time is mostly allocation and collection.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TREE_DEPTH 9
+#define ITERATIONS 20000
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+
+    /* Each call to f makes a pair and a partial application to drop. */
+    size_t calls;
+    char *src = bench_build_tree("(\\f -> \\a -> ", "f (", ") (", ")",
+            ") (\\x -> \\y -> (\\t -> \\p -> x + y + 1) (x, y) "
+            "((\\u -> \\v -> \\w -> u) x)) 1", TREE_DEPTH, &calls);
+    struct wist_handle *clo = bench_gen_expr(comp, vm, src);
+    free(src);
+    if (clo == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bench_time_calls(vm, "alloc", clo, calls, ITERATIONS);
+
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+    wist_ctx_destroy(ctx);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/* === bench/bench.c - Helpers shared by the benchmarks ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/* For clock_gettime under -std=c99. */
+#define _POSIX_C_SOURCE 199309L
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+static char *build_tree(char *iter, const char *open, const char *sep,
+        const char *close, int depth)
+{
+    if (depth == 0)
+    {
+        return iter + sprintf(iter, "a");
+    }
+
+    iter += sprintf(iter, "%s", open);
+    iter = build_tree(iter, open, sep, close, depth - 1);
+    iter += sprintf(iter, "%s", sep);
+    iter = build_tree(iter, open, sep, close, depth - 1);
+    return iter + sprintf(iter, "%s", close);
+}
+
+char *bench_build_tree(const char *head, const char *open, const char *sep,
+        const char *close, const char *tail, int depth, size_t *nodes_out)
+{
+    size_t nodes = ((size_t) 1 << depth) - 1;
+    char *src = malloc(strlen(head) + strlen(tail) + (nodes + 1)
+            * (1 + strlen(open) + strlen(sep) + strlen(close)) + 1);
+    char *iter = src;
+
+    iter += sprintf(iter, "%s", head);
+    iter = build_tree(iter, open, sep, close, depth);
+    sprintf(iter, "%s", tail);
+
+    *nodes_out = nodes;
+    return src;
+}
+
+struct wist_handle *bench_gen_expr(struct wist_compiler *comp,
+        struct wist_vm *vm, const char *src)
+{
+    struct wist_ast_expr *expr;
+    struct wist_parse_result *result = wist_compiler_parse_expr(comp,
+            (const uint8_t *) src, strlen(src), &expr);
+    if (wist_parse_result_has_errors(result))
+    {
+        printf("errors found in benchmark expression\n");
+        wist_parse_result_destroy(comp, result);
+        return NULL;
+    }
+
+    struct wist_handle *clo = wist_compiler_vm_gen_expr(comp, vm, expr);
+    if (clo == NULL)
+    {
+        printf("failed to generate code for benchmark expression\n");
+    }
+
+    wist_parse_result_destroy(comp, result);
+    wist_ast_expr_destroy(comp, expr);
+    return clo;
+}
+
+void bench_time_calls(struct wist_vm *vm, const char *name,
+        struct wist_handle *clo, size_t calls, int iterations)
+{
+    int64_t check = 0;
+    clock_t start = clock();
+    for (int i = 0; i < iterations; i++)
+    {
+        wist_handle_stack_push(vm);
+        struct wist_handle *val = wist_vm_eval(vm, clo);
+        check += wist_handle_get_int(val);
+        wist_handle_stack_pop(vm);
+    }
+    clock_t end = clock();
+
+    double secs = (double) (end - start) / CLOCKS_PER_SEC;
+    printf("%s: %zu calls x %d iterations in %.3fs (%.1f ns/call), "
+            "check %" PRId64 "\n", name, calls, iterations, secs,
+            secs * 1e9 / ((double) calls * iterations), check);
+}
+
+char *bench_build_doubling(int global, int depth)
+{
+    char *src = malloc(64 + depth * 8);
+    char *iter = src;
+
+    iter += sprintf(iter, "g%d = ", global);
+    for (int i = 1; i < depth; i++)
+    {
+        iter += sprintf(iter, "m (");
+    }
+    iter += sprintf(iter, "\\x -> (x, x)");
+    for (int i = 1; i < depth; i++)
+    {
+        iter += sprintf(iter, ")");
+    }
+    sprintf(iter, " %d", global);
+    return src;
+}
+
+bool bench_define(struct wist_compiler *comp, struct wist_vm *vm,
+        const char *src)
+{
+    struct wist_ast_decl *decl;
+    struct wist_parse_result *result = wist_compiler_parse_decl(comp,
+            (const uint8_t *) src, strlen(src), &decl);
+    if (wist_parse_result_has_errors(result))
+    {
+        printf("errors found in benchmark declaration\n");
+        wist_parse_result_destroy(comp, result);
+        return false;
+    }
+
+    wist_handle_stack_push(vm);
+    struct wist_handle *clo = wist_compiler_vm_gen_decl(comp, vm, decl);
+    if (clo == NULL)
+    {
+        printf("failed to generate code for benchmark declaration\n");
+    }
+    else
+    {
+        wist_vm_eval(vm, clo);
+    }
+    wist_handle_stack_pop(vm);
+
+    wist_parse_result_destroy(comp, result);
+    wist_ast_decl_destroy(comp, decl);
+    return clo != NULL;
+}
+
+double bench_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec * 1e3 + (double) now.tv_nsec / 1e6;
+}
@@ -0,0 +1,55 @@
+/* === bench/bench.h - Helpers shared by the benchmarks ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#ifndef _WIST_BENCH_H
+#define _WIST_BENCH_H
+
+#include <wist.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Produces [head] T [tail], where T is a complete binary tree of nodes
+ * [open] T' [sep] T' [close] of the given [depth] with a at the leaves, like
+ * "f (", ") (", ")" for calls or "(", ", ", ")" for pairs.  The source is
+ * malloc'd, and the number of nodes in T goes in [nodes_out].
+ */
+char *bench_build_tree(const char *head, const char *open, const char *sep,
+        const char *close, const char *tail, int depth, size_t *nodes_out);
+
+/*
+ * Parses [src] as an expression and generates code for it on [vm]'s current
+ * tier.  Returns NULL after saying why if either fails.
+ */
+struct wist_handle *bench_gen_expr(struct wist_compiler *comp,
+        struct wist_vm *vm, const char *src);
+
+/*
+ * Evaluates [clo] [iterations] times and prints how long each of its [calls]
+ * took, with the sum of the results to check against other runs.
+ */
+void bench_time_calls(struct wist_vm *vm, const char *name,
+        struct wist_handle *clo, size_t calls, int iterations);
+
+/*
+ * Produces g[global] = m (m (... (\x -> (x, x)))) [global], which builds a
+ * complete tree of the given [depth] out of whatever the global m doubles
+ * its argument into.  The source is malloc'd.
+ */
+char *bench_build_doubling(int global, int depth);
+
+/*
+ * Parses, generates and evaluates the declaration [src].  Returns false
+ * after saying why if it could not.
+ */
+bool bench_define(struct wist_compiler *comp, struct wist_vm *vm,
+        const char *src);
+
+/* Milliseconds on a monotonic clock, for timing single operations. */
+double bench_now_ms(void);
+
+#endif /* _WIST_BENCH_H */
@@ -0,0 +1,63 @@
+/* === bench/dispatch.c - Interpreter dispatch microbenchmark ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Builds one large closure-heavy expression and evaluates it over and over,
+ * so that the time is dominated by PUSH/ACCESS/APPLY/GRAB dispatch rather
+ * than by allocation.  Run it once against a default build and once against
+ * a `make DISPATCH=switch` build to compare the two interpreter loops, or
+ * against a `make OPSTATS=on` build to see which ops run one after another.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TREE_DEPTH 9
+#define ITERATIONS 20000
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+
+    /*
+     * (\f -> \a -> \b -> \c -> T) (\x -> \y -> \z -> x) 1 2 3, with calls
+     * f (T') b (T').  A tree keeps the argument stack shallow while still
+     * giving us thousands of instructions per evaluation.
+     */
+    size_t calls;
+    char *src = bench_build_tree("(\\f -> \\a -> \\b -> \\c -> ", "f (",
+            ") b (", ")", ") (\\x -> \\y -> \\z -> x) 1 2 3", TREE_DEPTH,
+            &calls);
+    struct wist_handle *clo = bench_gen_expr(comp, vm, src);
+    free(src);
+    if (clo == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bench_time_calls(vm, "dispatch", clo, calls, ITERATIONS);
+    /* Only builds made with OPSTATS=on count the ops, and they run slower. */
+    wist_vm_write_op_stats(vm, stdout);
+
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+    wist_ctx_destroy(ctx);
+
+    return EXIT_SUCCESS;
+}
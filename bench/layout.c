@@ -0,0 +1,94 @@
+/* === bench/layout.c - Value layout microbenchmark ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Evaluates an expression that builds a large tree of tuples, counting the
+ * bytes the collector allocates for it.  Run it once against a default build
+ * and once against a `make OBJ=wide` build to compare the tagged and the wide
+ * value layouts.  Only the fields change size, the object header does not.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TREE_DEPTH 10
+#define ITERATIONS 200
+
+/*
+ * The bytes the VM has allocated values in so far.  Most never leave the
+ * young generation, so the context's allocator never sees them.
+ */
+static size_t allocated_bytes(struct wist_vm *vm)
+{
+    struct wist_vm_gc_stats stats;
+    wist_vm_get_gc_stats(vm, &stats);
+
+    size_t bytes = 0;
+    for (int i = 0; i < WIST_VM_GC_KINDS; i++)
+    {
+        bytes += stats.allocated_bytes[i];
+    }
+    return bytes;
+}
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+
+    size_t tuples;
+    /* (\a -> T) 1, where T is a tree of pairs with a at the leaves. */
+    char *src = bench_build_tree("(\\a -> ", "(", ", ", ")", ") 1",
+            TREE_DEPTH, &tuples);
+    struct wist_handle *clo = bench_gen_expr(comp, vm, src);
+    free(src);
+    if (clo == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    size_t start_bytes = allocated_bytes(vm);
+    clock_t start = clock();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        wist_handle_stack_push(vm);
+        struct wist_handle *val = wist_vm_eval(vm, clo);
+        if (wist_handle_get_type(val) != WIST_OBJ_TUPLE)
+        {
+            printf("benchmark expression did not produce a tuple\n");
+            return EXIT_FAILURE;
+        }
+        wist_handle_stack_pop(vm);
+    }
+    clock_t end = clock();
+
+    double secs = (double) (end - start) / CLOCKS_PER_SEC;
+    double bytes = (double) (allocated_bytes(vm) - start_bytes) / ITERATIONS;
+    printf("layout: %zu byte values, %zu tuples x %d iterations in %.3fs "
+            "(%.1f ns/tuple), %.0f bytes/eval (%.1f bytes/tuple)\n",
+            wist_vm_value_size(), tuples, ITERATIONS, secs,
+            secs * 1e9 / ((double) tuples * ITERATIONS), bytes,
+            bytes / tuples);
+
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+    wist_ctx_destroy(ctx);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/* === bench/pause.c - Collector pause times ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Keeps a few large trees of tuples in globals and keeps rebuilding them,
+ * so the old heap is big and collected often, then prints how long the
+ * collector stopped evaluation for with and without a pause budget, and with
+ * marking in the background.  With a budget, it also prints how many pauses
+ * ran well over it.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TREE_DEPTH 13
+#define GLOBALS 8
+#define ITERATIONS 200
+#define BUDGET_US 100
+
+/* Doubles what [f] builds, calling it again for each half. */
+static const char double_src[] = "m = \\f -> \\x -> (f x, f x)";
+
+static struct wist_handle *gen_decl(struct wist_compiler *comp,
+        struct wist_vm *vm, const char *src, struct wist_ast_decl **decl_out,
+        struct wist_parse_result **result_out)
+{
+    *result_out = wist_compiler_parse_decl(comp, (const uint8_t *) src,
+            strlen(src), decl_out);
+    if (wist_parse_result_has_errors(*result_out))
+    {
+        printf("errors found in benchmark declaration\n");
+        return NULL;
+    }
+    return wist_compiler_vm_gen_decl(comp, vm, *decl_out);
+}
+
+static int run(struct wist_ctx *ctx, size_t budget_us, bool concurrent)
+{
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+    wist_vm_set_gc_budget(vm, budget_us);
+    if (wist_vm_set_gc_concurrent(vm, concurrent) != concurrent)
+    {
+        printf("pause: concurrent marking not supported\n");
+        wist_vm_destroy(vm);
+        wist_compiler_destroy(comp);
+        return EXIT_SUCCESS;
+    }
+
+    struct wist_ast_decl *decls[GLOBALS + 1];
+    struct wist_parse_result *results[GLOBALS + 1];
+    struct wist_handle *clos[GLOBALS];
+    struct wist_handle *m = gen_decl(comp, vm, double_src, &decls[GLOBALS],
+            &results[GLOBALS]);
+    if (m == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    wist_vm_eval(vm, m);
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        char *src = bench_build_doubling(i, TREE_DEPTH);
+        clos[i] = gen_decl(comp, vm, src, &decls[i], &results[i]);
+        free(src);
+        if (clos[i] == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    clock_t start = clock();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        wist_handle_stack_push(vm);
+        wist_vm_eval(vm, clos[i % GLOBALS]);
+        wist_handle_stack_pop(vm);
+    }
+    clock_t end = clock();
+
+    size_t pauses[WIST_VM_GC_PAUSE_BUCKETS];
+    size_t total = 0, longest = 0;
+    wist_vm_get_gc_pauses(vm, pauses);
+    for (size_t i = 0; i < WIST_VM_GC_PAUSE_BUCKETS; i++)
+    {
+        total += pauses[i];
+        if (pauses[i] > 0)
+        {
+            longest = i;
+        }
+    }
+
+    printf("pause: budget %zuus%s, %d rebuilds in %.3fs, %zu pauses, "
+            "longest under %zuus\n", budget_us,
+            concurrent ? ", concurrent marking" : "", ITERATIONS,
+            (double) (end - start) / CLOCKS_PER_SEC, total,
+            (size_t) 1 << longest);
+    printf("  us:");
+    for (size_t i = 0; i <= longest; i++)
+    {
+        printf(" <%zu:%zu", (size_t) 1 << i, pauses[i]);
+    }
+    printf("\n");
+
+    /* Bucket i holds pauses under 2^i us but not under 2^(i - 1). */
+    if (budget_us != 0)
+    {
+        size_t over = 0, from = 1;
+        while (from < WIST_VM_GC_PAUSE_BUCKETS
+                && ((size_t) 1 << (from - 1)) < budget_us)
+        {
+            from++;
+        }
+        for (size_t i = from; i < WIST_VM_GC_PAUSE_BUCKETS; i++)
+        {
+            over += pauses[i];
+        }
+        printf("  over budget: %zu of %zu pauses took %zuus or more\n",
+                over, total, (size_t) 1 << (from - 1));
+    }
+
+    for (int i = 0; i <= GLOBALS; i++)
+    {
+        wist_parse_result_destroy(comp, results[i]);
+        wist_ast_decl_destroy(comp, decls[i]);
+    }
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+
+    return EXIT_SUCCESS;
+}
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    int status = run(ctx, 0, false);
+    if (status == EXIT_SUCCESS)
+    {
+        status = run(ctx, BUDGET_US, false);
+    }
+    if (status == EXIT_SUCCESS)
+    {
+        status = run(ctx, 0, true);
+    }
+
+    wist_ctx_destroy(ctx);
+    return status;
+}
@@ -0,0 +1,68 @@
+/* === bench/teardown.c - VM teardown ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Creates VMs one after another, fills each with a tree of tuples and
+ * closures in a global, and times how long destroying them takes.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TREE_DEPTH 15
+#define VMS 50
+
+/* Doubles what [f] builds, with a closure over [x] next to the halves. */
+static const char double_src[] = "m = \\f -> \\x -> (f x, f x, \\y -> x + y)";
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    char *src = bench_build_doubling(0, TREE_DEPTH);
+    double total = 0, longest = 0;
+    for (int i = 0; i < VMS; i++)
+    {
+        struct wist_compiler *comp = wist_compiler_create(ctx);
+        struct wist_vm *vm = wist_vm_create(ctx);
+        wist_compiler_vm_connect(comp, vm);
+
+        if (!bench_define(comp, vm, double_src)
+                || !bench_define(comp, vm, src))
+        {
+            free(src);
+            return EXIT_FAILURE;
+        }
+
+        double start = bench_now_ms();
+        wist_vm_destroy(vm);
+        double time = bench_now_ms() - start;
+        total += time;
+        if (time > longest)
+        {
+            longest = time;
+        }
+
+        wist_compiler_destroy(comp);
+    }
+    free(src);
+
+    printf("teardown: %d VMs with a tree of depth %d, %.3fms a VM on "
+            "average, %.3fms at most\n", VMS, TREE_DEPTH, total / VMS,
+            longest);
+
+    wist_ctx_destroy(ctx);
+    return EXIT_SUCCESS;
+}
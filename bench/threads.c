@@ -0,0 +1,93 @@
+/* === bench/threads.c - Parallel collection ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Builds a large heap of nested tuples and closures in globals, then times
+ * full collections of it with more and more collector threads.  The VM uses
+ * no more threads than there are CPUs, so this stops early on small machines.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TREE_DEPTH 16
+#define GLOBALS 4
+#define COLLECTIONS 10
+#define MAX_THREADS 8
+
+/* Doubles what [f] builds, with a closure over [x] next to the halves. */
+static const char double_src[] = "m = \\f -> \\x -> (f x, f x, \\y -> x + y)";
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+
+    if (!bench_define(comp, vm, double_src))
+    {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        char *src = bench_build_doubling(i, TREE_DEPTH);
+        bool defined = bench_define(comp, vm, src);
+        free(src);
+        if (!defined)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    double single = 0;
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        size_t supported = wist_vm_set_gc_threads(vm, threads);
+        if (supported != threads)
+        {
+            printf("threads: %zu threads not supported, only %zu\n", threads,
+                    supported);
+            break;
+        }
+
+        double best = 0;
+        for (int i = 0; i < COLLECTIONS; i++)
+        {
+            double start = bench_now_ms();
+            wist_vm_collect(vm);
+            double time = bench_now_ms() - start;
+            if (i == 0 || time < best)
+            {
+                best = time;
+            }
+        }
+        if (threads == 1)
+        {
+            single = best;
+        }
+
+        printf("threads: %zu threads, %d trees of depth %d, best full "
+                "collection %.2fms (%.2fx)\n", threads, GLOBALS, TREE_DEPTH,
+                best, single / best);
+    }
+
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+    wist_ctx_destroy(ctx);
+
+    return EXIT_SUCCESS;
+}
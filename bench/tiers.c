@@ -0,0 +1,66 @@
+/* === bench/tiers.c - Stack tier, register tier and baseline JIT ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/*
+ * Compiles the same call and arithmetic heavy expression once for each VM
+ * tier and times evaluating it, then times the stack tier again with the JIT
+ * compiling the hot closures, so all three can be compared on identical
+ * work.  The check values must match.
+ */
+
+#include <wist.h>
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TREE_DEPTH 9
+#define ITERATIONS 20000
+
+int main()
+{
+    struct wist_ctx *ctx = wist_ctx_create();
+    if (ctx == NULL)
+    {
+        printf("failed to create wist context\n");
+        return EXIT_FAILURE;
+    }
+
+    struct wist_compiler *comp = wist_compiler_create(ctx);
+    struct wist_vm *vm = wist_vm_create(ctx);
+    wist_compiler_vm_connect(comp, vm);
+
+    size_t calls;
+    char *src = bench_build_tree("(\\f -> \\a -> ", "f (", ") (", ")",
+            ") (\\x -> \\y -> x + y + 1) 1", TREE_DEPTH, &calls);
+    wist_vm_set_tier(vm, WIST_VM_TIER_STACK);
+    struct wist_handle *stack_clo = bench_gen_expr(comp, vm, src);
+    wist_vm_set_tier(vm, WIST_VM_TIER_REG);
+    struct wist_handle *reg_clo = bench_gen_expr(comp, vm, src);
+    free(src);
+    if (stack_clo == NULL || reg_clo == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bench_time_calls(vm, "stack", stack_clo, calls, ITERATIONS);
+    bench_time_calls(vm, "register", reg_clo, calls, ITERATIONS);
+    if (wist_vm_set_jit(vm, true))
+    {
+        bench_time_calls(vm, "stack jit", stack_clo, calls, ITERATIONS);
+    }
+    else
+    {
+        printf("stack jit: not supported by this build\n");
+    }
+
+    wist_vm_destroy(vm);
+    wist_compiler_destroy(comp);
+    wist_ctx_destroy(ctx);
+
+    return EXIT_SUCCESS;
+}
@@ -68,6 +68,24 @@ enum wist_ast_expr_kind {
     WIST_AST_EXPR_LET,
     WIST_AST_EXPR_INT,
     WIST_AST_EXPR_TUPLE,
+    WIST_AST_EXPR_BINOP,
+};
+
+/* Every binary operator takes two integers and returns an integer. */
+enum wist_ast_binop_kind {
+    WIST_AST_BINOP_ADD,
+    WIST_AST_BINOP_SUB,
+    WIST_AST_BINOP_MUL,
+    WIST_AST_BINOP_DIV,
+    WIST_AST_BINOP_REM,
+
+    /* Comparisons return 1 when they hold and 0 otherwise. */
+    WIST_AST_BINOP_LT,
+    WIST_AST_BINOP_LE,
+    WIST_AST_BINOP_GT,
+    WIST_AST_BINOP_GE,
+    WIST_AST_BINOP_EQ,
+    WIST_AST_BINOP_NE,
 };
 
 struct wist_ast_expr {
@@ -117,6 +135,11 @@ struct wist_ast_expr {
         struct {
             struct wist_vector fields; /* struct wist_ast_expr * */
         } tuple;
+
+        struct {
+            enum wist_ast_binop_kind op;
+            struct wist_ast_expr *lhs, *rhs;
+        } binop;
     };
 };
 
@@ -160,6 +183,10 @@ struct wist_ast_expr *wist_ast_create_let(struct wist_compiler *comp,
         struct wist_srcloc loc, struct wist_sym *sym, struct wist_ast_expr *val,
         struct wist_ast_expr *body);
 
+struct wist_ast_expr *wist_ast_create_binop(struct wist_compiler *comp, 
+        struct wist_srcloc loc, enum wist_ast_binop_kind op, 
+        struct wist_ast_expr *lhs, struct wist_ast_expr *rhs);
+
 struct wist_ast_type *wist_ast_create_fun_type(struct wist_compiler *comp,
         struct wist_ast_type *in, struct wist_ast_type *out);
 struct wist_ast_type *wist_ast_create_var_type(struct wist_compiler *comp);
@@ -22,6 +22,19 @@ enum wist_token_kind {
     WIST_TOKEN_COMMA,      /* , */
     WIST_TOKEN_EQ,         /* = */
 
+    /* Operators. */
+    WIST_TOKEN_PLUS,       /* + */
+    WIST_TOKEN_MINUS,      /* - */
+    WIST_TOKEN_STAR,       /* * */
+    WIST_TOKEN_SLASH,      /* / */
+    WIST_TOKEN_PERCENT,    /* % */
+    WIST_TOKEN_LT,         /* < */
+    WIST_TOKEN_LT_EQ,      /* <= */
+    WIST_TOKEN_GT,         /* > */
+    WIST_TOKEN_GT_EQ,      /* >= */
+    WIST_TOKEN_EQ_EQ,      /* == */
+    WIST_TOKEN_BANG_EQ,    /* != */
+
     /* Keywords. */
     WIST_TOKEN_LET,        /* let */
     WIST_TOKEN_IN,         /* in */
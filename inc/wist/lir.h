@@ -10,6 +10,7 @@
 #include <wist.h>
 #include <wist/defs.h>
 #include <wist/vector.h>
+#include <wist/srcloc.h>
 
 enum wist_lir_expr_kind {
     WIST_LIR_EXPR_LAM,
@@ -19,14 +20,32 @@ enum wist_lir_expr_kind {
     WIST_LIR_EXPR_LET,
     WIST_LIR_EXPR_INT,
     WIST_LIR_EXPR_MKB,
+    WIST_LIR_EXPR_PRIM,
 };
 
 enum wist_lir_block_kind {
     WIST_LIR_BLOCK_TUPLE,
 };
 
+/* Integer primitives, in the same order as enum wist_ast_binop_kind. */
+enum wist_lir_prim_kind {
+    WIST_LIR_PRIM_ADD,
+    WIST_LIR_PRIM_SUB,
+    WIST_LIR_PRIM_MUL,
+    WIST_LIR_PRIM_DIV,
+    WIST_LIR_PRIM_REM,
+    WIST_LIR_PRIM_LT,
+    WIST_LIR_PRIM_LE,
+    WIST_LIR_PRIM_GT,
+    WIST_LIR_PRIM_GE,
+    WIST_LIR_PRIM_EQ,
+    WIST_LIR_PRIM_NE,
+};
+
 struct wist_lir_expr {
     enum wist_lir_expr_kind t;
+    /* Where lambdas and blocks came from, for the heap profiler. */
+    struct wist_srcloc loc;
 
     union {
         struct {
@@ -35,6 +54,13 @@ struct wist_lir_expr {
 
         struct {
             struct wist_lir_expr *body;
+            /* 
+             * The slots, in the scope enclosing the lambda, of every free 
+             * variable the lambda's closure must capture.  Filled in by 
+             * wist_lir_resolve_captures, and always empty for lambdas that 
+             * share the frame of their enclosing lambda (see there).
+             */
+            struct wist_vector captures; /* int */
         } lam;
 
         struct {
@@ -44,11 +70,17 @@ struct wist_lir_expr {
 
         struct {
             struct wist_lir_expr *origin;
+            /* 
+             * The de Bruijn index of the binder, which is also the variable's 
+             * slot at runtime: the innermost locals come first, followed by 
+             * the fields of the flat closure environment.
+             */
             int index;
         } var;
 
         struct {
             struct wist_sym *sym;
+            uint32_t slot; /* The global's slot in the toplevel. */
         } gvar;
 
         struct {
@@ -59,6 +91,11 @@ struct wist_lir_expr {
         struct {
             int64_t val;
         } i;
+
+        struct {
+            enum wist_lir_prim_kind t;
+            struct wist_lir_expr *lhs, *rhs;
+        } prim;
     };
 };
 
@@ -76,17 +113,44 @@ struct wist_lir_expr *wist_lir_create_let(struct wist_compiler *comp,
 struct wist_lir_expr *wist_lir_create_var(struct wist_compiler *comp,
         int index, struct wist_lir_expr *origin);
 struct wist_lir_expr *wist_lir_create_gvar(struct wist_compiler *comp,
-        struct wist_sym *sym);
+        struct wist_sym *sym, uint32_t slot);
 struct wist_lir_expr *wist_lir_create_mkb(struct wist_compiler *comp,
         enum wist_lir_block_kind t, struct wist_vector mkb);
 struct wist_lir_expr *wist_lir_create_int(struct wist_compiler *comp, 
         int64_t i);
+struct wist_lir_expr *wist_lir_create_prim(struct wist_compiler *comp,
+        enum wist_lir_prim_kind t, struct wist_lir_expr *lhs, 
+        struct wist_lir_expr *rhs);
 
 /* === LIR GENERATION === */
 
 struct wist_lir_expr *wist_compiler_lir_gen_expr(struct wist_compiler *comp, 
         struct wist_ast_expr *expr);
 
+/* 
+ * Runs free variable analysis over [expr], filling in the capture set of 
+ * every lambda that becomes a closure and rewriting every variable's index to 
+ * its final slot: locals of the enclosing function first, then its captures 
+ * in capture order. 
+ *
+ * A lambda that is the body of another lambda, or the tail of one through 
+ * any number of lets, is entered by GRAB and shares that lambda's frame 
+ * rather than being allocated as a closure of its own. 
+ */
+void wist_lir_resolve_captures(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr);
+
+/* 
+ * Checks if the primitive [expr] can take one of its operands as a 32 bit 
+ * immediate.  If so, [t_out] is the primitive to run with [operand_out] as 
+ * the left operand and [imm_out] as the right, which is rewritten from the 
+ * original when the constant was on the left or [expr] subtracts.  Only 
+ * add and the comparisons have immediate forms.
+ */
+bool wist_lir_prim_imm_form(struct wist_lir_expr *expr, 
+        enum wist_lir_prim_kind *t_out, struct wist_lir_expr **operand_out, 
+        int32_t *imm_out);
+
 /* === PRETTY PRINTING === */
 
 void wist_lir_print_expr(struct wist_lir_expr *expr);
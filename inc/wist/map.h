@@ -52,6 +52,7 @@ static struct wist_map_entry *wist_map_einsert(struct wist_ctx *ctx,
         if (map->key_eq(entry->data, key)) {
             return NULL;
         }
+        entry = entry->next;
     }
 
     entry = 
@@ -78,6 +79,7 @@ static struct wist_map_entry *wist_map_efind(struct wist_ctx *ctx,
         if (map->key_eq(entry->data, key)) {
             return entry;
         }
+        entry = entry->next;
     }
 
     return NULL;
@@ -59,4 +59,11 @@ struct wist_srcloc wist_srcloc_index_combine(struct wist_ctx *ctx,
 const uint8_t *wist_srcloc_index_slice(struct wist_srcloc_index *index, 
         struct wist_srcloc loc, size_t *str_len_out);
 
+/* 
+ * Finds the line and column, both from 1, that [loc] starts at in the text 
+ * it was parsed from.  Returns false if it is in none of the segments. 
+ */
+bool wist_srcloc_index_locate(struct wist_srcloc_index *index, 
+        struct wist_srcloc loc, size_t *line_out, size_t *col_out);
+
 #endif /* _WIST_SRCLOC_H */
@@ -11,9 +11,14 @@
 #include <wist/ast.h>
 #include <wist/vm_obj.h>
 
+/* 
+ * Every global gets a dense slot number when it is first declared, and its 
+ * value lives in [slots] of the owning wist_toplvl.  Generated code refers to 
+ * globals by slot, so the VM never has to look a symbol up while running. 
+ */
 struct wist_toplvl_entry {
     struct wist_ast_type *type;
-    struct wist_vm_obj val;
+    uint32_t slot;
 };
 
 struct wist_toplvl_scope {
@@ -23,15 +28,26 @@ struct wist_toplvl_scope {
 struct wist_toplvl {
     struct wist_toplvl_scope global;
     struct wist_ctx *ctx;
+    struct wist_vector slots; /* struct wist_vm_obj */
+    struct wist_vector slot_syms; /* struct wist_sym *, for debug printing. */
 };
 
 
 void wist_toplvl_init(struct wist_ctx *ctx, struct wist_toplvl *toplvl);
 void wist_toplvl_finish(struct wist_toplvl *toplvl);
 
+/* 
+ * Adds a global, or returns the existing entry if [sym] is already defined 
+ * so that redefining a global reuses its slot. 
+ */
 struct wist_toplvl_entry *wist_toplvl_add(struct wist_toplvl *toplvl, 
         struct wist_sym *sym);
 struct wist_toplvl_entry *wist_toplvl_find(struct wist_toplvl *toplvl, 
         struct wist_sym *sym);
 
+#define WIST_TOPLVL_SLOT(_toplvl, _slot)                                       \
+    (WIST_VECTOR_DATA(&(_toplvl)->slots, struct wist_vm_obj)[_slot])
+#define WIST_TOPLVL_SLOT_SYM(_toplvl, _slot)                                   \
+    (WIST_VECTOR_DATA(&(_toplvl)->slot_syms, struct wist_sym *)[_slot])
+
 #endif /* _WIST_TOPLEVEL_H */
@@ -109,6 +109,8 @@ static void wist_vector_fix_size(struct wist_ctx *ctx, struct wist_vector *vec)
 #define WIST_VECTOR_INDEX(_vec, _type, _idx)                                   \
     ((_type *) wist_vector_index(_vec, sizeof(_type), _idx))
 
+#define WIST_VECTOR_POP(_vec, _type) ((_vec)->data_used -= sizeof(_type))
+
 #define WIST_VECTOR_FINISH(_ctx, _vec) wist_vector_finish(_ctx, _vec)
 
 #define WIST_VECTOR_FIX_SIZE(_ctx, _vec) wist_vector_fix_size(_ctx, _vec)
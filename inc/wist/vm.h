@@ -10,11 +10,18 @@
 #include <wist.h>
 #include <wist/vm_obj.h>
 #include <wist/vm_gc.h>
+#include <wist/vm_code.h>
+#include <wist/vm_jit.h>
+#include <wist/vm_prof.h>
 #include <wist/lexer.h>
 
 #define WIST_MAX_HANDLE_FRAMES 256
 #define WIST_HANDLES_PER_FRAME 32
 
+/* The VM stacks start with this many entries, and double as they grow. */
+#define WIST_VM_STACK_SEGMENT 1024
+#define WIST_VM_DEFAULT_STACK_LIMIT (1024 * 1024)
+
 struct wist_handle {
     struct wist_vm_obj obj;
 };
@@ -25,23 +32,92 @@ struct wist_handle_frame {
     size_t cur_handle;
 };
 
+/* 
+ * An entry on the return stack, which is either a saved caller frame or one 
+ * local (a grabbed argument or a let binding) of the running function. 
+ */
+struct wist_vm_ret_frame {
+    union {
+        struct {
+            struct wist_vm_obj env;
+            uint32_t *pc;
+            int extra_args;
+        } frame;
+        struct wist_vm_obj env;
+    };
+};
+
+struct wist_vm_reg_frame;
+
 struct wist_vm {
     struct wist_ctx *ctx;
     struct wist_vm_gc gc;
     struct wist_vector handles;
-    struct wist_vector code_area;
+    /* Stack tier code, see vm_code.h. */
+    struct wist_vm_code_area code_area;
     struct wist_toplvl *toplvl;
 
     struct wist_handle_frame frames[WIST_MAX_HANDLE_FRAMES];
     size_t cur_frame;
+
+    /* 
+     * The stacks are owned by the VM rather than the C stack, so they can 
+     * grow on demand.  [arg_sp] and [ret_sp] are the first free entries 
+     * whenever the interpreter is not running. 
+     */
+    struct wist_vm_obj *arg_stack;
+    struct wist_vm_ret_frame *ret_stack;
+    size_t arg_stack_len, ret_stack_len;
+    size_t arg_sp, ret_sp;
+    size_t stack_limit;
+    enum wist_vm_err err;
+
+    /* The APPLY; RETURN stub for wist_vm_apply. */
+    uint32_t *apply_stub;
+    /* The RESTART every partial application runs. */
+    uint32_t *restart_stub;
+
+    /* The register tier, see vm_reg.h. */
+    enum wist_vm_tier tier;
+    struct wist_vector reg_code_area;
+    struct wist_vm_obj *reg_stack;
+    struct wist_vm_reg_frame *reg_frames;
+    size_t reg_stack_len, reg_frames_len;
+    size_t reg_sp, reg_frame_sp;
+
+    /* Native code for hot stack tier closures, see vm_jit.h. */
+    struct wist_vm_jit jit;
+    /* Where stack tier code allocates, see vm_prof.h. */
+    struct wist_vm_prof prof;
+
+#ifdef WIST_VM_OP_STATS
+    /* 
+     * How many times each pair and triple of ops ran one after the other, 
+     * indexed by the ops in order in base __WIST_VM_OP_COUNT. 
+     */
+    uint64_t *op_pairs, *op_triples;
+#endif
 };
 
 struct wist_vm_obj wist_vm_interpret(struct wist_vm *vm, 
         struct wist_vm_obj closure);
 
+/* 
+ * Applies [fun] to [arg] on the stack tier, for callers that are not running 
+ * stack tier code themselves. 
+ */
+struct wist_vm_obj wist_vm_apply(struct wist_vm *vm, struct wist_vm_obj fun,
+        struct wist_vm_obj arg);
+
 struct wist_handle *wist_vm_add_handle(struct wist_vm *vm);
 
-#define WIST_VM_OBJ_CLO_PC(_vm, _obj)                                          \
-    WIST_VECTOR_INDEX(&(_vm)->code_area, uint8_t, WIST_VM_OBJ_FIELD2(_obj).idx)
+/* 
+ * Returns the stack length that fits [needed] entries, doubling [cur_len] up 
+ * to the VM's stack limit, or 0 if [needed] would pass the limit. 
+ */
+size_t wist_vm_stack_grow_len(struct wist_vm *vm, size_t cur_len, 
+        size_t needed);
+
+#define WIST_VM_OBJ_CLO_PC(_obj) WIST_VM_OBJ_GET_CODE(WIST_VM_OBJ_FIELD2(_obj))
 
 #endif /* _WIST_VM_H */
@@ -0,0 +1,76 @@
+/* === inc/wist/vm_code.h - Stack tier code area ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#ifndef _WIST_VM_CODE_H
+#define _WIST_VM_CODE_H
+
+#include <wist.h>
+#include <wist/vm_gc.h>
+
+/*
+ * Stack tier code, in instruction words (see vm_obj.h), never moves once it
+ * is added, so closures point straight at their code, and code can run while
+ * more is added.  Offsets into the area name instructions for the JIT and the
+ * heap profiler, and only ever grow as code is added.
+ *
+ * Where there is mmap, the whole area is reserved up front without access,
+ * and committed a chunk at a time as it fills.  Otherwise it is a chain of
+ * chunks from the context's allocator, each twice as big as the last, with
+ * chunk k at offset WIST_VM_CODE_CHUNK_WORDS * (2^k - 1).
+ */
+#ifdef WIST_VM_GC_MMAP
+#define WIST_VM_CODE_MMAP
+#endif
+/* The most words of code a VM can hold, so offsets fit in 32 bits. */
+#define WIST_VM_CODE_AREA_WORDS ((size_t) 256 * 1024 * 1024)
+/* Words are committed, or the first chunk is allocated, this many at a time. */
+#define WIST_VM_CODE_CHUNK_WORDS ((size_t) 16 * 1024)
+/* Enough doubling chunks to hold the whole area. */
+#define WIST_VM_CODE_CHUNK_COUNT 15
+
+struct wist_vm_code_area {
+#ifdef WIST_VM_CODE_MMAP
+    uint32_t *base;
+#else
+    /* NULL for the chunks that were skipped over or not needed yet. */
+    uint32_t *chunks[WIST_VM_CODE_CHUNK_COUNT];
+    int chunk_count;
+#endif
+    /* The offsets of the end of the code, and of what can be written to. */
+    size_t len, committed;
+};
+
+struct wist_vm;
+
+/*
+ * Converts between pointers to code and offsets into the area.  Both must
+ * name code in the area.
+ */
+#ifdef WIST_VM_CODE_MMAP
+#define WIST_VM_CODE_OFFSET(_vm, _pc)                                          \
+    ((size_t) ((_pc) - (_vm)->code_area.base))
+#define WIST_VM_CODE_AT(_vm, _offset) ((_vm)->code_area.base + (_offset))
+#else
+#define WIST_VM_CODE_OFFSET(_vm, _pc)                                          \
+    wist_vm_code_offset(&(_vm)->code_area, (_pc))
+#define WIST_VM_CODE_AT(_vm, _offset)                                          \
+    wist_vm_code_at(&(_vm)->code_area, (_offset))
+
+size_t wist_vm_code_offset(struct wist_vm_code_area *area, const uint32_t *pc);
+uint32_t *wist_vm_code_at(struct wist_vm_code_area *area, size_t offset);
+#endif
+
+void wist_vm_code_init(struct wist_vm *vm);
+void wist_vm_code_finish(struct wist_vm *vm);
+
+/*
+ * Copies [len] words of code to the end of the code area, starting 8 byte
+ * aligned.  Returns where they start, or NULL if the area is full.
+ */
+uint32_t *wist_vm_code_add(struct wist_vm *vm, const uint32_t *code,
+        size_t len);
+
+#endif /* _WIST_VM_CODE_H */
@@ -1,4 +1,4 @@
-/* === inc/wist/vm_gc.h - VM garbage collector === 
+/* === inc/wist/vm_gc.h - VM garbage collector ===
  * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
  * Part of the Wist reference implementation, under the MIT license.
  * See LICENSE.txt for license information.
@@ -9,31 +9,304 @@
 
 #include <wist.h>
 #include <wist/defs.h>
+#include <wist/vector.h>
 #include <wist/vm_obj.h>
 
-/* This is a fake garbage collector that just allocates a linked list of items. */
+/*
+ * A generational collector.  New objects are bump allocated in a fixed size
+ * nursery, and a minor collection copies the ones still reachable into the
+ * old space and empties it.  The old space is collected by mark and sweep
+ * once it has grown enough, either all at once or, with a pause budget set,
+ * a little at a time between safe points and allocations.
+ *
+ * Small old objects live in pages of equally sized slots, one list of pages
+ * for each field count up to WIST_VM_GC_SMALL_FIELDS, so sweeping them is a
+ * linear scan and a freed slot is reused by the next object of its size.
+ * Bigger objects are allocated on their own and kept on the [large] list.
+ * Where there is mmap, pages are cut from big aligned regions mapped for
+ * the heap alone, so tearing it down is one munmap a region.  The regions
+ * left empty by a major collection are handed back to the OS, and mapped
+ * regions may ask for transparent huge pages.
+ * Compacting slides the live objects of each size class into as few pages
+ * as they fit in, each to the slot its [next] was pointed at first, and
+ * frees the rest.
+ *
+ * Objects are never changed after they are filled in, so the only old
+ * objects that can point into the nursery are ones allocated in the old
+ * space while it is in use, when an object does not fit.  Those are kept in
+ * [remembered] until the next minor collection.
+ *
+ * Old objects are white, gray or black by their mark.  Which of the two
+ * black values means black changes with every major collection, so the
+ * survivors of the last one are white again without touching them, and new
+ * objects are always allocated black.  Marking starts from the stacks,
+ * handles and temporary roots at a safe point; because objects are never
+ * changed, everything reachable from there is still reachable by the time
+ * marking gets to it.  The globals are scanned as marking goes instead, so
+ * SETGLOBAL shades the value it overwrites with WIST_VM_GC_BARRIER.
+ *
+ * With concurrent marking on, the globals are shaded with the other roots
+ * instead, and a thread of its own then marks while evaluation goes on.
+ * Nothing the marker reads changes under it: it only scans objects from
+ * before the snapshot, and it only writes their marks, which have a byte of
+ * their own.  The interpreter notices that it is done at the next step and
+ * sweeps a little at every step from then on, even without a budget.  With
+ * one CPU there is no thread, and the steps mark a little at a time too.
+ *
+ * Collections that run to the end at once can mark and sweep on several
+ * threads.  Workers claim white objects by their mark, keep the gray ones
+ * they find to themselves, and share half of them once they have enough or
+ * another worker runs out, which then steals them.
+ *
+ * Allocating never collects or moves anything, but it may mark or sweep.
+ * The interpreters check WIST_VM_GC_DUE at safe points, where every live
+ * value is on a VM stack, in a handle, in a global or in a temporary root
+ * pushed with wist_vm_gc_push_root.  Collections move objects, so anything
+ * read from a root must be read again afterwards.
+ */
+
+/* Major collections are not started before this many old bytes. */
+#define WIST_VM_GC_MIN_HEAP (1024 * 1024)
+/* The old space may grow to this multiple of the live bytes before collecting. */
+#define WIST_VM_GC_GROWTH 2
+#define WIST_VM_GC_NURSERY_SIZE (256 * 1024)
+/* A minor collection is due at the next safe point within this of the end. */
+#define WIST_VM_GC_NURSERY_SLACK (4 * 1024)
+/* With a pause budget, minor collections are due no sooner than this. */
+#define WIST_VM_GC_MIN_DUE (16 * 1024)
+
+/* The mark of a nursery object that was copied, with the copy in [next]. */
+#define WIST_VM_GC_FORWARDED 2
+/* The mark of an old object that is still to be scanned. */
+#define WIST_VM_GC_GRAY 2
+/* The two marks that take turns meaning black. */
+#define WIST_VM_GC_BLACK_A 1
+#define WIST_VM_GC_BLACK_B 3
+
+/*
+ * Parallel and concurrent marking need pthreads.  Building with
+ * WIST_VM_GC_NO_THREADS defined leaves it out everywhere.
+ */
+#if defined(__unix__) && !defined(WIST_VM_GC_NO_THREADS)
+#define WIST_VM_GC_THREADS
+#endif
+#define WIST_VM_GC_MAX_THREADS 64
+
+#ifdef WIST_VM_GC_THREADS
+#include <pthread.h>
+#endif
+
+/* While a major collection is running, allocation steps it this often. */
+#define WIST_VM_GC_STEP_BYTES (16 * 1024)
+/* How much marking or sweeping is done between looks at the clock. */
+#define WIST_VM_GC_CLOCK_WORK 1024
+/* Without a budget, sweeping after background marking steps this long. */
+#define WIST_VM_GC_SWEEP_US 200
+
+/* Objects with more fields than this go in the large object space. */
+#define WIST_VM_GC_SMALL_FIELDS 8
+#define WIST_VM_GC_PAGE_SIZE (16 * 1024)
+/* The tag of a free page slot, which is on its class's free list by [next]. */
+#define WIST_VM_GC_FREE_TAG 0xff
+
+/*
+ * Pages come from regions mapped with mmap, or one at a time from the
+ * context's allocator in builds with WIST_VM_GC_NO_MMAP defined.
+ */
+#if defined(__unix__) && !defined(WIST_VM_GC_NO_MMAP)
+#define WIST_VM_GC_MMAP
+#if defined(__linux__)
+#define WIST_VM_GC_HUGE_PAGES
+#endif
+#endif
+/* Regions are aligned to their size, which is one x86-64 huge page. */
+#define WIST_VM_GC_REGION_SIZE (2 * 1024 * 1024)
+#define WIST_VM_GC_REGION_PAGES (WIST_VM_GC_REGION_SIZE / WIST_VM_GC_PAGE_SIZE)
 
 struct wist_vm_gc_hdr {
-    uint8_t mark : 2;
-    uint32_t field_count: 22;
-    uint8_t tag : 8;
+    uint8_t mark;
+    uint8_t tag;
+    /* The heap profiler's site for sampled objects, see vm_prof.h, else 0. */
+    uint16_t site;
+    uint32_t field_count;
     struct wist_vm_gc_hdr *next;
     struct wist_vm_obj fields[];
 };
 
+#define WIST_VM_GC_HDR_SIZE(_field_count)                                      \
+    (sizeof(struct wist_vm_gc_hdr)                                             \
+     + sizeof(struct wist_vm_obj) * (_field_count))
+
+/* A page of slots for objects of [field_count] fields, which follow it. */
+struct wist_vm_gc_page {
+    struct wist_vm_gc_page *next;
+    uint32_t field_count, slot_count;
+    struct wist_vm_gc_hdr *free;
+    /* The region it was cut from, or NULL if it came from the allocator. */
+    struct wist_vm_gc_region *region;
+};
+
+/*
+ * The bookkeeping of a region lives outside it, so nothing is lost when an
+ * empty region is given back to the OS.
+ */
+struct wist_vm_gc_region {
+    struct wist_vm_gc_region *next;
+    uint8_t *base;
+    /* A bit for each page in use, and how many that is. */
+    uint64_t used[WIST_VM_GC_REGION_PAGES / 64];
+    size_t used_count;
+    /* Whether the pages are given back, and read as zero when next used. */
+    bool released;
+};
+
+/* The pages of one size class, with the first that may have free slots. */
+struct wist_vm_gc_class {
+    struct wist_vm_gc_page *pages, *alloc;
+};
+
+enum wist_vm_gc_phase {
+    WIST_VM_GC_IDLE,
+    WIST_VM_GC_MARK,
+    /* Marking on the marker thread, which owns [gray] until [marked]. */
+    WIST_VM_GC_BACKGROUND,
+    WIST_VM_GC_SWEEP,
+};
+
+/* [count] values starting at [objs] that a collection must keep alive. */
+struct wist_vm_gc_root {
+    struct wist_vm_obj *objs;
+    size_t count;
+};
+
 struct wist_vm_gc {
     struct wist_ctx *ctx;
-    struct wist_vm_gc_hdr *objs;
+
+    uint8_t *nursery, *nursery_top, *nursery_due, *nursery_end;
+    /* Where bump allocation stops to step a running major collection. */
+    uint8_t *nursery_limit;
+    struct wist_vector remembered; /* struct wist_vm_gc_hdr * */
+
+    struct wist_vm_gc_class classes[WIST_VM_GC_SMALL_FIELDS + 1];
+    struct wist_vm_gc_hdr *large;
+    struct wist_vm_gc_region *regions;
+    /* Whether regions mapped from now on ask for transparent huge pages. */
+    bool huge_pages;
+    /* The bytes in old objects, live or not, and when to collect next. */
+    size_t bytes_allocated, next_collect;
+    /*
+     * What has been done so far, less the objects allocated since the last
+     * minor collection, which are only counted by kind when it empties the
+     * nursery.  See wist_vm_gc_get_stats.
+     */
+    struct wist_vm_gc_stats stats;
+    wist_vm_gc_fn callback;
+    void *callback_ud;
+    /* Set when a major collection finishes, until the callback hears of it. */
+    bool major_done;
+
+    enum wist_vm_gc_phase phase;
+    uint8_t black;
+    /* The most a pause may take in microseconds, or 0 for no limit. */
+    size_t budget_us;
+    /* The threads that mark and sweep when there is no limit. */
+    size_t threads;
+    /* Whether major collections mark on a thread of their own. */
+    bool concurrent;
+#ifdef WIST_VM_GC_THREADS
+    pthread_t marker;
+    /* Set by the marker once there is nothing gray left. */
+    bool marked;
+#endif
+    /* The old bytes when marking started and the bytes marked since. */
+    size_t bytes_at_start, bytes_marked;
+    /* The globals, and how many of them marking has scanned. */
+    struct wist_vector *globals; /* struct wist_vm_obj */
+    size_t globals_scanned;
+    /* The next size class and link to sweep, then the large objects. */
+    size_t sweep_class;
+    struct wist_vm_gc_page **sweep_page;
+    struct wist_vm_gc_hdr **sweep_large;
+
+    struct wist_vector roots; /* struct wist_vm_gc_root */
+    /* Old objects whose fields are still to be marked. */
+    struct wist_vector gray; /* struct wist_vm_gc_hdr * */
+    /* Nursery copies whose fields are still to be copied. */
+    struct wist_vector copied; /* struct wist_vm_gc_hdr * */
 };
 
 
 void wist_vm_gc_init(struct wist_ctx *ctx, struct wist_vm_gc *gc);
 void wist_vm_gc_finish(struct wist_vm_gc *gc);
 
-struct wist_vm_gc_hdr *wist_vm_gc_alloc(struct wist_vm_gc *gc, 
+/*
+ * Allocates in the nursery if there is room, and the old space if not.  This
+ * is also where a running major collection is stepped.
+ */
+struct wist_vm_gc_hdr *wist_vm_gc_alloc(struct wist_vm_gc *gc,
         size_t field_count);
 
+/* The inline fast path of wist_vm_gc_alloc, used by WIST_VM_GC_ALLOC. */
+static inline struct wist_vm_gc_hdr *wist_vm_gc_bump(struct wist_vm_gc *gc,
+        size_t field_count) {
+    size_t size = WIST_VM_GC_HDR_SIZE(field_count);
+    if ((size_t) (gc->nursery_limit - gc->nursery_top) < size) {
+        return wist_vm_gc_alloc(gc, field_count);
+    }
+
+    struct wist_vm_gc_hdr *new = (struct wist_vm_gc_hdr *) gc->nursery_top;
+    gc->nursery_top += size;
+    new->mark = 0x0;
+    new->site = 0;
+    new->field_count = field_count;
+    return new;
+}
+
+/*
+ * Collects the garbage of [vm], which must be stopped at a safe point.  This
+ * empties the nursery, and collects the old space too if it is due.
+ */
+void wist_vm_gc_collect(struct wist_vm *vm);
+/* The same, but always collecting the old space. */
+void wist_vm_gc_collect_full(struct wist_vm *vm);
+/* A full collection, then compacts the small old objects. */
+void wist_vm_gc_compact(struct wist_vm *vm);
+
+/*
+ * Calls [visit] with every old object, which are all live after a full
+ * collection.
+ */
+typedef void (*wist_vm_gc_walk_fn)(void *ud, struct wist_vm_gc_hdr *hdr);
+void wist_vm_gc_walk(struct wist_vm_gc *gc, wist_vm_gc_walk_fn visit,
+        void *ud);
+
+/* Fills in [stats] with everything allocated up to now counted. */
+void wist_vm_gc_get_stats(struct wist_vm_gc *gc,
+        struct wist_vm_gc_stats *stats);
+
+/* Shades [obj] gray if it is white, see WIST_VM_GC_BARRIER. */
+void wist_vm_gc_shade(struct wist_vm_gc *gc, struct wist_vm_obj obj);
+
+/* The CPUs online, which no more threads than are used to collect. */
+size_t wist_vm_gc_cpus(void);
+
+/* Temporary roots are pushed and popped in stack order. */
+void wist_vm_gc_push_root(struct wist_vm_gc *gc, struct wist_vm_obj *objs,
+        size_t count);
+void wist_vm_gc_pop_root(struct wist_vm_gc *gc);
+
 #define WIST_VM_GC_ALLOC(_gc, _field_count, _type) wist_vm_obj_create_gc(      \
-        _type, wist_vm_gc_alloc(_gc, _field_count))
+        _type, wist_vm_gc_bump(_gc, _field_count))
+
+/*
+ * Must come before a global holding [_old] is overwritten.  Marking in the
+ * background shaded every global when it started, so it needs nothing.
+ */
+#define WIST_VM_GC_BARRIER(_gc, _old)                                          \
+    ((_gc)->phase == WIST_VM_GC_MARK ? wist_vm_gc_shade(_gc, _old) : (void) 0)
+
+#define WIST_VM_GC_DUE(_gc)                                                    \
+    ((_gc)->nursery_top >= (_gc)->nursery_due                                  \
+     || (_gc)->bytes_allocated >= (_gc)->next_collect)
 
 #endif /* _WIST_VM_GC_H */
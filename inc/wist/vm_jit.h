@@ -0,0 +1,91 @@
+/* === inc/wist/vm_jit.h - Baseline JIT for the stack VM ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#ifndef _WIST_VM_JIT_H
+#define _WIST_VM_JIT_H
+
+#include <wist.h>
+#include <wist/vector.h>
+#include <wist/vm_obj.h>
+
+#include <stdio.h>
+
+/*
+ * The JIT emits x86-64 code that works on tagged values directly, so it is
+ * only built for that target with the default value layout.  Building with
+ * WIST_VM_NO_JIT defined leaves it out everywhere.
+ */
+#if defined(__x86_64__) && defined(__linux__) && !defined(WIST_VM_WIDE_OBJ) \
+    && !defined(WIST_VM_NO_JIT)
+#define WIST_VM_JIT
+#endif
+
+/* How many times a closure is entered before it is compiled. */
+#define WIST_VM_JIT_HOT_COUNT 64
+/* Executable memory is mapped in chunks of this many bytes. */
+#define WIST_VM_JIT_CHUNK_SIZE (64 * 1024)
+/* The table of closures entered starts this big, and doubles when half full. */
+#define WIST_VM_JIT_ENTRIES_LEN 64
+
+struct wist_vm_ret_frame;
+
+/*
+ * The interpreter registers native code reads on entry and writes back when
+ * it hands control to the interpreter again.
+ */
+struct wist_vm_jit_state {
+    struct wist_vm *vm;
+    struct wist_vm_obj accum, env;
+    struct wist_vm_obj *asp, *arg_end;
+    struct wist_vm_ret_frame *rsp, *ret_end;
+    uint32_t extra_args;
+};
+
+/*
+ * Native code for a closure runs from the closure's first instruction up to
+ * the first one it leaves to the interpreter, usually an APPLY or RETURN, and
+ * returns the code area offset of that instruction.
+ */
+typedef size_t (*wist_vm_jit_fn)(struct wist_vm_jit_state *state);
+
+struct wist_vm_jit_entry {
+    /* The code area offset of the closure, or SIZE_MAX in a free slot. */
+    size_t offset;
+    wist_vm_jit_fn fn;
+    uint16_t count;
+    /* Set when the code at this offset is not worth compiling. */
+    bool rejected;
+};
+
+struct wist_vm_jit_chunk {
+    struct wist_vm_jit_chunk *next;
+    uint8_t *mem;
+    size_t used;
+};
+
+struct wist_vm_jit {
+    bool enabled;
+    /*
+     * An open addressed table of the closures that were entered, so it grows
+     * with the closures that run rather than with the code area.
+     */
+    struct wist_vm_jit_entry *entries;
+    size_t entries_len, entries_used;
+    struct wist_vm_jit_chunk *chunks;
+    /* The perf map for this process, opened with the first compilation. */
+    FILE *perf_map;
+};
+
+void wist_vm_jit_init(struct wist_vm *vm);
+void wist_vm_jit_finish(struct wist_vm *vm);
+
+/*
+ * Counts an entry to the closure code at [offset], compiling it once it is
+ * hot.  Returns its native code, or NULL if there is none (yet).
+ */
+wist_vm_jit_fn wist_vm_jit_enter(struct wist_vm *vm, size_t offset);
+
+#endif /* _WIST_VM_JIT_H */
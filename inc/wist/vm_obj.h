@@ -19,6 +19,44 @@ enum wist_vm_op {
 __WIST_VM_OP_COUNT /* The number of opcodes. */
 };
 
+/* How many bits of operand each ordinary op keeps in its instruction word. */
+enum wist_vm_op_arg_bits {
+#define OPCODE(name, bits) WIST_VM_ARG_BITS_##name = bits,
+#define SUPEROP(first, second)
+#include <wist/vm_ops.h>
+#undef SUPEROP
+#undef OPCODE
+};
+
+/* 
+ * Stack tier code is a sequence of 32 bit words, so it is always read with 
+ * aligned loads.  Each instruction starts with a word holding its opcode in 
+ * the low 8 bits and its operand in the 24 above, and only a few ops are 
+ * followed by more words.  Constants that do not fit in an operand are in a 
+ * pool after the code, which is 8 byte aligned. 
+ */
+#define WIST_VM_INSN_ARG_BITS 24
+#define WIST_VM_INSN_ARG_MAX ((1u << WIST_VM_INSN_ARG_BITS) - 1)
+#define WIST_VM_INSN_SARG_MIN (-(1 << (WIST_VM_INSN_ARG_BITS - 1)))
+#define WIST_VM_INSN_SARG_MAX ((1 << (WIST_VM_INSN_ARG_BITS - 1)) - 1)
+
+#define WIST_VM_INSN(_op, _arg)                                                \
+    ((uint32_t) (_op) | ((uint32_t) (_arg) << 8))
+#define WIST_VM_INSN_OP(_insn) ((uint8_t) (_insn))
+#define WIST_VM_INSN_ARG(_insn) ((uint32_t) (_insn) >> 8)
+/* The operand as a signed number, for the immediate forms. */
+#define WIST_VM_INSN_SARG(_insn)                                               \
+    ((int32_t) (WIST_VM_INSN_ARG(_insn) ^ (1u << 23)) - (1 << 23))
+
+/* CLOSURE splits its operand into an 8 bit A and a 16 bit B. */
+#define WIST_VM_INSN_AB(_op, _a, _b)                                           \
+    WIST_VM_INSN(_op, (uint32_t) (_a) | ((uint32_t) (_b) << 8))
+#define WIST_VM_INSN_A(_insn) ((uint8_t) ((_insn) >> 8))
+#define WIST_VM_INSN_B(_insn) ((uint16_t) ((_insn) >> 16))
+
+/* The words taken by [_count] 1 byte capture slots. */
+#define WIST_VM_CAPTURE_WORDS(_count) (((size_t) (_count) + 3) / 4)
+
 enum wist_vm_obj_kind {
     WIST_VM_OBJ_CLO = WIST_OBJ_CLOSURE,
     WIST_VM_OBJ_INT = WIST_OBJ_INTEGER,
@@ -27,21 +65,106 @@ enum wist_vm_obj_kind {
     /* These are internal types the user won't (shouldn't) see. */
     WIST_VM_OBJ_ENV,
     WIST_VM_OBJ_MARK,
+    /* 
+     * A closure applied to too few arguments.  The fields are the closure, 
+     * the code index of the RESTART stub and then the arguments in order, so 
+     * it can be applied like any other closure. 
+     */
+    WIST_VM_OBJ_PAP,
 
     /* Used when values have not been initialized for debugging. */
     WIST_VM_OBJ_UNDEFINED, 
 };
 
+/* 
+ * Values come in two layouts, and the WIST_VM_OBJ_* macros below are the only 
+ * way the rest of the VM touches them.
+ *
+ * By default a value is one tagged 8 byte word.  Integers are stored shifted 
+ * left with the low bit set, so they are 63 bits wide.  Heap pointers are 
+ * 8 byte aligned with the low bits clear, and their kind lives in the tag of 
+ * the object header.  The internal MARK and UNDEFINED values are immediates 
+ * with bit 1 set.
+ *
+ * Building with WIST_VM_WIDE_OBJ defined uses the old 16 byte layout of an 
+ * explicit kind next to a 64 bit payload instead.
+ */
+#ifdef WIST_VM_WIDE_OBJ
+
 struct wist_vm_obj {
     enum wist_vm_obj_kind t;
 
     union {
         int64_t i; 
         struct wist_vm_gc_hdr *gc;
-        size_t idx; /* For indexing the code area. */
+        uint32_t *code; /* For pointing into the code area. */
     };
 };
 
+#define WIST_VM_OBJ_KIND(_obj) ((_obj).t)
+#define WIST_VM_OBJ_IS_MARK(_obj) ((_obj).t == WIST_VM_OBJ_MARK)
+#define WIST_VM_OBJ_IS_GC(_obj)                                                \
+    ((_obj).t != WIST_VM_OBJ_INT && (_obj).t != WIST_VM_OBJ_MARK               \
+     && (_obj).t != WIST_VM_OBJ_UNDEFINED && (_obj).gc != NULL)
+#define WIST_VM_OBJ_GET_GC(_obj) ((_obj).gc)
+#define WIST_VM_OBJ_MOVE_GC(_obj, _hdr)                                        \
+    ((struct wist_vm_obj) { .t = (_obj).t, .gc = (_hdr) })
+#define WIST_VM_OBJ_GET_INT(_obj) ((_obj).i)
+#define WIST_VM_OBJ_GET_CODE(_obj) ((_obj).code)
+
+#define WIST_VM_OBJ_INT_MIN INT64_MIN
+#define WIST_VM_OBJ_INT_MAX INT64_MAX
+
+#define WIST_VM_OBJ_MAKE_INT(_i)                                               \
+    ((struct wist_vm_obj) { .t = WIST_VM_OBJ_INT, .i = (_i) })
+#define WIST_VM_OBJ_MAKE_CODE(_code)                                           \
+    ((struct wist_vm_obj) { .t = WIST_VM_OBJ_INT, .code = (_code) })
+#define WIST_VM_OBJ_MAKE_MARK()                                                \
+    ((struct wist_vm_obj) { .t = WIST_VM_OBJ_MARK })
+#define WIST_VM_OBJ_MAKE_UNDEFINED()                                           \
+    ((struct wist_vm_obj) { .t = WIST_VM_OBJ_UNDEFINED })
+
+#else
+
+struct wist_vm_obj {
+    uintptr_t bits;
+};
+
+#define WIST_VM_OBJ_MARK_BITS ((uintptr_t) 0x2)
+#define WIST_VM_OBJ_UNDEFINED_BITS ((uintptr_t) 0x6)
+
+/* Evaluates [_obj] more than once, so only pass it plain lvalues. */
+#define WIST_VM_OBJ_KIND(_obj)                                                 \
+    ((_obj).bits & 1 ? WIST_VM_OBJ_INT                                         \
+     : (_obj).bits == WIST_VM_OBJ_MARK_BITS ? WIST_VM_OBJ_MARK                 \
+     : (_obj).bits == WIST_VM_OBJ_UNDEFINED_BITS ? WIST_VM_OBJ_UNDEFINED       \
+     : (enum wist_vm_obj_kind) WIST_VM_OBJ_GET_GC(_obj)->tag)
+#define WIST_VM_OBJ_IS_MARK(_obj) ((_obj).bits == WIST_VM_OBJ_MARK_BITS)
+/* Zeroed memory is not a pointer either, so fresh stacks are safe to scan. */
+#define WIST_VM_OBJ_IS_GC(_obj) (((_obj).bits & 3) == 0 && (_obj).bits != 0)
+#define WIST_VM_OBJ_GET_GC(_obj) ((struct wist_vm_gc_hdr *) (_obj).bits)
+/* Points at [_hdr] without writing the kind there, unlike create_gc. */
+#define WIST_VM_OBJ_MOVE_GC(_obj, _hdr)                                        \
+    ((struct wist_vm_obj) { .bits = (uintptr_t) (_hdr) })
+#define WIST_VM_OBJ_GET_INT(_obj) (((int64_t) (_obj).bits) >> 1)
+/* Code is word aligned, so a pointer to it is tagged like an integer. */
+#define WIST_VM_OBJ_GET_CODE(_obj) ((uint32_t *) ((_obj).bits - 1))
+
+/* The integers that survive the shift, anything wider wraps. */
+#define WIST_VM_OBJ_INT_MAX ((int64_t) (INTPTR_MAX >> 1))
+#define WIST_VM_OBJ_INT_MIN (-WIST_VM_OBJ_INT_MAX - 1)
+
+#define WIST_VM_OBJ_MAKE_INT(_i)                                               \
+    ((struct wist_vm_obj) { .bits = (((uintptr_t) (_i)) << 1) | 1 })
+#define WIST_VM_OBJ_MAKE_CODE(_code)                                           \
+    ((struct wist_vm_obj) { .bits = ((uintptr_t) (_code)) | 1 })
+#define WIST_VM_OBJ_MAKE_MARK()                                                \
+    ((struct wist_vm_obj) { .bits = WIST_VM_OBJ_MARK_BITS })
+#define WIST_VM_OBJ_MAKE_UNDEFINED()                                           \
+    ((struct wist_vm_obj) { .bits = WIST_VM_OBJ_UNDEFINED_BITS })
+
+#endif /* WIST_VM_WIDE_OBJ */
+
 #include <wist/vm_gc.h>
 
 #define WIST_VM_TO_GC_HDR(_ptr) (&(_ptr)->hdr)
@@ -50,11 +173,41 @@ struct wist_vm_obj wist_vm_obj_create_gc(enum wist_vm_obj_kind,
         struct wist_vm_gc_hdr *gc);
 
 void wist_vm_obj_print_op(uint8_t op);
+const char *wist_vm_obj_op_name(uint8_t op);
+
+/* 
+ * Returns the superinstruction that runs [first] then [second], or 
+ * __WIST_VM_OP_COUNT if there is none. 
+ */
+uint8_t wist_vm_obj_fuse_ops(uint8_t first, uint8_t second);
+
+/* 
+ * Gives the two ops of the superinstruction [op] and returns true, or 
+ * returns false if it is an ordinary op. 
+ */
+bool wist_vm_obj_split_op(uint8_t op, uint8_t *first_out, 
+        uint8_t *second_out);
+
+uint8_t wist_vm_obj_op_arg_bits(uint8_t op);
+
+/* 
+ * Whether the superinstruction of [first] and [second] is one word, rather 
+ * than one for each op. 
+ */
+bool wist_vm_obj_superop_packed(uint8_t first, uint8_t second);
+
+/* 
+ * Gives an instruction word for each op of the superinstruction [insn] and 
+ * returns true, or returns false if it is an ordinary op.  When it is not 
+ * packed, the second word is read from [pc], which is moved past it. 
+ */
+bool wist_vm_obj_split_insn(uint32_t insn, uint32_t **pc_ptr, 
+        uint32_t *first_out, uint32_t *second_out);
 void wist_vm_obj_print_clo(struct wist_vm *vm, struct wist_vm_obj clo);
 
-#define WIST_VM_OBJ_FIELD1(_obj) ((_obj).gc->fields[0])
-#define WIST_VM_OBJ_FIELD2(_obj) ((_obj).gc->fields[1])
-#define WIST_VM_OBJ_FIELD(_obj, _n) ((_obj).gc->fields[_n])
-#define WIST_VM_OBJ_FIELD_COUNT(_obj) ((_obj).gc->field_count)
+#define WIST_VM_OBJ_FIELD1(_obj) (WIST_VM_OBJ_GET_GC(_obj)->fields[0])
+#define WIST_VM_OBJ_FIELD2(_obj) (WIST_VM_OBJ_GET_GC(_obj)->fields[1])
+#define WIST_VM_OBJ_FIELD(_obj, _n) (WIST_VM_OBJ_GET_GC(_obj)->fields[_n])
+#define WIST_VM_OBJ_FIELD_COUNT(_obj) (WIST_VM_OBJ_GET_GC(_obj)->field_count)
 
 #endif /* _WIST_VM_OBJ_H */
@@ -6,17 +6,138 @@
 
 /* There is no include guard, because this is meant to be used to generate code. */
 
-OPCODE(INT64, 8)
+/* 
+ * Every op is given the number of bits of operand it keeps in its 
+ * instruction word, out of the 24 above the opcode (see vm_obj.h). 
+ *
+ * Includers that do not handle superinstructions themselves get them as 
+ * ordinary opcodes, named after their two ops, with no operand bits of their 
+ * own. 
+ */
+#ifndef SUPEROP
+#define SUPEROP(first, second) OPCODE(first##_##second, 0)
+#define WIST_VM_OPS_DEFAULT_SUPEROP
+#endif
+
+/* 
+ * The distance in words from the instruction to its 8 byte constant, in the 
+ * pool after the code it was generated with. 
+ */
+OPCODE(INT64, 24)
+/* A signed 24 bit integer, which most literals fit in without the pool. */
+OPCODE(INTI, 24)
 OPCODE(RETURN, 0)
-OPCODE(CLOSURE, 2)
+/* 
+ * A capture count in the low 8 bits and the length of the closure's code in 
+ * words in the high 16, followed by the 1 byte slots to capture padded to 
+ * whole words, and then the closure's code. 
+ */
+OPCODE(CLOSURE, 24)
 OPCODE(PUSH, 0)
 OPCODE(PUSHMARK, 0)
-OPCODE(ACCESS, 1)
-OPCODE(APPLY, 0)
-OPCODE(APPTERM, 0)
-OPCODE(MKB, 2)
-OPCODE(GRAB, 0)
+OPCODE(ACCESS, 8)
+/* 
+ * How many arguments were pushed for the call, or 0 if more than fit.  The 
+ * first time one runs it rewrites itself into one of the quickened forms 
+ * below, depending on the closure it is calling. 
+ */
+OPCODE(APPLY, 8)
+OPCODE(APPTERM, 8)
+/* 
+ * Calls made with exactly as many arguments as the closure's GRAB takes, 
+ * which move them all to the return stack at once and start after the GRAB.  
+ * They check the closure still takes that many, and become the ANY forms for 
+ * good once one does not. 
+ */
+OPCODE(APPLY_EXACT, 8)
+OPCODE(APPTERM_EXACT, 8)
+/* Calls that leave the arguments to the closure, as APPLY always did. */
+OPCODE(APPLY_ANY, 8)
+OPCODE(APPTERM_ANY, 8)
+OPCODE(MKB, 24)
+/* 
+ * The number of arguments the closure takes after the one it was entered 
+ * with, which are all moved to the return stack at once.  It is only ever 
+ * the first instruction of a closure, so when a mark comes first the closure 
+ * is still in the accumulator and is returned in a partial application with 
+ * the arguments there are. 
+ */
+OPCODE(GRAB, 8)
+/* 
+ * Grabs one argument for a lambda reached through lets, which returns a new 
+ * closure over the whole frame when a mark comes first. 
+ */
+OPCODE(GRABENV, 0)
+/* 
+ * The code of every partial application, which puts its arguments back in 
+ * front of the new one and enters its closure. 
+ */
+OPCODE(RESTART, 0)
 OPCODE(LET, 0)
 OPCODE(ENDLET, 0)
-OPCODE(SETGLOBAL, 8)
-OPCODE(GETGLOBAL, 0)
+OPCODE(SETGLOBAL, 24)
+OPCODE(GETGLOBAL, 24)
+/* 
+ * Followed by a word with the offset of a register tier function, which is 
+ * run with the current local (if any) as its argument.  See vm_reg.h. 
+ */
+OPCODE(REGENTER, 0)
+
+/* 
+ * Integer primitives take their left operand from the accumulator and their 
+ * right operand from the top of the argument stack, which they pop.  
+ * Comparisons leave 1 or 0 in the accumulator.
+ */
+OPCODE(ADD, 0)
+OPCODE(SUB, 0)
+OPCODE(MUL, 0)
+OPCODE(DIV, 0)
+OPCODE(REM, 0)
+OPCODE(LT, 0)
+OPCODE(LE, 0)
+OPCODE(GT, 0)
+OPCODE(GE, 0)
+OPCODE(EQ, 0)
+OPCODE(NE, 0)
+
+/* The same, but with a signed 24 bit right operand. */
+OPCODE(ADDI, 24)
+OPCODE(LTI, 24)
+OPCODE(LEI, 24)
+OPCODE(GTI, 24)
+OPCODE(GEI, 24)
+OPCODE(EQI, 24)
+OPCODE(NEI, 24)
+
+/* 
+ * Superinstructions run two ops with one dispatch.  One is a single word 
+ * with the operand of its second op above that of its first, when both fit, 
+ * and otherwise the words of both ops with the first opcode rewritten, so 
+ * the code builder makes one by rewriting the word of the first op.  They 
+ * are the pairs that run most often in a `make OPSTATS=on` build, apart from 
+ * those with an op that code is entered after (CLOSURE, APPLY, GRAB, GRABENV 
+ * and RETURN) first, or one the heap profiler finds by its position second.  
+ * The JIT runs them as their two ops with exits to the start of the pair, 
+ * so the first op also has to be safe to run again, unless the second never 
+ * exits. 
+ */
+SUPEROP(ACCESS, PUSH)
+SUPEROP(PUSH, ACCESS)
+SUPEROP(INTI, PUSH)
+SUPEROP(ACCESS, APPLY)
+SUPEROP(GETGLOBAL, APPLY)
+SUPEROP(ACCESS, RETURN)
+
+/* 
+ * The quickened forms of the superinstructions with an APPLY, which there 
+ * must be for every one of them. 
+ */
+SUPEROP(ACCESS, APPLY_EXACT)
+SUPEROP(ACCESS, APPLY_ANY)
+SUPEROP(GETGLOBAL, APPLY_EXACT)
+SUPEROP(GETGLOBAL, APPLY_ANY)
+
+#ifdef WIST_VM_OPS_DEFAULT_SUPEROP
+#undef SUPEROP
+#undef WIST_VM_OPS_DEFAULT_SUPEROP
+#endif
@@ -0,0 +1,108 @@
+/* === inc/wist/vm_prof.h - VM heap profiler ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#ifndef _WIST_VM_PROF_H
+#define _WIST_VM_PROF_H
+
+#include <wist.h>
+#include <wist/vector.h>
+#include <wist/srcloc.h>
+#include <wist/vm_obj.h>
+
+#include <stdio.h>
+
+/*
+ * Samples what the stack tier allocates by the op that allocated it.  Code
+ * generated while profiling is on records a site for every CLOSURE, GRAB,
+ * GRABENV and MKB, with where it starts in the source and the site of the
+ * lambda it is in.  The interpreter then picks about one object in every
+ * [rate] bytes those ops allocate, counts it at its site, and puts the
+ * site's number in the object's header.  The collector keeps that number
+ * when it copies or slides the object, so the sampled objects still live are
+ * the ones with a number left in the heap after a full collection.
+ *
+ * A sampled object stands for all the bytes allocated since the last one,
+ * which is [rate] on average, or just itself if it is bigger than that.
+ */
+
+/* How much of the source a site keeps, for telling sites apart. */
+#define WIST_VM_PROF_TEXT 32
+/* Headers have 16 bits for the site, which is numbered from 1 there. */
+#define WIST_VM_PROF_MAX_SITES UINT16_MAX
+#define WIST_VM_PROF_DEFAULT_RATE (64 * 1024)
+
+enum wist_vm_prof_kind {
+    WIST_VM_PROF_CLOSURE,
+    WIST_VM_PROF_PARTIAL,
+    WIST_VM_PROF_TUPLE,
+    /* Where objects from code without sites are counted, always site 0. */
+    WIST_VM_PROF_UNKNOWN,
+};
+
+struct wist_vm_prof_site {
+    /* The code area index of the op, once the code is placed. */
+    size_t pc;
+    enum wist_vm_prof_kind t;
+    /* The site of the lambda it is in, or 0 at the top of a declaration. */
+    size_t parent;
+    /* The declaration it is in, an index into [decls]. */
+    size_t decl;
+    uint32_t line, col;
+    char text[WIST_VM_PROF_TEXT + 1];
+    /* The objects and bytes the ones sampled here stand for. */
+    size_t allocated, allocated_bytes;
+};
+
+/* The name of a declaration or expression the sites of some code are in. */
+struct wist_vm_prof_decl {
+    char name[WIST_VM_PROF_TEXT + 1];
+};
+
+struct wist_vm_prof {
+    bool enabled;
+    size_t rate;
+    /* The bytes still to allocate before the next sample. */
+    size_t countdown;
+    uint64_t random;
+    /* Sorted by [pc] after site 0, since code is only ever added at the end. */
+    struct wist_vector sites; /* struct wist_vm_prof_site */
+    struct wist_vector decls; /* struct wist_vm_prof_decl */
+};
+
+void wist_vm_prof_init(struct wist_vm *vm);
+void wist_vm_prof_finish(struct wist_vm *vm);
+
+/*
+ * Starts recording the sites of code for the declaration named [name] or,
+ * if it is NULL, an expression.  Returns the declaration for add_site.
+ */
+size_t wist_vm_prof_add_decl(struct wist_vm *vm, const uint8_t *name,
+        size_t name_len);
+
+/*
+ * Records the site of the op at [pc] in code that is still being generated,
+ * and returns its number, or 0 if there are too many.  [loc] is looked up in
+ * [srclocs], whose text must still be there.
+ */
+size_t wist_vm_prof_add_site(struct wist_vm *vm,
+        struct wist_srcloc_index *srclocs, enum wist_vm_prof_kind t,
+        size_t pc, size_t parent, size_t decl, struct wist_srcloc loc);
+
+/* Moves the sites from [first] on by [base], where their code was placed. */
+void wist_vm_prof_place_sites(struct wist_vm *vm, size_t first, size_t base);
+
+/*
+ * Called with every object the op at [pc] allocates while profiling, and
+ * samples it if its turn has come.
+ */
+void wist_vm_prof_sample(struct wist_vm *vm, struct wist_vm_obj obj,
+        size_t pc);
+
+/* Writes a profile as described at wist_vm_write_heap_profile. */
+void wist_vm_prof_write(struct wist_vm *vm, FILE *out,
+        enum wist_vm_heap_profile what);
+
+#endif /* _WIST_VM_PROF_H */
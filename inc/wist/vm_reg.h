@@ -0,0 +1,80 @@
+/* === inc/wist/vm_reg.h - Register based VM tier === 
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#ifndef _WIST_VM_REG_H
+#define _WIST_VM_REG_H
+
+#include <wist.h>
+#include <wist/vm.h>
+
+/* 
+ * The register tier compiles every chain of directly nested lambdas into one 
+ * function whose frame is a window of registers on the VM's register stack.  
+ * Arguments, captures, let bindings and temporaries all get a register of 
+ * their own, so instructions name their operands instead of shuffling them 
+ * through an accumulator and the argument stack.
+ *
+ * A closure of this tier is an ordinary CLO whose code is a stub in the stack 
+ * tier's code area, REGENTER followed by RETURN, so the stack tier can call 
+ * it like any other closure.  The register tier recognises the stub and 
+ * enters the function directly, and calls any other closure through 
+ * wist_vm_apply.
+ */
+
+enum wist_vm_reg_op {
+#define OPCODE(name, _args) WIST_VM_REG_OP_##name,
+#include <wist/vm_reg_ops.h>
+#undef OPCODE
+__WIST_VM_REG_OP_COUNT /* The number of opcodes. */
+};
+
+/* 
+ * Every function in the register code area starts with this header.  
+ *
+ * The frame of a function holds its last argument in register 0, then the 
+ * values in its closure environment, then everything else.  For a chain of 
+ * n lambdas only the body takes all n arguments.  The functions for the 
+ * first n - 1 lambdas are generated to each capture one more argument and 
+ * return a closure of the next, which keeps one argument application 
+ * working while a call with all n arguments can jump straight to the body.
+ */
+struct wist_vm_reg_fn_hdr {
+    uint16_t frame_size;
+    /* How many arguments of the chain are already held in the environment. */
+    uint8_t held;
+    /* How many more arguments it takes to reach the body. */
+    uint8_t remaining;
+    /* The offset of the body of the chain in the register code area. */
+    uint32_t body;
+};
+
+/* A suspended caller on the register tier's frame stack. */
+struct wist_vm_reg_frame {
+    uint8_t *pc;
+    size_t base;
+    uint16_t frame_size;
+    uint8_t dst; /* The caller's register that receives the result. */
+};
+
+#define WIST_VM_REG_FN_HDR(_vm, _fn)                                           \
+    ((struct wist_vm_reg_fn_hdr *) WIST_VECTOR_INDEX(&(_vm)->reg_code_area,    \
+        uint8_t, _fn))
+
+/* 
+ * Runs the function at offset [fn] of the register code area with [arg] as 
+ * its argument and [env] as its environment. 
+ */
+struct wist_vm_obj wist_vm_reg_interpret(struct wist_vm *vm, uint32_t fn, 
+        struct wist_vm_obj env, struct wist_vm_obj arg);
+
+void wist_vm_reg_print_fn(struct wist_vm *vm, uint32_t fn);
+
+struct wist_handle *wist_compiler_vm_reg_gen_expr(struct wist_compiler *comp,
+        struct wist_vm *vm, struct wist_ast_expr *expr);
+struct wist_handle *wist_compiler_vm_reg_gen_decl(struct wist_compiler *comp, 
+        struct wist_vm *vm, struct wist_ast_decl *decl);
+
+#endif /* _WIST_VM_REG_H */
@@ -0,0 +1,51 @@
+/* === inc/wist/vm_reg_ops.h - Register VM opcodes === 
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/* There is no include guard, because this is meant to be used to generate code. */
+
+/* 
+ * Operands are 1 byte register numbers unless noted otherwise, and the size 
+ * only counts the fixed operands, not the register lists some ops end with.
+ */
+
+/* dst, 8 byte integer. */
+OPCODE(LOADI, 9)
+/* dst, 4 byte slot. */
+OPCODE(GETGLOBAL, 5)
+/* src, 4 byte slot. */
+OPCODE(SETGLOBAL, 5)
+/* dst, 4 byte stub offset, capture count, then that many registers. */
+OPCODE(CLOSURE, 6)
+/* dst, field count, then that many registers. */
+OPCODE(MKB, 2)
+/* dst, fun, argument count, then that many registers. */
+OPCODE(CALL, 3)
+/* fun, argument count, then that many registers. */
+OPCODE(TAILCALL, 2)
+/* src. */
+OPCODE(RET, 1)
+
+/* dst, lhs, rhs. */
+OPCODE(ADD, 3)
+OPCODE(SUB, 3)
+OPCODE(MUL, 3)
+OPCODE(DIV, 3)
+OPCODE(REM, 3)
+OPCODE(LT, 3)
+OPCODE(LE, 3)
+OPCODE(GT, 3)
+OPCODE(GE, 3)
+OPCODE(EQ, 3)
+OPCODE(NE, 3)
+
+/* dst, lhs, signed 4 byte immediate. */
+OPCODE(ADDI, 6)
+OPCODE(LTI, 6)
+OPCODE(LEI, 6)
+OPCODE(GTI, 6)
+OPCODE(GEI, 6)
+OPCODE(EQI, 6)
+OPCODE(NEI, 6)
@@ -18,6 +18,21 @@ const char *ast_expr_to_string_map[] = {
     [WIST_AST_EXPR_INT]   = "Integer",
     [WIST_AST_EXPR_LET]   = "Let",
     [WIST_AST_EXPR_TUPLE] = "Tuple",
+    [WIST_AST_EXPR_BINOP] = "Binary Operator",
+};
+
+const char *ast_binop_to_string_map[] = {
+    [WIST_AST_BINOP_ADD] = "+",
+    [WIST_AST_BINOP_SUB] = "-",
+    [WIST_AST_BINOP_MUL] = "*",
+    [WIST_AST_BINOP_DIV] = "/",
+    [WIST_AST_BINOP_REM] = "%",
+    [WIST_AST_BINOP_LT]  = "<",
+    [WIST_AST_BINOP_LE]  = "<=",
+    [WIST_AST_BINOP_GT]  = ">",
+    [WIST_AST_BINOP_GE]  = ">=",
+    [WIST_AST_BINOP_EQ]  = "==",
+    [WIST_AST_BINOP_NE]  = "!=",
 };
 
 const char *ast_decl_to_string_map[] = {
@@ -103,6 +118,16 @@ struct wist_ast_expr *wist_ast_create_let(struct wist_compiler *comp,
     return expr;
 }
 
+struct wist_ast_expr *wist_ast_create_binop(struct wist_compiler *comp, 
+        struct wist_srcloc loc, enum wist_ast_binop_kind op, 
+        struct wist_ast_expr *lhs, struct wist_ast_expr *rhs) {
+    struct wist_ast_expr *expr = wist_ast_create_expr(comp, WIST_AST_EXPR_BINOP, loc);
+    expr->binop.op = op;
+    expr->binop.lhs = lhs;
+    expr->binop.rhs = rhs;
+    return expr;
+}
+
 struct wist_ast_type *wist_ast_create_fun_type(struct wist_compiler *comp,
         struct wist_ast_type *in, struct wist_ast_type *out) {
     struct wist_ast_type *type = wist_ast_create_type(comp, WIST_AST_TYPE_FUN);
@@ -232,6 +257,10 @@ void wist_ast_expr_destroy(struct wist_compiler *comp,
             WIST_VECTOR_FINISH(comp->ctx, &expr->tuple.fields);
             break;
         }
+        case WIST_AST_EXPR_BINOP:
+            wist_ast_expr_destroy(comp, expr->binop.lhs);
+            wist_ast_expr_destroy(comp, expr->binop.rhs);
+            break;
         case WIST_AST_EXPR_VAR:
         case WIST_AST_EXPR_GVAR:
         case WIST_AST_EXPR_INT:
@@ -357,7 +386,14 @@ static void wist_ast_print_expr_indent(struct wist_compiler *comp,
                 printf("\n");
                 wist_ast_print_expr_indent(comp, *field, indent + 1);
             }
+            break;
         }
+        case WIST_AST_EXPR_BINOP:
+            printf(" : '%s'\n", ast_binop_to_string_map[expr->binop.op]);
+            wist_ast_print_expr_indent(comp, expr->binop.lhs, indent + 1);
+            printf("\n");
+            wist_ast_print_expr_indent(comp, expr->binop.rhs, indent + 1);
+            break;
     }
 
     if (expr->type != NULL) {
@@ -79,6 +79,7 @@ void wist_compiler_vm_connect(struct wist_compiler *comp, struct wist_vm *vm) {
 struct wist_parse_result *wist_compiler_parse_expr(struct wist_compiler *comp,
         const uint8_t *src, size_t src_len, struct wist_ast_expr **expr_out) {
     struct wist_parse_result *result = WIST_CTX_NEW(comp->ctx, struct wist_parse_result);
+    wist_srcloc_index_add_segment(comp->ctx, &comp->srclocs, src, src_len);
     result->has_errors = false;
     WIST_VECTOR_INIT(comp->ctx, &result->diags, struct wist_diag);
     comp->cur_result = result;
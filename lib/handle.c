@@ -9,11 +9,15 @@
 #include <wist/vm.h>
 
 enum wist_obj_type wist_handle_get_type(struct wist_handle *handle) {
-    return (enum wist_obj_type) handle->obj.t;
+    enum wist_vm_obj_kind kind = WIST_VM_OBJ_KIND(handle->obj);
+    if (kind == WIST_VM_OBJ_PAP) {
+        return WIST_OBJ_CLOSURE;
+    }
+    return (enum wist_obj_type) kind;
 }
 
 int64_t wist_handle_get_int(struct wist_handle *handle) {
-    return handle->obj.i;
+    return WIST_VM_OBJ_GET_INT(handle->obj);
 }
 
 void wist_handle_stack_push(struct wist_vm *vm) {
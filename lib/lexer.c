@@ -31,6 +31,12 @@ struct wist_lexer {
      * skip past invalid chars but do not report them.
      */
     bool invalid_char_mode;
+
+    /* 
+     * True when the last token ended an operand, in which case a '-' is 
+     * always the subtraction operator, so "x -1" is "x - 1" and not "x (-1)".
+     */
+    bool after_operand;
 };
 
 #define INIT_WIST_TOKENS 8
@@ -52,6 +58,18 @@ const char *token_to_string_map[] = {
     [WIST_TOKEN_COMMA] = "Comma",
     [WIST_TOKEN_EQ] = "Eq",         
 
+    [WIST_TOKEN_PLUS] = "Plus",
+    [WIST_TOKEN_MINUS] = "Minus",
+    [WIST_TOKEN_STAR] = "Star",
+    [WIST_TOKEN_SLASH] = "Slash",
+    [WIST_TOKEN_PERCENT] = "Percent",
+    [WIST_TOKEN_LT] = "Lt",
+    [WIST_TOKEN_LT_EQ] = "Lt_Eq",
+    [WIST_TOKEN_GT] = "Gt",
+    [WIST_TOKEN_GT_EQ] = "Gt_Eq",
+    [WIST_TOKEN_EQ_EQ] = "Eq_Eq",
+    [WIST_TOKEN_BANG_EQ] = "Bang_Eq",
+
     [WIST_TOKEN_LET] = "Let",
     [WIST_TOKEN_IN] = "In", 
     [WIST_TOKEN_END] = "End",
@@ -79,11 +97,15 @@ struct wist_token *wist_lex(struct wist_compiler *comp, const uint8_t *src,
         .src = src,
         .src_len = src_len,
         .invalid_char_mode = false,
+        .after_operand = false,
     };
 
     struct wist_token tok;
     while ((tok = lex_next(&lexer)).t != WIST_TOKEN_EOI) {
         WIST_VECTOR_PUSH(comp->ctx, &vec, struct wist_token, &tok);
+        lexer.after_operand = tok.t == WIST_TOKEN_SYM 
+            || tok.t == WIST_TOKEN_INT || tok.t == WIST_TOKEN_RPAREN 
+            || tok.t == WIST_TOKEN_END;
     }
     /* This is the terminating EOI token. */
     WIST_VECTOR_PUSH(comp->ctx, &vec, struct wist_token, &tok);
@@ -113,6 +135,18 @@ void wist_token_print(struct wist_compiler *comp, struct wist_token tok) {
         case WIST_TOKEN_COMMA:
         case WIST_TOKEN_EQ:
 
+        case WIST_TOKEN_PLUS:
+        case WIST_TOKEN_MINUS:
+        case WIST_TOKEN_STAR:
+        case WIST_TOKEN_SLASH:
+        case WIST_TOKEN_PERCENT:
+        case WIST_TOKEN_LT:
+        case WIST_TOKEN_LT_EQ:
+        case WIST_TOKEN_GT:
+        case WIST_TOKEN_GT_EQ:
+        case WIST_TOKEN_EQ_EQ:
+        case WIST_TOKEN_BANG_EQ:
+
         case WIST_TOKEN_LET:
         case WIST_TOKEN_IN:
         case WIST_TOKEN_END:
@@ -130,8 +164,7 @@ void wist_token_print(struct wist_compiler *comp, struct wist_token tok) {
 
 static struct wist_token make_token(struct wist_lexer *lexer, 
         enum wist_token_kind t) {
-    struct wist_token tok;
-    tok.t = t;
+    struct wist_token tok = { .t = t };
     SKIP_C(lexer);
     tok.loc = lexer_get_loc(lexer);
     RESET(lexer);
@@ -184,7 +217,7 @@ start:
     }
 
     /* Lex an integer. */
-    if (isdigit(c) || c == '-') {
+    if (isdigit(c) || (c == '-' && !lexer->after_operand)) {
         bool neg = false;
         if (c == '-') {
             SKIP_C(lexer);
@@ -226,14 +259,48 @@ not_integer:
         case ',':
             return make_token(lexer, WIST_TOKEN_COMMA);
         case '=':
+            SKIP_C(lexer);
+            if (!IS_EOI(lexer) && PEEK_C(lexer) == '=') {
+                return make_token(lexer, WIST_TOKEN_EQ_EQ);
+            }
+            BACKUP_C(lexer);
             return make_token(lexer, WIST_TOKEN_EQ);
-        case '-': {
+        case '-': 
             SKIP_C(lexer);
-            if ((c = PEEK_C(lexer)) == '>') {
+            if (!IS_EOI(lexer) && PEEK_C(lexer) == '>') {
                 return make_token(lexer, WIST_TOKEN_THIN_ARROW);
             }
+            BACKUP_C(lexer);
+            return make_token(lexer, WIST_TOKEN_MINUS);
+        case '+':
+            return make_token(lexer, WIST_TOKEN_PLUS);
+        case '*':
+            return make_token(lexer, WIST_TOKEN_STAR);
+        case '/':
+            return make_token(lexer, WIST_TOKEN_SLASH);
+        case '%':
+            return make_token(lexer, WIST_TOKEN_PERCENT);
+        case '<':
+            SKIP_C(lexer);
+            if (!IS_EOI(lexer) && PEEK_C(lexer) == '=') {
+                return make_token(lexer, WIST_TOKEN_LT_EQ);
+            }
+            BACKUP_C(lexer);
+            return make_token(lexer, WIST_TOKEN_LT);
+        case '>':
+            SKIP_C(lexer);
+            if (!IS_EOI(lexer) && PEEK_C(lexer) == '=') {
+                return make_token(lexer, WIST_TOKEN_GT_EQ);
+            }
+            BACKUP_C(lexer);
+            return make_token(lexer, WIST_TOKEN_GT);
+        case '!':
+            SKIP_C(lexer);
+            if (!IS_EOI(lexer) && PEEK_C(lexer) == '=') {
+                return make_token(lexer, WIST_TOKEN_BANG_EQ);
+            }
+            BACKUP_C(lexer);
             break;
-        }
     }
 
     if (!lexer->invalid_char_mode)
@@ -7,6 +7,7 @@
 #include <wist/lir.h>
 #include <wist/ast.h>
 #include <wist/compiler.h>
+#include <wist/toplevel.h>
 
 #include <stdio.h>
 #include <inttypes.h>
@@ -17,6 +18,14 @@ struct lam_map {
     struct lam_map *next;
 };
 
+/* A lambda that gets its own closure, while we resolve its captures. */
+struct capture_scope {
+    struct wist_lir_expr *lam;
+    struct capture_scope *up;
+    /* The number of locals in the enclosing function where [lam] is built. */
+    int outer_depth; 
+};
+
 const char *lir_expr_to_string_map[] = {
     [WIST_LIR_EXPR_LAM] = "Lambda",
     [WIST_LIR_EXPR_APP] = "Application",
@@ -25,6 +34,21 @@ const char *lir_expr_to_string_map[] = {
     [WIST_LIR_EXPR_GVAR] = "Global Variable",
     [WIST_LIR_EXPR_INT] = "Integer",
     [WIST_LIR_EXPR_MKB] = "Make Block",
+    [WIST_LIR_EXPR_PRIM] = "Primitive",
+};
+
+const char *lir_prim_to_string_map[] = {
+    [WIST_LIR_PRIM_ADD] = "add",
+    [WIST_LIR_PRIM_SUB] = "sub",
+    [WIST_LIR_PRIM_MUL] = "mul",
+    [WIST_LIR_PRIM_DIV] = "div",
+    [WIST_LIR_PRIM_REM] = "rem",
+    [WIST_LIR_PRIM_LT] = "lt",
+    [WIST_LIR_PRIM_LE] = "le",
+    [WIST_LIR_PRIM_GT] = "gt",
+    [WIST_LIR_PRIM_GE] = "ge",
+    [WIST_LIR_PRIM_EQ] = "eq",
+    [WIST_LIR_PRIM_NE] = "ne",
 };
 
 /* === PROTOTYPES === */
@@ -34,6 +58,13 @@ static struct wist_lir_expr *wist_lir_create_expr(struct wist_compiler *comp,
 static struct wist_lir_expr *gen_expr_rec(struct wist_compiler *comp, 
         struct wist_ast_expr *expr, struct lam_map *map);
 
+static void resolve_expr_rec(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr, struct capture_scope *scope, int depth);
+static void resolve_tail_rec(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr, struct capture_scope *scope, int depth);
+static int resolve_slot(struct wist_compiler *comp, 
+        struct capture_scope *scope, int depth, int index);
+
 static void print_expr_indent(struct wist_lir_expr *expr, int indent);
 
 /* === PUBLICS === */
@@ -43,6 +74,7 @@ void wist_lir_expr_destroy(struct wist_compiler *comp,
     switch (expr->t) {
         case WIST_LIR_EXPR_LAM: 
             wist_lir_expr_destroy(comp, expr->lam.body);
+            WIST_VECTOR_FINISH(comp->ctx, &expr->lam.captures);
             break;
         case WIST_LIR_EXPR_LET: 
             wist_lir_expr_destroy(comp, expr->let.val);
@@ -60,6 +92,10 @@ void wist_lir_expr_destroy(struct wist_compiler *comp,
             wist_lir_expr_destroy(comp, expr->app.fun);
             wist_lir_expr_destroy(comp, expr->app.arg);
             break;
+        case WIST_LIR_EXPR_PRIM: 
+            wist_lir_expr_destroy(comp, expr->prim.lhs);
+            wist_lir_expr_destroy(comp, expr->prim.rhs);
+            break;
         case WIST_LIR_EXPR_VAR:
         case WIST_LIR_EXPR_GVAR:
         case WIST_LIR_EXPR_INT:
@@ -89,6 +125,7 @@ struct wist_lir_expr *wist_lir_create_lam(struct wist_compiler *comp,
         struct wist_lir_expr *body) {
     struct wist_lir_expr *expr = wist_lir_create_expr(comp, WIST_LIR_EXPR_LAM);
     expr->lam.body = body;
+    WIST_VECTOR_INIT(comp->ctx, &expr->lam.captures, int);
     return expr;
 }
 
@@ -109,9 +146,10 @@ struct wist_lir_expr *wist_lir_create_var(struct wist_compiler *comp,
 }
 
 struct wist_lir_expr *wist_lir_create_gvar(struct wist_compiler *comp,
-        struct wist_sym *sym) {
+        struct wist_sym *sym, uint32_t slot) {
     struct wist_lir_expr *expr = wist_lir_create_expr(comp, WIST_LIR_EXPR_GVAR);
     expr->gvar.sym = sym;
+    expr->gvar.slot = slot;
     return expr;
 }
 
@@ -122,12 +160,82 @@ struct wist_lir_expr *wist_lir_create_int(struct wist_compiler *comp,
     return expr;
 }
 
+struct wist_lir_expr *wist_lir_create_prim(struct wist_compiler *comp,
+        enum wist_lir_prim_kind t, struct wist_lir_expr *lhs, 
+        struct wist_lir_expr *rhs) {
+    struct wist_lir_expr *expr = wist_lir_create_expr(comp, WIST_LIR_EXPR_PRIM);
+    expr->prim.t = t;
+    expr->prim.lhs = lhs;
+    expr->prim.rhs = rhs;
+    return expr;
+}
+
 struct wist_lir_expr *wist_compiler_lir_gen_expr(struct wist_compiler *comp, 
         struct wist_ast_expr *expr) {
     struct lam_map *map = NULL;
     return gen_expr_rec(comp, expr, map);
 }
 
+void wist_lir_resolve_captures(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr) {
+    resolve_expr_rec(comp, expr, NULL, 0);
+}
+
+bool wist_lir_prim_imm_form(struct wist_lir_expr *expr, 
+        enum wist_lir_prim_kind *t_out, struct wist_lir_expr **operand_out, 
+        int32_t *imm_out) {
+    struct wist_lir_expr *lhs = expr->prim.lhs, *rhs = expr->prim.rhs;
+    bool imm_is_lhs;
+    int64_t imm;
+
+    if (rhs->t == WIST_LIR_EXPR_INT) {
+        imm_is_lhs = false;
+        imm = rhs->i.val;
+        *operand_out = lhs;
+    } else if (lhs->t == WIST_LIR_EXPR_INT) {
+        imm_is_lhs = true;
+        imm = lhs->i.val;
+        *operand_out = rhs;
+    } else {
+        return false;
+    }
+
+    switch (expr->prim.t) {
+        case WIST_LIR_PRIM_ADD:
+        case WIST_LIR_PRIM_EQ:
+        case WIST_LIR_PRIM_NE:
+            *t_out = expr->prim.t;
+            break;
+        case WIST_LIR_PRIM_SUB:
+            if (imm_is_lhs || imm == INT64_MIN) {
+                return false;
+            }
+            imm = -imm;
+            *t_out = WIST_LIR_PRIM_ADD;
+            break;
+        case WIST_LIR_PRIM_LT:
+            *t_out = imm_is_lhs ? WIST_LIR_PRIM_GT : WIST_LIR_PRIM_LT;
+            break;
+        case WIST_LIR_PRIM_LE:
+            *t_out = imm_is_lhs ? WIST_LIR_PRIM_GE : WIST_LIR_PRIM_LE;
+            break;
+        case WIST_LIR_PRIM_GT:
+            *t_out = imm_is_lhs ? WIST_LIR_PRIM_LT : WIST_LIR_PRIM_GT;
+            break;
+        case WIST_LIR_PRIM_GE:
+            *t_out = imm_is_lhs ? WIST_LIR_PRIM_LE : WIST_LIR_PRIM_GE;
+            break;
+        default:
+            return false;
+    }
+
+    if (imm < INT32_MIN || imm > INT32_MAX) {
+        return false;
+    }
+    *imm_out = (int32_t) imm;
+    return true;
+}
+
 void wist_lir_print_expr(struct wist_lir_expr *expr) {
     print_expr_indent(expr, 0);
     printf("\n");
@@ -139,6 +247,7 @@ static struct wist_lir_expr *wist_lir_create_expr(struct wist_compiler *comp,
         enum wist_lir_expr_kind t) {
     struct wist_lir_expr *expr = WIST_CTX_NEW(comp->ctx, struct wist_lir_expr);
     expr->t = t;
+    expr->loc.start = expr->loc.len = 0;
     return expr;
 }
 
@@ -157,6 +266,7 @@ static struct wist_lir_expr *gen_expr_rec(struct wist_compiler *comp,
             new_map->next = map;
             new_map->var = expr->lam.var;
             struct wist_lir_expr *lir_expr = wist_lir_create_lam(comp, NULL);
+            lir_expr->loc = expr->loc;
             new_map->origin = lir_expr;
             struct wist_lir_expr *body = 
                 gen_expr_rec(comp, expr->lam.body, new_map);
@@ -190,7 +300,8 @@ static struct wist_lir_expr *gen_expr_rec(struct wist_compiler *comp,
             return NULL;
         }
         case WIST_AST_EXPR_GVAR: {
-            return wist_lir_create_gvar(comp, expr->gvar.sym);
+            return wist_lir_create_gvar(comp, expr->gvar.sym, 
+                    expr->gvar.var->slot);
         }
         case WIST_AST_EXPR_TUPLE: {
             struct wist_vector lir_fields;
@@ -200,16 +311,109 @@ static struct wist_lir_expr *gen_expr_rec(struct wist_compiler *comp,
                 WIST_VECTOR_PUSH(comp->ctx, &lir_fields, 
                         struct wist_lir_expr *, &lir_field);
             }
-            return wist_lir_create_mkb(comp, WIST_LIR_BLOCK_TUPLE, lir_fields);
+            struct wist_lir_expr *mkb = wist_lir_create_mkb(comp, 
+                    WIST_LIR_BLOCK_TUPLE, lir_fields);
+            mkb->loc = expr->loc;
+            return mkb;
         }
         case WIST_AST_EXPR_INT:
             return wist_lir_create_int(comp, expr->i.val);
+        case WIST_AST_EXPR_BINOP: {
+            struct wist_lir_expr *lhs = 
+                gen_expr_rec(comp, expr->binop.lhs, map);
+            struct wist_lir_expr *rhs = 
+                gen_expr_rec(comp, expr->binop.rhs, map);
+            return wist_lir_create_prim(comp, 
+                    (enum wist_lir_prim_kind) expr->binop.op, lhs, rhs);
+        }
     }
 
     printf("Invalid case of wist_compiler_lir_gen_expr\n");
     return NULL;
 }
 
+static void resolve_expr_rec(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr, struct capture_scope *scope, int depth) {
+    switch (expr->t) {
+        case WIST_LIR_EXPR_LAM: {
+            struct capture_scope new_scope = {
+                .lam = expr,
+                .up = scope,
+                .outer_depth = depth,
+            };
+            resolve_tail_rec(comp, expr->lam.body, &new_scope, 1);
+            break;
+        }
+        case WIST_LIR_EXPR_LET:
+            resolve_expr_rec(comp, expr->let.val, scope, depth);
+            resolve_expr_rec(comp, expr->let.body, scope, depth + 1);
+            break;
+        case WIST_LIR_EXPR_APP:
+            resolve_expr_rec(comp, expr->app.fun, scope, depth);
+            resolve_expr_rec(comp, expr->app.arg, scope, depth);
+            break;
+        case WIST_LIR_EXPR_MKB:
+            WIST_VECTOR_FOR_EACH(&expr->mkb.fields, struct wist_lir_expr *, 
+                    field) {
+                resolve_expr_rec(comp, *field, scope, depth);
+            }
+            break;
+        case WIST_LIR_EXPR_PRIM:
+            resolve_expr_rec(comp, expr->prim.lhs, scope, depth);
+            resolve_expr_rec(comp, expr->prim.rhs, scope, depth);
+            break;
+        case WIST_LIR_EXPR_VAR:
+            expr->var.index = resolve_slot(comp, scope, depth, 
+                    expr->var.index);
+            break;
+        case WIST_LIR_EXPR_GVAR:
+        case WIST_LIR_EXPR_INT:
+            break;
+    }
+}
+
+/* Walks the part of a lambda's body that shares its frame. */
+static void resolve_tail_rec(struct wist_compiler *comp, 
+        struct wist_lir_expr *expr, struct capture_scope *scope, int depth) {
+    switch (expr->t) {
+        case WIST_LIR_EXPR_LAM:
+            resolve_tail_rec(comp, expr->lam.body, scope, depth + 1);
+            break;
+        case WIST_LIR_EXPR_LET:
+            resolve_expr_rec(comp, expr->let.val, scope, depth);
+            resolve_tail_rec(comp, expr->let.body, scope, depth + 1);
+            break;
+        default:
+            resolve_expr_rec(comp, expr, scope, depth);
+    }
+}
+
+/* 
+ * Maps a de Bruijn [index] seen [depth] locals into the function of [scope] 
+ * to a slot, adding a capture to the function (and to every function between 
+ * it and the binder) when the variable is free in it.
+ */
+static int resolve_slot(struct wist_compiler *comp, 
+        struct capture_scope *scope, int depth, int index) {
+    if (index < depth || scope == NULL) {
+        return index;
+    }
+
+    int outer_slot = resolve_slot(comp, scope->up, scope->outer_depth, 
+            index - depth);
+
+    int capture = 0;
+    WIST_VECTOR_FOR_EACH(&scope->lam->lam.captures, int, slot) {
+        if (*slot == outer_slot) {
+            return depth + capture;
+        }
+        capture++;
+    }
+
+    WIST_VECTOR_PUSH(comp->ctx, &scope->lam->lam.captures, int, &outer_slot);
+    return depth + capture;
+}
+
 static void print_expr_indent(struct wist_lir_expr *expr, int indent) {
     for (int i = 0; i < indent; i++) {
         printf("\t");
@@ -218,7 +422,11 @@ static void print_expr_indent(struct wist_lir_expr *expr, int indent) {
     printf("%s", lir_expr_to_string_map[expr->t]);
     switch (expr->t) {
         case WIST_LIR_EXPR_LAM: 
-            printf(" : %p\n", expr);
+            printf(" : %p :", expr);
+            WIST_VECTOR_FOR_EACH(&expr->lam.captures, int, slot) {
+                printf(" %d", *slot);
+            }
+            printf("\n");
             print_expr_indent(expr->lam.body, indent + 1);
             break;
         case WIST_LIR_EXPR_LET: 
@@ -237,8 +445,8 @@ static void print_expr_indent(struct wist_lir_expr *expr, int indent) {
             printf(" : %d : %p", expr->var.index, expr->var.origin);
             break;
         case WIST_LIR_EXPR_GVAR:
-            printf(" : '%.*s'", (int) expr->gvar.sym->str_len, 
-                    (const uint8_t *) expr->gvar.sym->str);
+            printf(" : '%.*s' : %" PRIu32, (int) expr->gvar.sym->str_len, 
+                    (const uint8_t *) expr->gvar.sym->str, expr->gvar.slot);
             break;
         case WIST_LIR_EXPR_MKB:
             WIST_VECTOR_FOR_EACH(&expr->mkb.fields, struct wist_lir_expr *, 
@@ -250,5 +458,11 @@ static void print_expr_indent(struct wist_lir_expr *expr, int indent) {
         case WIST_LIR_EXPR_INT:
             printf(" : %" PRId64, expr->i.val);
             break;
+        case WIST_LIR_EXPR_PRIM:
+            printf(" : %s\n", lir_prim_to_string_map[expr->prim.t]);
+            print_expr_indent(expr->prim.lhs, indent + 1);
+            printf("\n");
+            print_expr_indent(expr->prim.rhs, indent + 1);
+            break;
     }
 }
@@ -30,6 +30,8 @@ static bool expect(struct wist_parser *parser, struct wist_token *tok,
 /* Each of these parse_* expressions represents a terminal in the grammar. */
 static struct wist_ast_expr *parse_expr(struct wist_parser *parser);
 static struct wist_ast_expr *parse_lam_expr(struct wist_parser *parser);
+static struct wist_ast_expr *parse_binop_expr(struct wist_parser *parser, 
+        int min_prec);
 static struct wist_ast_expr *parse_app_expr(struct wist_parser *parser);
 static struct wist_ast_expr *parse_atomic_expr(struct wist_parser *parser);
 static struct wist_ast_expr *parse_tuple(struct wist_parser *parser, 
@@ -42,6 +44,12 @@ static struct wist_ast_expr *parse_atomic_expr_maybe(struct wist_parser *parser)
 
 static struct wist_ast_decl *parse_decl(struct wist_parser *parser);
 
+/* 
+ * Returns the precedence of the binary operator [tok] and puts its kind in 
+ * [op_out], or returns 0 if [tok] is not a binary operator. 
+ */
+static int binop_prec(struct wist_token tok, enum wist_ast_binop_kind *op_out);
+
 /* === PUBLICS === */
 
 struct wist_ast_expr *wist_parse_expr(struct wist_compiler *comp, 
@@ -113,7 +121,29 @@ static struct wist_ast_expr *parse_lam_expr(struct wist_parser *parser) {
                     &parser->comp->srclocs, bs_tok.loc, body->loc);
         return wist_ast_create_lam(parser->comp, full_loc, sym, body);
     }
-    return parse_app_expr(parser);
+    return parse_binop_expr(parser, 1);
+}
+
+/* All binary operators are left associative. */
+static struct wist_ast_expr *parse_binop_expr(struct wist_parser *parser, 
+        int min_prec) {
+    struct wist_ast_expr *lhs = parse_app_expr(parser);
+    enum wist_ast_binop_kind op;
+    int prec;
+
+    while ((prec = binop_prec(PEEK_TOK(parser), &op)) >= min_prec) {
+        SKIP_TOK(parser);
+        struct wist_ast_expr *rhs = parse_binop_expr(parser, prec + 1);
+        if (lhs == NULL || rhs == NULL) {
+            return NULL;
+        }
+
+        struct wist_srcloc full_loc = 
+            wist_srcloc_index_combine(parser->comp->ctx, 
+                    &parser->comp->srclocs, lhs->loc, rhs->loc);
+        lhs = wist_ast_create_binop(parser->comp, full_loc, op, lhs, rhs);
+    }
+    return lhs;
 }
 
 static struct wist_ast_expr *parse_app_expr(struct wist_parser *parser) {
@@ -138,7 +168,7 @@ static struct wist_ast_expr *parse_tuple(struct wist_parser *parser,
 
     while (PEEK_TOK(parser).t == WIST_TOKEN_COMMA) {
         SKIP_TOK(parser);
-        struct wist_ast_expr *field = parse_atomic_expr(parser);
+        struct wist_ast_expr *field = parse_expr(parser);
         WIST_VECTOR_PUSH(parser->comp->ctx, &fields, struct wist_ast_expr *, 
                 &field);
     }
@@ -194,6 +224,17 @@ static struct wist_ast_expr *parse_atomic_expr_maybe(struct wist_parser *parser)
         case WIST_TOKEN_COMMA:
         case WIST_TOKEN_IN:
         case WIST_TOKEN_END:
+        case WIST_TOKEN_PLUS:
+        case WIST_TOKEN_MINUS:
+        case WIST_TOKEN_STAR:
+        case WIST_TOKEN_SLASH:
+        case WIST_TOKEN_PERCENT:
+        case WIST_TOKEN_LT:
+        case WIST_TOKEN_LT_EQ:
+        case WIST_TOKEN_GT:
+        case WIST_TOKEN_GT_EQ:
+        case WIST_TOKEN_EQ_EQ:
+        case WIST_TOKEN_BANG_EQ:
             return NULL;
         default: {
             struct wist_diag *diag = wist_compiler_add_diag(parser->comp, 
@@ -233,3 +274,44 @@ static struct wist_ast_decl *parse_decl(struct wist_parser *parser) {
     return wist_ast_create_bind(parser->comp, full_loc, sym_tok.sym, expr);
 }
 
+static int binop_prec(struct wist_token tok, enum wist_ast_binop_kind *op_out) {
+    switch (tok.t) {
+        case WIST_TOKEN_STAR:
+            *op_out = WIST_AST_BINOP_MUL;
+            return 3;
+        case WIST_TOKEN_SLASH:
+            *op_out = WIST_AST_BINOP_DIV;
+            return 3;
+        case WIST_TOKEN_PERCENT:
+            *op_out = WIST_AST_BINOP_REM;
+            return 3;
+        case WIST_TOKEN_PLUS:
+            *op_out = WIST_AST_BINOP_ADD;
+            return 2;
+        case WIST_TOKEN_MINUS:
+            *op_out = WIST_AST_BINOP_SUB;
+            return 2;
+        case WIST_TOKEN_LT:
+            *op_out = WIST_AST_BINOP_LT;
+            return 1;
+        case WIST_TOKEN_LT_EQ:
+            *op_out = WIST_AST_BINOP_LE;
+            return 1;
+        case WIST_TOKEN_GT:
+            *op_out = WIST_AST_BINOP_GT;
+            return 1;
+        case WIST_TOKEN_GT_EQ:
+            *op_out = WIST_AST_BINOP_GE;
+            return 1;
+        case WIST_TOKEN_EQ_EQ:
+            *op_out = WIST_AST_BINOP_EQ;
+            return 1;
+        case WIST_TOKEN_BANG_EQ:
+            *op_out = WIST_AST_BINOP_NE;
+            return 1;
+        default:
+            /* Not an operator, but callers still never see [op_out] unset. */
+            *op_out = WIST_AST_BINOP_ADD;
+            return 0;
+    }
+}
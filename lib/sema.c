@@ -62,6 +62,8 @@ static struct wist_ast_type *prune(struct wist_compiler *comp,
 static void unify(struct wist_compiler *comp, struct wist_ast_type *t1, 
         struct wist_ast_type *t2);
 static bool type_eq(struct wist_ast_type *t1, struct wist_ast_type *t2);
+static struct wist_ast_type *instantiate_type(struct wist_compiler *comp, 
+        struct wist_ast_type *type, struct type_type_map **mappings);
 
 /* Repairs and cleanup for our post-inference AST. */
 static struct wist_ast_type *prune_full_type(struct wist_compiler *comp,
@@ -143,10 +145,18 @@ static struct wist_ast_type *infer_expr_rec(struct wist_compiler *comp,
                      * it to a global var expression. 
                      */
                     struct wist_ast_expr old = *expr;
+                    struct type_type_map *mappings = NULL;
                     expr->t = WIST_AST_EXPR_GVAR;
                     expr->gvar.sym = old.var.sym;
                     expr->gvar.var = toplvl;
-                    expr->type = toplvl->type;
+                    expr->type = instantiate_type(comp, toplvl->type, 
+                            &mappings);
+                    while (mappings != NULL) {
+                        struct type_type_map *next = mappings->next;
+                        WIST_CTX_FREE(comp->ctx, mappings, 
+                                struct type_type_map);
+                        mappings = next;
+                    }
                 }
             } else {
                 expr->var.var = entry;
@@ -228,6 +238,23 @@ static struct wist_ast_type *infer_expr_rec(struct wist_compiler *comp,
             expr->type = wist_ast_create_int_type(comp);
             break;
         }
+        case WIST_AST_EXPR_BINOP: {
+            struct wist_ast_type *lhs_type = infer_expr_rec(comp, scope, 
+                    expr->binop.lhs, non_generics);
+            if (lhs_type == NULL) {
+                return NULL;
+            }
+            struct wist_ast_type *rhs_type = infer_expr_rec(comp, scope, 
+                    expr->binop.rhs, non_generics);
+            if (rhs_type == NULL) {
+                return NULL;
+            }
+            comp->cur_expr = expr;
+            unify(comp, lhs_type, wist_ast_create_int_type(comp));
+            unify(comp, rhs_type, wist_ast_create_int_type(comp));
+            expr->type = wist_ast_create_int_type(comp);
+            break;
+        }
         default:
             printf("Invalid case in infer_expr_rec\n");
             return NULL;
@@ -364,6 +391,52 @@ static struct wist_ast_type *fresh_type_rec(struct wist_compiler *comp,
     return NULL;
 }
 
+/* 
+ * Globals are stored with their generic types already renamed, so every use 
+ * gets its own fresh type variables in place of the generics. 
+ */
+static struct wist_ast_type *instantiate_type(struct wist_compiler *comp, 
+        struct wist_ast_type *type, struct type_type_map **mappings) {
+    switch (type->t) {
+        case WIST_AST_TYPE_GEN: {
+            struct type_type_map *iter = *mappings;
+            while (iter != NULL) {
+                if (iter->key->gen.id == type->gen.id) {
+                    return iter->val;
+                }
+                iter = iter->next;
+            }
+            struct type_type_map *new_mappings = 
+                WIST_CTX_NEW(comp->ctx, struct type_type_map);
+            new_mappings->next = *mappings;
+            new_mappings->key = type;
+            new_mappings->val = wist_ast_create_var_type(comp);
+            *mappings = new_mappings;
+            return new_mappings->val;
+        }
+        case WIST_AST_TYPE_FUN:
+            return wist_ast_create_fun_type(comp, 
+                    instantiate_type(comp, type->fun.in, mappings),
+                    instantiate_type(comp, type->fun.out, mappings));
+        case WIST_AST_TYPE_TUPLE: {
+            struct wist_vector fields;
+            WIST_VECTOR_INIT(comp->ctx, &fields, struct wist_ast_type *);
+            WIST_VECTOR_FOR_EACH(&type->tuple.fields, struct wist_ast_type *, 
+                    field) {
+                struct wist_ast_type *new_field = 
+                    instantiate_type(comp, *field, mappings);
+                WIST_VECTOR_PUSH(comp->ctx, &fields, struct wist_ast_type *, 
+                        &new_field);
+            }
+            return wist_ast_create_tuple_type(comp, fields);
+        }
+        case WIST_AST_TYPE_INT:
+        case WIST_AST_TYPE_VAR:
+            break;
+    }
+    return type;
+}
+
 static struct wist_ast_type *prune(struct wist_compiler *comp, 
         struct wist_ast_type *type) {
     if (type->t == WIST_AST_TYPE_VAR && type->var.instance != NULL) {
@@ -491,6 +564,10 @@ static void prune_full_expr(struct wist_compiler *comp,
                 prune_full_expr(comp, *field, renamer);
             }
             break;
+        case WIST_AST_EXPR_BINOP:
+            prune_full_expr(comp, expr->binop.lhs, renamer);
+            prune_full_expr(comp, expr->binop.rhs, renamer);
+            break;
         case WIST_AST_EXPR_VAR:
         case WIST_AST_EXPR_GVAR:
         case WIST_AST_EXPR_INT:
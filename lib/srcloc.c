@@ -19,10 +19,16 @@ struct srcloc_segment {
     size_t src_len;
 };
 
+static struct wist_srcloc add_absolute(struct wist_ctx *ctx, 
+        struct wist_srcloc_index *index, uint64_t start, uint64_t end);
+static struct srcloc_segment *find_segment(struct wist_srcloc_index *index, 
+        struct wist_srcloc loc, size_t *start_out, size_t *end_out);
+
 void wist_srcloc_index_init(struct wist_ctx *ctx, 
         struct wist_srcloc_index *index) {
     WIST_VECTOR_INIT(ctx, &index->locs, struct wist_wsrcloc);
     WIST_VECTOR_INIT(ctx, &index->segments, struct srcloc_segment);
+    index->cur_segment = index->cur_base = 0;
 }
 
 /* Adds a text segment to an index. */
@@ -34,7 +40,7 @@ void wist_srcloc_index_add_segment(struct wist_ctx *ctx,
     };
 
     index->cur_segment = WIST_VECTOR_LEN(&index->segments, struct srcloc_segment);
-    if (index->cur_segment > 1) {
+    if (index->cur_segment > 0) {
         index->cur_base += WIST_VECTOR_INDEX(&index->segments, 
                 struct srcloc_segment, index->cur_segment - 1)->src_len;
     }
@@ -44,29 +50,13 @@ void wist_srcloc_index_add_segment(struct wist_ctx *ctx,
 
 void wist_srcloc_index_finish(struct wist_ctx *ctx, struct wist_srcloc_index *index) {
     WIST_VECTOR_FINISH(ctx, &index->locs);
+    WIST_VECTOR_FINISH(ctx, &index->segments);
 }
 
 struct wist_srcloc wist_srcloc_index_add(struct wist_ctx *ctx, 
         struct wist_srcloc_index *index, uint64_t start, uint64_t end) {
-    struct wist_srcloc loc;
-    start += index->cur_base;
-    end += index->cur_base;
-
-    if (start > UINT16_MAX || end > UINT16_MAX)
-    {
-        struct wist_wsrcloc wloc = {
-            .start = start,
-            .end = end,
-        };
-        WIST_VECTOR_PUSH(ctx, &index->locs, struct wist_wsrcloc, &wloc);
-        loc.start = WIST_VECTOR_LEN(&index->locs, struct wist_wsrcloc);
-        loc.len = 0;
-    } else {
-        loc.start = (uint16_t) start;
-        loc.len = (uint16_t) (end - start);
-    }
-
-    return loc;
+    return add_absolute(ctx, index, start + index->cur_base, 
+            end + index->cur_base);
 }
 
 struct wist_srcloc wist_srcloc_index_combine(struct wist_ctx *ctx,
@@ -89,16 +79,78 @@ struct wist_srcloc wist_srcloc_index_combine(struct wist_ctx *ctx,
         end = (uint64_t) (l2.start + l2.len);
     }
 
-    return wist_srcloc_index_add(ctx, index, start, end);
+    return add_absolute(ctx, index, start, end);
 }
 
 const uint8_t *wist_srcloc_index_slice(struct wist_srcloc_index *index, 
         struct wist_srcloc loc, size_t *str_len_out) {
-    size_t idx = 0;
-    uint64_t start;
-    uint64_t end;
+    size_t start, end;
+    struct srcloc_segment *segment = find_segment(index, loc, &start, &end);
+    if (segment == NULL) {
+        printf("Couldn't find segment. \n");
+        return NULL;
+    }
+
+    *str_len_out = end - start;
+    return segment->src + start;
+}
+
+bool wist_srcloc_index_locate(struct wist_srcloc_index *index, 
+        struct wist_srcloc loc, size_t *line_out, size_t *col_out) {
+    size_t start, end;
+    struct srcloc_segment *segment = find_segment(index, loc, &start, &end);
+    if (segment == NULL) {
+        return false;
+    }
+
+    *line_out = *col_out = 1;
+    for (size_t i = 0; i < start; i++) {
+        if (segment->src[i] == '\n') {
+            (*line_out)++;
+            *col_out = 1;
+        } else {
+            (*col_out)++;
+        }
+    }
+    return true;
+}
+
+/* Makes a srcloc from offsets into the whole text rather than a segment. */
+static struct wist_srcloc add_absolute(struct wist_ctx *ctx, 
+        struct wist_srcloc_index *index, uint64_t start, uint64_t end) {
+    struct wist_srcloc loc;
+
+    /* Empty locations go in the index too, since [len] 0 marks those. */
+    if (start > UINT16_MAX || end > UINT16_MAX || start == end)
+    {
+        struct wist_wsrcloc wloc = {
+            .start = start,
+            .end = end,
+        };
+        loc.start = WIST_VECTOR_LEN(&index->locs, struct wist_wsrcloc);
+        WIST_VECTOR_PUSH(ctx, &index->locs, struct wist_wsrcloc, &wloc);
+        loc.len = 0;
+    } else {
+        loc.start = (uint16_t) start;
+        loc.len = (uint16_t) (end - start);
+    }
+
+    return loc;
+}
+
+/* 
+ * Finds the segment [loc] is in, with its start and end made relative to 
+ * the segment.  A location right at the end of the text is in the last one. 
+ */
+static struct srcloc_segment *find_segment(struct wist_srcloc_index *index, 
+        struct wist_srcloc loc, size_t *start_out, size_t *end_out) {
+    size_t idx = 0, start, end;
     if (loc.len == 0)
     {
+        if ((size_t) loc.start >= WIST_VECTOR_LEN(&index->locs, 
+                    struct wist_wsrcloc)) {
+            return NULL;
+        }
         struct wist_wsrcloc *wloc = 
             WIST_VECTOR_INDEX(&index->locs, struct wist_wsrcloc, 
                     (size_t) loc.start);
@@ -109,13 +161,17 @@ const uint8_t *wist_srcloc_index_slice(struct wist_srcloc_index *index,
         end = start + loc.len;
     }
     
-    WIST_VECTOR_FOR_EACH(&index->segments, struct srcloc_segment, segment) {
-        if (idx + segment->src_len >= start) {
-            *str_len_out = end - start;
-            return segment->src + (start - idx);
+    size_t count = WIST_VECTOR_LEN(&index->segments, struct srcloc_segment);
+    for (size_t i = 0; i < count; i++) {
+        struct srcloc_segment *segment = WIST_VECTOR_INDEX(&index->segments, 
+                struct srcloc_segment, i);
+        if (start < idx + segment->src_len 
+                || (i + 1 == count && start == idx + segment->src_len)) {
+            *start_out = start - idx;
+            *end_out = end - idx;
+            return segment;
         }
         idx += segment->src_len;
     }
-    printf("Couldn't find segment. \n");
     return NULL;
 }
@@ -18,17 +18,33 @@ static void toplvl_scope_finish(struct wist_ctx *ctx,
 void wist_toplvl_init(struct wist_ctx *ctx, struct wist_toplvl *toplvl) {
     toplvl->ctx = ctx;
     toplvl_scope_init(ctx, &toplvl->global);
+    WIST_VECTOR_INIT(ctx, &toplvl->slots, struct wist_vm_obj);
+    WIST_VECTOR_INIT(ctx, &toplvl->slot_syms, struct wist_sym *);
 }
 
 void wist_toplvl_finish(struct wist_toplvl *toplvl) {
     toplvl_scope_finish(toplvl->ctx, &toplvl->global);
+    WIST_VECTOR_FINISH(toplvl->ctx, &toplvl->slots);
+    WIST_VECTOR_FINISH(toplvl->ctx, &toplvl->slot_syms);
 }
 
 struct wist_toplvl_entry *wist_toplvl_add(struct wist_toplvl *toplvl, 
         struct wist_sym *sym) {
-    struct wist_toplvl_entry tmp;
-    struct wist_toplvl_entry *entry = 
-        WIST_MAP_INSERT(toplvl->ctx, &toplvl->global.entries, &sym, &tmp, 
+    struct wist_toplvl_entry *entry = wist_toplvl_find(toplvl, sym);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    struct wist_toplvl_entry tmp = {
+        .type = NULL,
+        .slot = WIST_VECTOR_LEN(&toplvl->slots, struct wist_vm_obj),
+    };
+    struct wist_vm_obj *val = WIST_VECTOR_PUSH_UNINIT(toplvl->ctx, 
+            &toplvl->slots, struct wist_vm_obj);
+    *val = WIST_VM_OBJ_MAKE_UNDEFINED();
+    WIST_VECTOR_PUSH(toplvl->ctx, &toplvl->slot_syms, struct wist_sym *, &sym);
+
+    entry = WIST_MAP_INSERT(toplvl->ctx, &toplvl->global.entries, &sym, &tmp, 
                 struct wist_toplvl_entry);
     return entry;
 }
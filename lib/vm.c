@@ -5,26 +5,348 @@
 */
 
 #include <wist/vm.h>
+#include <wist/vm_reg.h>
 #include <wist/ctx.h>
 #include <wist/defs.h>
 #include <wist/toplevel.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
-#define WIST_VM_RSP_MAX_SIZE 128
-#define WIST_VM_ASP_MAX_SIZE 128
-
-struct return_frame {
-    union {
-        struct {
-            struct wist_vm_obj env;
-            uint8_t *pc;
-            int extra_args;
-        } frame;
-        struct wist_vm_obj env;
-    };
-};
+/* 
+ * The interpreter loop is direct threaded (every handler jumps straight to 
+ * the next one through a table of label addresses) when the compiler supports 
+ * GNU labels-as-values.  Building with WIST_VM_SWITCH_DISPATCH defined forces 
+ * the portable switch loop instead.
+ */
+#if defined(__GNUC__) && !defined(WIST_VM_SWITCH_DISPATCH)
+#define WIST_VM_THREADED_DISPATCH
+#endif
+
+/* 
+ * Moves past the next instruction word, and gives its opcode.  Handlers 
+ * read the word again from [pc - 1], so it is not kept live across dispatch. 
+ */
+#ifdef WIST_VM_OP_STATS
+#define VM_FETCH()                                                             \
+    (count_op(vm, op_hist, WIST_VM_INSN_OP(*pc)), WIST_VM_INSN_OP(*pc++))
+#else
+#define VM_FETCH() WIST_VM_INSN_OP(*pc++)
+#endif
+
+/* How many of the commonest pairs and triples wist_vm_write_op_stats lists. */
+#define VM_OP_STATS_TOP 20
+
+#ifdef WIST_VM_THREADED_DISPATCH
+#define VM_CASE(_name) op_##_name
+#define VM_NEXT() goto *dispatch_table[VM_FETCH()]
+#define VM_DISPATCH_BEGIN VM_NEXT();
+#define VM_DISPATCH_END
+#else
+#define VM_CASE(_name) case WIST_VM_OP_##_name
+#define VM_NEXT() break
+#define VM_DISPATCH_BEGIN while (1) { switch (VM_FETCH()) {
+#define VM_DISPATCH_END                                                        \
+            default:                                                           \
+                printf("unimplemented op case in wist_vm_interpret : %d\n",    \
+                        WIST_VM_INSN_OP(pc[-1]));                              \
+                break;                                                         \
+        }                                                                      \
+    }
+#endif
+
+/* The end of the usable part of a stack, which never passes the limit. */
+#define VM_STACK_END(_base, _len)                                              \
+    ((_base) + ((_len) < vm->stack_limit ? (_len) : vm->stack_limit))
+
+/* 
+ * Makes room for [_n] more entries on a stack, growing it if needed and 
+ * bailing out of the interpreter once it would pass the stack limit. 
+ */
+#define VM_RESERVE_ARGS(_n)                                                    \
+    if (asp + (_n) > arg_end) {                                                \
+        size_t _used = asp - vm->arg_stack;                                    \
+        if (!grow_arg_stack(vm, _used + (_n))) {                               \
+            goto stack_overflow;                                               \
+        }                                                                      \
+        asp = vm->arg_stack + _used;                                           \
+        arg_end = VM_STACK_END(vm->arg_stack, vm->arg_stack_len);              \
+    }
+#define VM_RESERVE_RETS(_n)                                                    \
+    if (rsp + (_n) > ret_end) {                                                \
+        size_t _used = rsp - vm->ret_stack;                                    \
+        if (!grow_ret_stack(vm, _used + (_n))) {                               \
+            goto stack_overflow;                                               \
+        }                                                                      \
+        rsp = vm->ret_stack + _used;                                           \
+        ret_end = VM_STACK_END(vm->ret_stack, vm->ret_stack_len);              \
+    }
+
+/* 
+ * Integer arithmetic wraps around on overflow instead of being undefined, 
+ * and the result is then truncated to the width of an integer value. 
+ */
+#define VM_WRAP(_lhs, _op, _rhs)                                               \
+    ((int64_t) ((uint64_t) (_lhs) _op (uint64_t) (_rhs)))
+
+/* 
+ * Defines the handler for an integer primitive, with [lhs] taken from the 
+ * accumulator and [rhs] popped from the argument stack. 
+ */
+#define VM_INT_OP(_name, _result)                                              \
+    VM_CASE(_name): {                                                          \
+        int64_t lhs = WIST_VM_OBJ_GET_INT(accum);                              \
+        int64_t rhs = WIST_VM_OBJ_GET_INT(*(--asp));                           \
+        accum = WIST_VM_OBJ_MAKE_INT(_result);                                 \
+        VM_NEXT();                                                             \
+    }
+
+/* The same, but with [rhs] the operand. */
+#define VM_INT_IMM_OP(_name, _result)                                          \
+    VM_CASE(_name): {                                                          \
+        int64_t lhs = WIST_VM_OBJ_GET_INT(accum);                              \
+        int64_t rhs = WIST_VM_INSN_SARG(pc[-1]);                               \
+        accum = WIST_VM_OBJ_MAKE_INT(_result);                                 \
+        VM_NEXT();                                                             \
+    }
+
+/* 
+ * Collects garbage if it is due.  Everything live is on the stacks, which 
+ * are published to the collector up to the current tops, apart from the 
+ * accumulator and environment, which go in this call's temporary root and 
+ * are read back because the collector moves objects. 
+ */
+#define VM_GC_SAFEPOINT()                                                      \
+    if (WIST_VM_GC_DUE(&vm->gc)) {                                             \
+        size_t _arg_sp = vm->arg_sp, _ret_sp = vm->ret_sp;                     \
+        vm->arg_sp = asp - vm->arg_stack;                                      \
+        vm->ret_sp = rsp - vm->ret_stack;                                      \
+        roots[0] = accum;                                                      \
+        roots[1] = env;                                                        \
+        wist_vm_gc_collect(vm);                                                \
+        accum = roots[0];                                                      \
+        env = roots[1];                                                        \
+        vm->arg_sp = _arg_sp;                                                  \
+        vm->ret_sp = _ret_sp;                                                  \
+    }
+
+/* 
+ * Runs native code for the closure just entered at [pc], if the JIT has 
+ * compiled it, and carries on interpreting wherever the native code stopped. 
+ * Closures are always entered with their one argument as the only local. 
+ */
+#ifdef WIST_VM_JIT
+#define VM_JIT_ON() (vm->jit.enabled && !vm->prof.enabled)
+#define VM_JIT_ENTER()                                                         \
+    if (VM_JIT_ON()) {                                                         \
+        wist_vm_jit_fn _fn = wist_vm_jit_enter(vm,                             \
+                WIST_VM_CODE_OFFSET(vm, pc));                                  \
+        if (_fn != NULL) {                                                     \
+            struct wist_vm_jit_state _state = {                                \
+                vm, accum, env, asp, arg_end, rsp, ret_end, extra_args         \
+            };                                                                 \
+            pc = WIST_VM_CODE_AT(vm, _fn(&_state));                            \
+            accum = _state.accum;                                              \
+            asp = _state.asp;                                                  \
+            rsp = _state.rsp;                                                  \
+            extra_args = _state.extra_args;                                    \
+            /* Native code allocates without ever collecting. */               \
+            VM_GC_SAFEPOINT();                                                 \
+        }                                                                      \
+    }
+#else
+#define VM_JIT_ON() false
+#define VM_JIT_ENTER()
+#endif
+
+/* 
+ * Whether a closure with code [_code] takes exactly [_n] arguments, so a call 
+ * can skip its GRAB.  Native code is only ever entered at the start of a 
+ * closure, so no call does while the JIT is on. 
+ */
+#define VM_TAKES_EXACTLY(_code, _n)                                            \
+    (WIST_VM_INSN_OP((_code)[0]) == WIST_VM_OP_GRAB                            \
+     && (uint8_t) WIST_VM_INSN_ARG((_code)[0]) + 1 == (_n) && !VM_JIT_ON())
+
+/* Lets the heap profiler sample [_obj], which the op at [_op] allocated. */
+#define VM_PROF_ALLOC(_obj, _op)                                               \
+    if (vm->prof.enabled) {                                                    \
+        wist_vm_prof_sample(vm, _obj,                                          \
+                WIST_VM_CODE_OFFSET(vm, _op));                                 \
+    }
+
+/* 
+ * The bodies of the ops superinstructions are made of, shared by the op's 
+ * own handler and every superinstruction it is in.  Each takes its operand 
+ * from [insn], and may leave the handler early, like RETURN. 
+ */
+#define VM_BODY_PUSH {                                                         \
+    VM_RESERVE_ARGS(1);                                                        \
+    *asp++ = accum;                                                            \
+}
+#define VM_BODY_ACCESS {                                                       \
+    /*                                                                         \
+     * Slots below [extra_args] are still on the return stack, the             \
+     * rest live in the flat environment block in the same order.              \
+     */                                                                        \
+    uint8_t _idx = (uint8_t) WIST_VM_INSN_ARG(insn);                           \
+    if (_idx < extra_args) {                                                   \
+        accum = (rsp - (1 + _idx))->env;                                       \
+    } else {                                                                   \
+        accum = WIST_VM_OBJ_FIELD(env, _idx - extra_args);                     \
+    }                                                                          \
+}
+#define VM_BODY_INT64 {                                                        \
+    accum = WIST_VM_OBJ_MAKE_INT(                                              \
+            *((int64_t *) (_op + WIST_VM_INSN_ARG(insn))));                    \
+}
+#define VM_BODY_INTI {                                                         \
+    accum = WIST_VM_OBJ_MAKE_INT(WIST_VM_INSN_SARG(insn));                     \
+}
+#define VM_BODY_GETGLOBAL {                                                    \
+    accum = WIST_TOPLVL_SLOT(vm->toplvl, WIST_VM_INSN_ARG(insn));              \
+}
+#define VM_BODY_APPLY_ANY {                                                    \
+    VM_RESERVE_RETS(2);                                                        \
+    struct wist_vm_ret_frame *_frame = rsp++;                                  \
+    _frame->frame.pc = pc;                                                     \
+    _frame->frame.env = env;                                                   \
+    _frame->frame.extra_args = extra_args;                                     \
+    extra_args = 1;                                                            \
+    _frame = rsp++;                                                            \
+    _frame->env = *(--asp);                                                    \
+    env = WIST_VM_OBJ_FIELD1(accum);                                           \
+    pc = WIST_VM_OBJ_CLO_PC(accum);                                        \
+    VM_JIT_ENTER();                                                            \
+}
+#define VM_BODY_APPLY_EXACT {                                                  \
+    uint8_t _n = (uint8_t) WIST_VM_INSN_ARG(insn);                             \
+    uint32_t *_code = WIST_VM_OBJ_CLO_PC(accum);                           \
+    if (!VM_TAKES_EXACTLY(_code, _n)) {                                        \
+        quicken(_op, WIST_VM_OP_APPLY_ANY);                                    \
+        VM_BODY_APPLY_ANY                                                      \
+    } else {                                                                   \
+        VM_RESERVE_RETS(_n + 1);                                               \
+        rsp->frame.pc = pc;                                                    \
+        rsp->frame.env = env;                                                  \
+        rsp->frame.extra_args = extra_args;                                    \
+        rsp++;                                                                 \
+        for (uint8_t _i = 0; _i < _n; _i++) {                                  \
+            (rsp++)->env = *(--asp);                                           \
+        }                                                                      \
+        extra_args = _n;                                                       \
+        env = WIST_VM_OBJ_FIELD1(accum);                                       \
+        pc = _code + 1;                                                        \
+    }                                                                          \
+}
+#define VM_BODY_APPLY {                                                        \
+    quicken(_op, VM_TAKES_EXACTLY(WIST_VM_OBJ_CLO_PC(accum),               \
+                (uint8_t) WIST_VM_INSN_ARG(insn))                              \
+            ? WIST_VM_OP_APPLY_EXACT : WIST_VM_OP_APPLY_ANY);                  \
+    VM_BODY_APPLY_ANY                                                          \
+}
+#define VM_BODY_RETURN {                                                       \
+    if (rsp == vm->ret_stack + ret_base) {                                     \
+        goto done;                                                             \
+    } else if (WIST_VM_OBJ_IS_MARK(*(asp - 1))) {                              \
+        rsp -= extra_args; /* Drop all the extra args on the return stack. */  \
+        asp--; /* Move past the mark. */                                       \
+        rsp--;                                                                 \
+        pc = rsp->frame.pc;                                                    \
+        env = rsp->frame.env;                                                  \
+        extra_args = rsp->frame.extra_args;                                    \
+    } else {                                                                   \
+        rsp -= extra_args;                                                     \
+        VM_RESERVE_RETS(1);                                                    \
+        (rsp++)->env = *(--asp);                                               \
+        env = WIST_VM_OBJ_FIELD1(accum);                                       \
+        pc = WIST_VM_OBJ_CLO_PC(accum);                                    \
+        extra_args = 1;                                                        \
+        VM_JIT_ENTER();                                                        \
+    }                                                                          \
+}
+
+/* 
+ * The same for APPTERM, which drops the locals of the running closure 
+ * instead of saving its frame. 
+ */
+#define VM_BODY_APPTERM_ANY {                                                  \
+    pc = WIST_VM_OBJ_CLO_PC(accum);                                        \
+    env = WIST_VM_OBJ_FIELD1(accum);                                           \
+    rsp -= extra_args;                                                         \
+    VM_RESERVE_RETS(1);                                                        \
+    extra_args = 1;                                                            \
+    (rsp++)->env = *(--asp);                                                   \
+    VM_JIT_ENTER();                                                            \
+}
+#define VM_BODY_APPTERM_EXACT {                                                \
+    uint8_t _n = (uint8_t) WIST_VM_INSN_ARG(insn);                             \
+    uint32_t *_code = WIST_VM_OBJ_CLO_PC(accum);                           \
+    if (!VM_TAKES_EXACTLY(_code, _n)) {                                        \
+        quicken(_op, WIST_VM_OP_APPTERM_ANY);                                  \
+        VM_BODY_APPTERM_ANY                                                    \
+    } else {                                                                   \
+        env = WIST_VM_OBJ_FIELD1(accum);                                       \
+        rsp -= extra_args;                                                     \
+        VM_RESERVE_RETS(_n);                                                   \
+        for (uint8_t _i = 0; _i < _n; _i++) {                                  \
+            (rsp++)->env = *(--asp);                                           \
+        }                                                                      \
+        extra_args = _n;                                                       \
+        pc = _code + 1;                                                        \
+    }                                                                          \
+}
+#define VM_BODY_APPTERM {                                                      \
+    quicken(_op, VM_TAKES_EXACTLY(WIST_VM_OBJ_CLO_PC(accum),               \
+                (uint8_t) WIST_VM_INSN_ARG(insn))                              \
+            ? WIST_VM_OP_APPTERM_EXACT : WIST_VM_OP_APPTERM_ANY);              \
+    VM_BODY_APPTERM_ANY                                                        \
+}
+
+/* 
+ * Defines the handler for an op made of bodies, where [_op] is where it 
+ * starts, for the ones that quicken it or find a constant from there. 
+ */
+#define VM_BODY_OP(_name, _bodies)                                             \
+    VM_CASE(_name): {                                                          \
+        uint32_t *_op = pc - 1;                                                \
+        uint32_t insn = *_op;                                                  \
+        IGNORE(_op);                                                           \
+        IGNORE(insn);                                                          \
+        _bodies                                                                \
+        VM_NEXT();                                                             \
+    }
+
+/* 
+ * Moves [insn] on to the operand of the second op of a superinstruction, 
+ * which is above that of the first in the same word when they fit, and 
+ * otherwise in the next word. 
+ */
+#define VM_SUPEROP_NEXT(_first, _second)                                       \
+    if (WIST_VM_ARG_BITS_##_first + WIST_VM_ARG_BITS_##_second                 \
+            <= WIST_VM_INSN_ARG_BITS) {                                        \
+        insn >>= WIST_VM_ARG_BITS_##_first;                                    \
+    } else {                                                                   \
+        insn = *pc++;                                                          \
+    }
+
+/* === PROTOTYPES === */
+
+static void quicken(uint32_t *op, uint8_t to);
+static bool grow_arg_stack(struct wist_vm *vm, size_t needed);
+static bool grow_ret_stack(struct wist_vm *vm, size_t needed);
+static struct wist_vm_obj interpret(struct wist_vm *vm, uint32_t *pc, 
+        struct wist_vm_obj env, struct wist_vm_obj accum);
+#ifdef WIST_VM_OP_STATS
+static void count_op(struct wist_vm *vm, uint8_t *hist, uint8_t op);
+static void write_op_seqs(struct wist_vm *vm, FILE *out, uint64_t *counts, 
+        size_t len, size_t seq_len);
+static int compare_op_seqs(const void *lhs, const void *rhs);
+#endif
+
+/* === PUBLICS === */
 
 struct wist_vm *wist_vm_create(struct wist_ctx *ctx) {
     struct wist_vm *vm = WIST_CTX_NEW(ctx, struct wist_vm);
@@ -33,13 +355,67 @@ struct wist_vm *wist_vm_create(struct wist_ctx *ctx) {
     vm->cur_frame = 0;
     vm->frames[vm->cur_frame].cur_handle = 0;
     WIST_VECTOR_INIT(ctx, &vm->handles, struct wist_handle);
-    WIST_VECTOR_INIT(ctx, &vm->code_area, uint8_t);
+    wist_vm_code_init(vm);
+
+    vm->arg_stack_len = vm->ret_stack_len = WIST_VM_STACK_SEGMENT;
+    vm->arg_stack = WIST_CTX_NEW_ARR(ctx, struct wist_vm_obj, 
+            vm->arg_stack_len);
+    vm->ret_stack = WIST_CTX_NEW_ARR(ctx, struct wist_vm_ret_frame, 
+            vm->ret_stack_len);
+    vm->arg_sp = vm->ret_sp = 0;
+    vm->stack_limit = WIST_VM_DEFAULT_STACK_LIMIT;
+    vm->err = WIST_VM_ERR_NONE;
+
+    /* The first code in the code area is the stub wist_vm_apply runs. */
+    uint32_t apply_stub[] = { 
+        WIST_VM_INSN(WIST_VM_OP_APPLY, 1), WIST_VM_INSN(WIST_VM_OP_RETURN, 0) 
+    };
+    vm->apply_stub = wist_vm_code_add(vm, apply_stub, 2);
+    uint32_t restart = WIST_VM_INSN(WIST_VM_OP_RESTART, 0);
+    vm->restart_stub = wist_vm_code_add(vm, &restart, 1);
+
+    vm->tier = WIST_VM_TIER_STACK;
+    WIST_VECTOR_INIT(ctx, &vm->reg_code_area, uint8_t);
+    vm->reg_stack_len = vm->reg_frames_len = WIST_VM_STACK_SEGMENT;
+    vm->reg_stack = WIST_CTX_NEW_ARR(ctx, struct wist_vm_obj, 
+            vm->reg_stack_len);
+    vm->reg_frames = WIST_CTX_NEW_ARR(ctx, struct wist_vm_reg_frame, 
+            vm->reg_frames_len);
+    vm->reg_sp = vm->reg_frame_sp = 0;
+
+    wist_vm_jit_init(vm);
+    wist_vm_prof_init(vm);
+
+#ifdef WIST_VM_OP_STATS
+    size_t ops = __WIST_VM_OP_COUNT;
+    vm->op_pairs = WIST_CTX_NEW_ARR(ctx, uint64_t, ops * ops);
+    vm->op_triples = WIST_CTX_NEW_ARR(ctx, uint64_t, ops * ops * ops);
+    memset(vm->op_pairs, 0, sizeof(uint64_t) * ops * ops);
+    memset(vm->op_triples, 0, sizeof(uint64_t) * ops * ops * ops);
+#endif
     return vm;
 }
 
 void wist_vm_destroy(struct wist_vm *vm) {
     wist_vm_gc_finish(&vm->gc);
     wist_vector_finish(vm->ctx, &vm->handles);
+    wist_vm_code_finish(vm);
+    WIST_CTX_FREE_ARR(vm->ctx, vm->arg_stack, struct wist_vm_obj, 
+            vm->arg_stack_len);
+    WIST_CTX_FREE_ARR(vm->ctx, vm->ret_stack, struct wist_vm_ret_frame, 
+            vm->ret_stack_len);
+    wist_vector_finish(vm->ctx, &vm->reg_code_area);
+    WIST_CTX_FREE_ARR(vm->ctx, vm->reg_stack, struct wist_vm_obj, 
+            vm->reg_stack_len);
+    WIST_CTX_FREE_ARR(vm->ctx, vm->reg_frames, struct wist_vm_reg_frame, 
+            vm->reg_frames_len);
+    wist_vm_jit_finish(vm);
+    wist_vm_prof_finish(vm);
+#ifdef WIST_VM_OP_STATS
+    size_t ops = __WIST_VM_OP_COUNT;
+    WIST_CTX_FREE_ARR(vm->ctx, vm->op_pairs, uint64_t, ops * ops);
+    WIST_CTX_FREE_ARR(vm->ctx, vm->op_triples, uint64_t, ops * ops * ops);
+#endif
     WIST_CTX_FREE(vm->ctx, vm, struct wist_vm);
 }
 
@@ -50,37 +426,327 @@ struct wist_handle *wist_vm_add_handle(struct wist_vm *vm) {
 
 struct wist_handle *wist_vm_eval(struct wist_vm *vm, 
         struct wist_handle *closure) {
+    vm->err = WIST_VM_ERR_NONE;
+    struct wist_vm_obj val = wist_vm_interpret(vm, closure->obj);
+    if (vm->err != WIST_VM_ERR_NONE) {
+        return NULL;
+    }
+
     struct wist_handle *handle = wist_vm_add_handle(vm);
-    handle->obj = wist_vm_interpret(vm, closure->obj);
+    handle->obj = val;
     return handle;
 }
 
+enum wist_vm_err wist_vm_get_err(struct wist_vm *vm) {
+    return vm->err;
+}
+
+void wist_vm_set_stack_limit(struct wist_vm *vm, size_t max_entries) {
+    vm->stack_limit = max_entries;
+}
+
+void wist_vm_collect(struct wist_vm *vm) {
+    wist_vm_gc_collect_full(vm);
+}
+
+void wist_vm_compact(struct wist_vm *vm) {
+    wist_vm_gc_compact(vm);
+}
+
+void wist_vm_set_gc_budget(struct wist_vm *vm, size_t budget_us) {
+    vm->gc.budget_us = budget_us;
+    /* Minor collections are paced up from the smallest nursery. */
+    vm->gc.nursery_due = vm->gc.nursery + (budget_us != 0 ? WIST_VM_GC_MIN_DUE
+            : WIST_VM_GC_NURSERY_SIZE - WIST_VM_GC_NURSERY_SLACK);
+}
+
+size_t wist_vm_set_gc_threads(struct wist_vm *vm, size_t threads) {
+#ifdef WIST_VM_GC_THREADS
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > WIST_VM_GC_MAX_THREADS) {
+        threads = WIST_VM_GC_MAX_THREADS;
+    }
+    /* More would only take turns with each other. */
+    if (threads > wist_vm_gc_cpus()) {
+        threads = wist_vm_gc_cpus();
+    }
+    vm->gc.threads = threads;
+#else
+    IGNORE(threads);
+#endif
+    return vm->gc.threads;
+}
+
+bool wist_vm_set_gc_concurrent(struct wist_vm *vm, bool enabled) {
+#ifdef WIST_VM_GC_THREADS
+    vm->gc.concurrent = enabled;
+#else
+    IGNORE(enabled);
+#endif
+    return vm->gc.concurrent;
+}
+
+bool wist_vm_set_gc_huge_pages(struct wist_vm *vm, bool enabled) {
+#ifdef WIST_VM_GC_HUGE_PAGES
+    vm->gc.huge_pages = enabled;
+#else
+    IGNORE(enabled);
+#endif
+    return vm->gc.huge_pages;
+}
+
+void wist_vm_get_gc_pauses(struct wist_vm *vm,
+        size_t pauses[WIST_VM_GC_PAUSE_BUCKETS]) {
+    memcpy(pauses, vm->gc.stats.pauses, sizeof(vm->gc.stats.pauses));
+}
+
+void wist_vm_get_gc_stats(struct wist_vm *vm, struct wist_vm_gc_stats *stats) {
+    wist_vm_gc_get_stats(&vm->gc, stats);
+}
+
+void wist_vm_set_gc_callback(struct wist_vm *vm, wist_vm_gc_fn fn, void *ud) {
+    vm->gc.callback = fn;
+    vm->gc.callback_ud = ud;
+}
+
+void wist_vm_set_heap_profile(struct wist_vm *vm, bool enabled, 
+        size_t sample_bytes) {
+    vm->prof.enabled = enabled;
+    vm->prof.rate = sample_bytes;
+    vm->prof.countdown = 0;
+}
+
+void wist_vm_write_heap_profile(struct wist_vm *vm, FILE *out, 
+        enum wist_vm_heap_profile what) {
+    wist_vm_prof_write(vm, out, what);
+}
+
+bool wist_vm_write_op_stats(struct wist_vm *vm, FILE *out) {
+#ifdef WIST_VM_OP_STATS
+    size_t ops = __WIST_VM_OP_COUNT;
+    fprintf(out, "pairs:\n");
+    write_op_seqs(vm, out, vm->op_pairs, ops * ops, 2);
+    fprintf(out, "triples:\n");
+    write_op_seqs(vm, out, vm->op_triples, ops * ops * ops, 3);
+    return true;
+#else
+    IGNORE(vm);
+    IGNORE(out);
+    return false;
+#endif
+}
+
+size_t wist_vm_value_size(void) {
+    return sizeof(struct wist_vm_obj);
+}
+
 struct wist_vm_obj wist_vm_interpret(struct wist_vm *vm, 
         struct wist_vm_obj clo) {
-    IGNORE(vm);
+    return interpret(vm, WIST_VM_OBJ_CLO_PC(clo), WIST_VM_OBJ_FIELD1(clo),
+            WIST_VM_OBJ_MAKE_UNDEFINED());
+}
+
+struct wist_vm_obj wist_vm_apply(struct wist_vm *vm, struct wist_vm_obj fun,
+        struct wist_vm_obj arg) {
+    /* The stub's APPLY takes the mark and argument pushed here. */
+    size_t arg_sp = vm->arg_sp;
+    if (arg_sp + 2 > vm->arg_stack_len && !grow_arg_stack(vm, arg_sp + 2)) {
+        vm->err = WIST_VM_ERR_STACK_OVERFLOW;
+        return WIST_VM_OBJ_MAKE_UNDEFINED();
+    }
+    vm->arg_stack[arg_sp] = WIST_VM_OBJ_MAKE_MARK();
+    vm->arg_stack[arg_sp + 1] = arg;
+    vm->arg_sp += 2;
 
-    struct wist_vm_obj accum, env = WIST_VM_OBJ_FIELD1(clo);
-    uint8_t *pc;
+    struct wist_vm_obj result = interpret(vm, vm->apply_stub, 
+            WIST_VM_OBJ_MAKE_UNDEFINED(), fun);
 
-    pc = WIST_VM_OBJ_CLO_PC(vm, clo);
+    vm->arg_sp = arg_sp;
+    return result;
+}
+
+size_t wist_vm_stack_grow_len(struct wist_vm *vm, size_t cur_len, 
+        size_t needed) {
+    if (needed > vm->stack_limit) {
+        return 0;
+    }
 
-    struct wist_vm_obj arg_stack[WIST_VM_ASP_MAX_SIZE];
-    struct wist_vm_obj *asp = arg_stack;
-    struct return_frame return_stack[WIST_VM_RSP_MAX_SIZE];
-    struct return_frame *rsp = return_stack;
+    /* Doubling keeps deep recursion from copying the stack over and over. */
+    size_t new_len = cur_len > 0 ? cur_len : WIST_VM_STACK_SEGMENT;
+    while (new_len < needed) {
+        new_len *= 2;
+    }
+    return new_len < vm->stack_limit ? new_len : vm->stack_limit;
+}
+
+/* === PRIVATES === */
+
+/* 
+ * Rewrites the call at [op] into its quickened form [to], keeping the op in 
+ * front of it if it is the second op of a superinstruction. 
+ */
+static void quicken(uint32_t *op, uint8_t to) {
+    uint8_t first, second;
+    if (wist_vm_obj_split_op(WIST_VM_INSN_OP(*op), &first, &second)) {
+        to = wist_vm_obj_fuse_ops(first, to);
+    }
+    *op = WIST_VM_INSN(to, WIST_VM_INSN_ARG(*op));
+}
+
+static struct wist_vm_obj interpret(struct wist_vm *vm, uint32_t *pc, 
+        struct wist_vm_obj env, struct wist_vm_obj accum) {
+    /* 
+     * Evaluation starts above whatever is already on the stacks, and the 
+     * stacks may move when they grow, so the base is kept as an index. 
+     */
+    size_t ret_base = vm->ret_sp;
+    struct wist_vm_obj *asp = vm->arg_stack + vm->arg_sp;
+    struct wist_vm_obj *arg_end = VM_STACK_END(vm->arg_stack, 
+            vm->arg_stack_len);
+    struct wist_vm_ret_frame *rsp = vm->ret_stack + vm->ret_sp;
+    struct wist_vm_ret_frame *ret_end = VM_STACK_END(vm->ret_stack, 
+            vm->ret_stack_len);
     uint32_t extra_args = 0;
+#ifdef WIST_VM_OP_STATS
+    /* The last two ops, or none yet. */
+    uint8_t op_hist[2] = { __WIST_VM_OP_COUNT, __WIST_VM_OP_COUNT };
+#endif
+
+    /* Where the accumulator and environment are kept during collections. */
+    struct wist_vm_obj roots[2] = { accum, env };
+    wist_vm_gc_push_root(&vm->gc, roots, 2);
+
+#ifdef WIST_VM_THREADED_DISPATCH
+    static void *dispatch_table[] = {
+#define OPCODE(name, _args) [WIST_VM_OP_##name] = &&op_##name,
+#include <wist/vm_ops.h>
+#undef OPCODE
+    };
+#endif
+
+    VM_DISPATCH_BEGIN
+        VM_CASE(CLOSURE): {
+            uint32_t *op = pc - 1;
+            uint32_t insn = *op;
+            VM_GC_SAFEPOINT();
+            uint8_t capture_count = WIST_VM_INSN_A(insn);
+            uint16_t code_len = WIST_VM_INSN_B(insn);
+            uint8_t *captures = (uint8_t *) pc;
+            pc += WIST_VM_CAPTURE_WORDS(capture_count);
+            struct wist_vm_obj clo_env = WIST_VM_GC_ALLOC(&vm->gc, 
+                    capture_count, WIST_VM_OBJ_ENV);
+            /* Copy only the slots the compiler found free in the body. */
+            for (uint8_t i = 0; i < capture_count; i++) {
+                uint8_t idx = captures[i];
+                if (idx < extra_args) {
+                    WIST_VM_OBJ_FIELD(clo_env, i) = (rsp - (1 + idx))->env;
+                } else {
+                    WIST_VM_OBJ_FIELD(clo_env, i) = 
+                        WIST_VM_OBJ_FIELD(env, idx - extra_args);
+                }
+            }
+            accum = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
+            WIST_VM_OBJ_FIELD1(accum) = clo_env;
+            WIST_VM_OBJ_FIELD2(accum) = WIST_VM_OBJ_MAKE_CODE(pc);
+            VM_PROF_ALLOC(clo_env, op);
+            VM_PROF_ALLOC(accum, op);
+            pc += code_len;
+            VM_NEXT();
+        }
+        VM_BODY_OP(PUSH, VM_BODY_PUSH)
+        VM_CASE(LET): {
+            VM_RESERVE_RETS(1);
+            (rsp++)->env = accum;
+            extra_args++;
+            VM_NEXT();
+        }
+        VM_CASE(ENDLET): {
+            rsp--;
+            extra_args--;
+            VM_NEXT();
+        }
+        VM_CASE(PUSHMARK): {
+            VM_RESERVE_ARGS(1);
+            *asp++ = WIST_VM_OBJ_MAKE_MARK();
+            VM_NEXT();
+        }
+        VM_CASE(SETGLOBAL): {
+            uint32_t slot = WIST_VM_INSN_ARG(pc[-1]);
+            WIST_VM_GC_BARRIER(&vm->gc, WIST_TOPLVL_SLOT(vm->toplvl, slot));
+            WIST_TOPLVL_SLOT(vm->toplvl, slot) = accum;
+            VM_NEXT();
+        }
+        VM_BODY_OP(GETGLOBAL, VM_BODY_GETGLOBAL)
+        VM_CASE(REGENTER): {
+            uint32_t fn = *pc++;
+            struct wist_vm_obj arg = extra_args > 0 ? (rsp - 1)->env 
+                : WIST_VM_OBJ_MAKE_UNDEFINED();
 
-    accum.t = WIST_VM_OBJ_UNDEFINED;
-    struct wist_vm_obj empty_env = WIST_VM_GC_ALLOC(&vm->gc, 0, WIST_VM_OBJ_ENV);
+            /* Anything the register tier calls back into runs above us. */
+            size_t arg_sp = vm->arg_sp, ret_sp = vm->ret_sp;
+            size_t arg_used = asp - vm->arg_stack;
+            size_t ret_used = rsp - vm->ret_stack;
+            vm->arg_sp = arg_used;
+            vm->ret_sp = ret_used;
+            roots[1] = env;
+            accum = wist_vm_reg_interpret(vm, fn, env, arg);
+            env = roots[1];
+            vm->arg_sp = arg_sp;
+            vm->ret_sp = ret_sp;
 
-    while (1) {
-        switch (*pc++){
-            case WIST_VM_OP_CLOSURE: {
-                uint16_t code_len = *((uint16_t *) pc);
-                pc += 2;
+            asp = vm->arg_stack + arg_used;
+            arg_end = VM_STACK_END(vm->arg_stack, vm->arg_stack_len);
+            rsp = vm->ret_stack + ret_used;
+            ret_end = VM_STACK_END(vm->ret_stack, vm->ret_stack_len);
+            if (vm->err != WIST_VM_ERR_NONE) {
+                goto error;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(GRAB): {
+            uint8_t count = (uint8_t) WIST_VM_INSN_ARG(pc[-1]);
+            uint8_t supplied = 0;
+            while (supplied < count 
+                    && !WIST_VM_OBJ_IS_MARK(*(asp - (1 + supplied)))) {
+                supplied++;
+            }
+
+            if (supplied == count) {
+                VM_RESERVE_RETS(count);
+                for (uint8_t i = 0; i < count; i++) {
+                    (rsp++)->env = *(--asp);
+                }
+                extra_args += count;
+            } else {
+                VM_GC_SAFEPOINT();
+                /* The closure was entered with its first argument only. */
+                struct wist_vm_obj pap = WIST_VM_GC_ALLOC(&vm->gc, 
+                        3 + supplied, WIST_VM_OBJ_PAP);
+                WIST_VM_OBJ_FIELD(pap, 0) = accum;
+                WIST_VM_OBJ_FIELD(pap, 1) = WIST_VM_OBJ_MAKE_CODE(
+                        vm->restart_stub);
+                WIST_VM_OBJ_FIELD(pap, 2) = (rsp - 1)->env;
+                for (uint8_t i = 0; i < supplied; i++) {
+                    WIST_VM_OBJ_FIELD(pap, 3 + i) = *(--asp);
+                }
+                accum = pap;
+                VM_PROF_ALLOC(pap, pc - 1);
+
+                asp--; /* Move past the mark. */
+                rsp -= extra_args + 1;
+                pc = rsp->frame.pc;
+                env = rsp->frame.env;
+                extra_args = rsp->frame.extra_args;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(GRABENV): {
+            if (WIST_VM_OBJ_IS_MARK(*(asp - 1))) {
+                VM_GC_SAFEPOINT();
+                asp--;
                 accum = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
-                WIST_VM_OBJ_FIELD2(accum).idx = pc - WIST_VECTOR_DATA(&vm->code_area, uint8_t);
-                pc += code_len;
+                WIST_VM_OBJ_FIELD2(accum) = WIST_VM_OBJ_MAKE_CODE(pc);
                 size_t env_count = extra_args + WIST_VM_OBJ_FIELD_COUNT(env);
                 struct wist_vm_obj full_env = WIST_VM_GC_ALLOC(&vm->gc, env_count, WIST_VM_OBJ_ENV);
                 for (size_t i = 0; i < extra_args; i++) {
@@ -90,151 +756,197 @@ struct wist_vm_obj wist_vm_interpret(struct wist_vm *vm,
                     WIST_VM_OBJ_FIELD(full_env, i + extra_args) = WIST_VM_OBJ_FIELD(env, i);
                 }
                 WIST_VM_OBJ_FIELD1(accum) = full_env;
-                extra_args = 0;
-                env = full_env;
-                break;
-            }
-            case WIST_VM_OP_PUSH: {
-                *asp++ = accum;
-                break;
-            }
-            case WIST_VM_OP_LET: {
-                (rsp++)->env = accum;
+                VM_PROF_ALLOC(full_env, pc - 1);
+                VM_PROF_ALLOC(accum, pc - 1);
+
+                rsp--;
+                pc = rsp->frame.pc;
+                env = rsp->frame.env;
+                extra_args = rsp->frame.extra_args;
+            } else {
+                VM_RESERVE_RETS(1);
+                asp--;
+                rsp->env = *asp;
+                rsp++;
                 extra_args++;
-                break;
-            }
-            case WIST_VM_OP_ENDLET: {
-                if (extra_args > 0) {
-                    rsp--;
-                    extra_args--;
-                } else {
-                    extra_args = WIST_VM_OBJ_FIELD_COUNT(env) - 1;
-                    for (size_t i = 0; i < extra_args; i++) {
-                        (rsp++)->env = WIST_VM_OBJ_FIELD(env, i + 1);
-                    }
-                    env = empty_env;
-                }
-                break;
-            }
-            case WIST_VM_OP_PUSHMARK: {
-                asp->t = WIST_VM_OBJ_MARK;
-                asp++;
-                break;
             }
-            case WIST_VM_OP_SETGLOBAL: {
-                struct wist_sym *sym = *((struct wist_sym **) pc);
-                pc += sizeof(struct wist_sym **);
-                struct wist_toplvl_entry *entry = 
-                    wist_toplvl_find(vm->toplvl, sym);
-                entry->val = accum;
-                break;
-            }
-            case WIST_VM_OP_GETGLOBAL: {
-                struct wist_sym *sym = *((struct wist_sym **) pc);
-                pc += sizeof(struct wist_sym **);
-                struct wist_toplvl_entry *entry = 
-                    wist_toplvl_find(vm->toplvl, sym);
-                accum = entry->val;
-                break;
-            }
-            case WIST_VM_OP_GRAB: {
-                if ((asp - 1)->t == WIST_VM_OBJ_MARK) {
-                    asp--;
-                    accum = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
-                    WIST_VM_OBJ_FIELD2(accum).idx = pc - WIST_VECTOR_DATA(&vm->code_area, uint8_t);
-                    size_t env_count = extra_args + WIST_VM_OBJ_FIELD_COUNT(env);
-                    struct wist_vm_obj full_env = WIST_VM_GC_ALLOC(&vm->gc, env_count, WIST_VM_OBJ_CLO);
-                    for (size_t i = 0; i < extra_args; i++) {
-                        WIST_VM_OBJ_FIELD(full_env, i) = (--rsp)->env;
-                    }
-                    for (size_t i = 0; i < WIST_VM_OBJ_FIELD_COUNT(env); i++) {
-                        WIST_VM_OBJ_FIELD(full_env, i + extra_args) = WIST_VM_OBJ_FIELD(env, i);
-                    }
-                    WIST_VM_OBJ_FIELD1(accum) = full_env;
-
-                    rsp--;
-                    pc = rsp->frame.pc;
-                    env = rsp->frame.env;
-                    extra_args = rsp->frame.extra_args;
-                } else {
-                    asp--;
-                    rsp->env = *asp;
-                    rsp++;
-                    extra_args++;
-                }
-                break;
-            }
-            case WIST_VM_OP_APPLY: {
-                struct return_frame *frame = rsp++;
-                frame->frame.pc = pc;
-                frame->frame.env = env;
-                frame->frame.extra_args = extra_args;
-                extra_args = 1;
-                frame = rsp++;
-                frame->env = *(--asp);
-                env = WIST_VM_OBJ_FIELD1(accum);
-                pc = WIST_VM_OBJ_CLO_PC(vm, accum);
-                break;
-            }
-            case WIST_VM_OP_APPTERM: {
-                pc = WIST_VM_OBJ_CLO_PC(vm, accum);
-                env = WIST_VM_OBJ_FIELD1(accum);
-                rsp -= extra_args;
-                extra_args = 1;
-                (rsp++)->env = *(--asp);
-                break;
+            VM_NEXT();
+        }
+        VM_CASE(RESTART): {
+            /* 
+             * Entered like a closure, with the partial application in the 
+             * accumulator and the new argument as the only local. 
+             */
+            struct wist_vm_obj pap = accum;
+            size_t held = WIST_VM_OBJ_FIELD_COUNT(pap) - 2;
+            VM_RESERVE_ARGS(held);
+            *asp++ = (rsp - 1)->env;
+            for (size_t i = held - 1; i > 0; i--) {
+                *asp++ = WIST_VM_OBJ_FIELD(pap, 2 + i);
             }
-            case WIST_VM_OP_ACCESS: {
-                uint8_t idx = *pc++;
-                if (idx < extra_args) {
-                    accum = (rsp - (1 + idx))->env;
-                } else {
-                    struct wist_vm_obj iter = env;
-                    for (uint8_t i = extra_args; i < idx; i++) {
-                        iter = WIST_VM_OBJ_FIELD2(iter);
-                    }
-                    accum = WIST_VM_OBJ_FIELD1(iter);
-                }
-                break;
+            (rsp - 1)->env = WIST_VM_OBJ_FIELD(pap, 2);
+            accum = WIST_VM_OBJ_FIELD(pap, 0);
+            env = WIST_VM_OBJ_FIELD1(accum);
+            pc = WIST_VM_OBJ_CLO_PC(accum);
+            VM_JIT_ENTER();
+            VM_NEXT();
+        }
+        VM_BODY_OP(APPLY, VM_BODY_APPLY)
+        VM_BODY_OP(APPLY_EXACT, VM_BODY_APPLY_EXACT)
+        VM_BODY_OP(APPLY_ANY, VM_BODY_APPLY_ANY)
+        VM_BODY_OP(APPTERM, VM_BODY_APPTERM)
+        VM_BODY_OP(APPTERM_EXACT, VM_BODY_APPTERM_EXACT)
+        VM_BODY_OP(APPTERM_ANY, VM_BODY_APPTERM_ANY)
+        VM_BODY_OP(ACCESS, VM_BODY_ACCESS)
+        VM_BODY_OP(INT64, VM_BODY_INT64)
+        VM_BODY_OP(INTI, VM_BODY_INTI)
+        VM_CASE(MKB): {
+            VM_GC_SAFEPOINT();
+            uint32_t field_count = WIST_VM_INSN_ARG(pc[-1]);
+            accum = WIST_VM_GC_ALLOC(&vm->gc, field_count, WIST_VM_OBJ_TUPLE);
+            for (int i = field_count - 1; i >= 0; i--) {
+                WIST_VM_OBJ_FIELD(accum, i) = *(--asp);
             }
-            case WIST_VM_OP_INT64: {
-                accum.t = WIST_VM_OBJ_INT;
-                accum.i =  *((int64_t*) pc);;
-                pc += 8;
-                break;
+            VM_PROF_ALLOC(accum, pc - 1);
+            VM_NEXT();
+        }
+        VM_INT_OP(ADD, VM_WRAP(lhs, +, rhs))
+        VM_INT_OP(SUB, VM_WRAP(lhs, -, rhs))
+        VM_INT_OP(MUL, VM_WRAP(lhs, *, rhs))
+        VM_CASE(DIV): {
+            int64_t lhs = WIST_VM_OBJ_GET_INT(accum);
+            int64_t rhs = WIST_VM_OBJ_GET_INT(*(--asp));
+            if (rhs == 0) {
+                goto div_by_zero;
             }
-            case WIST_VM_OP_MKB: {
-                uint16_t field_count = *((uint16_t *) pc);
-                pc += 2;
-                accum = WIST_VM_GC_ALLOC(&vm->gc, field_count, WIST_VM_OBJ_TUPLE);
-                for (int i = field_count - 1; i >= 0; i--) {
-                    WIST_VM_OBJ_FIELD(accum, i) = *(--asp);
-                }
-                break;
+            /* INT64_MIN / -1 overflows, so negate instead. */
+            accum = WIST_VM_OBJ_MAKE_INT(rhs == -1 ? VM_WRAP(0, -, lhs) 
+                    : lhs / rhs);
+            VM_NEXT();
+        }
+        VM_CASE(REM): {
+            int64_t lhs = WIST_VM_OBJ_GET_INT(accum);
+            int64_t rhs = WIST_VM_OBJ_GET_INT(*(--asp));
+            if (rhs == 0) {
+                goto div_by_zero;
             }
-            case WIST_VM_OP_RETURN: 
-                if (rsp == return_stack) {
-                    return accum;
-                } else {
-                    if ((asp - 1)->t == WIST_VM_OBJ_MARK) {
-                        rsp -= extra_args; /* Drop all the extra args on the return stack. */
-                        asp--; /* Move past the mark. */
-                        rsp--;
-                        pc = rsp->frame.pc;
-                        env = rsp->frame.env;
-                        extra_args = rsp->frame.extra_args;
-                    } else {
-                        rsp -= (extra_args);
-                        (rsp + 1)->env = *(--asp);
-                        env = WIST_VM_OBJ_FIELD1(accum);
-                        pc = WIST_VM_OBJ_CLO_PC(vm, accum);
-                        extra_args = 1;
-                    }
-                    break;
-                };
-            default:
-                printf("unimplemented op case in wist_vm_interpret : %d\n", *(pc - 1));
-                break;
+            accum = WIST_VM_OBJ_MAKE_INT(rhs == -1 ? 0 : lhs % rhs);
+            VM_NEXT();
+        }
+        VM_INT_OP(LT, lhs < rhs)
+        VM_INT_OP(LE, lhs <= rhs)
+        VM_INT_OP(GT, lhs > rhs)
+        VM_INT_OP(GE, lhs >= rhs)
+        VM_INT_OP(EQ, lhs == rhs)
+        VM_INT_OP(NE, lhs != rhs)
+        VM_INT_IMM_OP(ADDI, VM_WRAP(lhs, +, rhs))
+        VM_INT_IMM_OP(LTI, lhs < rhs)
+        VM_INT_IMM_OP(LEI, lhs <= rhs)
+        VM_INT_IMM_OP(GTI, lhs > rhs)
+        VM_INT_IMM_OP(GEI, lhs >= rhs)
+        VM_INT_IMM_OP(EQI, lhs == rhs)
+        VM_INT_IMM_OP(NEI, lhs != rhs)
+        VM_BODY_OP(RETURN, VM_BODY_RETURN)
+#define OPCODE(name, _bits)
+#define SUPEROP(first, second)                                                 \
+        VM_BODY_OP(first##_##second, VM_BODY_##first                           \
+                VM_SUPEROP_NEXT(first, second) VM_BODY_##second)
+#include <wist/vm_ops.h>
+#undef SUPEROP
+#undef OPCODE
+    VM_DISPATCH_END
+
+stack_overflow:
+    vm->err = WIST_VM_ERR_STACK_OVERFLOW;
+    goto error;
+
+div_by_zero:
+    vm->err = WIST_VM_ERR_DIV_BY_ZERO;
+
+error:
+    accum = WIST_VM_OBJ_MAKE_UNDEFINED();
+
+done:
+    wist_vm_gc_pop_root(&vm->gc);
+    return accum;
+}
+
+#ifdef WIST_VM_OP_STATS
+/* Counts [op] as following the ops in [hist], and adds it to them. */
+static void count_op(struct wist_vm *vm, uint8_t *hist, uint8_t op) {
+    size_t ops = __WIST_VM_OP_COUNT;
+    if (hist[1] != __WIST_VM_OP_COUNT) {
+        vm->op_pairs[hist[1] * ops + op]++;
+        if (hist[0] != __WIST_VM_OP_COUNT) {
+            vm->op_triples[(hist[0] * ops + hist[1]) * ops + op]++;
+        }
+    }
+    hist[0] = hist[1];
+    hist[1] = op;
+}
+
+/* 
+ * Writes the most common of the sequences of [seq_len] ops counted in 
+ * [counts], with their share of all of them. 
+ */
+static void write_op_seqs(struct wist_vm *vm, FILE *out, uint64_t *counts, 
+        size_t len, size_t seq_len) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < len; i++) {
+        total += counts[i];
+    }
+
+    /* Sort pointers rather than the counts, since the index is the ops. */
+    uint64_t **sorted = WIST_CTX_NEW_ARR(vm->ctx, uint64_t *, len);
+    for (size_t i = 0; i < len; i++) {
+        sorted[i] = &counts[i];
+    }
+    qsort(sorted, len, sizeof(uint64_t *), compare_op_seqs);
+
+    for (size_t i = 0; i < VM_OP_STATS_TOP && i < len; i++) {
+        if (*sorted[i] == 0) {
+            break;
+        }
+        fprintf(out, "%12" PRIu64 " %5.1f%%", *sorted[i], 
+                100.0 * (double) *sorted[i] / (double) total);
+
+        size_t seq = sorted[i] - counts, div = len;
+        for (size_t j = 0; j < seq_len; j++) {
+            div /= __WIST_VM_OP_COUNT;
+            fprintf(out, " %s", wist_vm_obj_op_name(
+                        (uint8_t) (seq / div % __WIST_VM_OP_COUNT)));
         }
+        fprintf(out, "\n");
     }
+    WIST_CTX_FREE_ARR(vm->ctx, sorted, uint64_t *, len);
+}
+
+static int compare_op_seqs(const void *lhs, const void *rhs) {
+    uint64_t l = **(uint64_t * const *) lhs, r = **(uint64_t * const *) rhs;
+    return l < r ? 1 : l > r ? -1 : 0;
+}
+#endif
+
+static bool grow_arg_stack(struct wist_vm *vm, size_t needed) {
+    size_t new_len = wist_vm_stack_grow_len(vm, vm->arg_stack_len, needed);
+    if (new_len == 0) {
+        return false;
+    }
+
+    vm->arg_stack = WIST_CTX_RESIZE(vm->ctx, vm->arg_stack, 
+            struct wist_vm_obj, vm->arg_stack_len, new_len);
+    vm->arg_stack_len = new_len;
+    return true;
+}
+
+static bool grow_ret_stack(struct wist_vm *vm, size_t needed) {
+    size_t new_len = wist_vm_stack_grow_len(vm, vm->ret_stack_len, needed);
+    if (new_len == 0) {
+        return false;
+    }
+
+    vm->ret_stack = WIST_CTX_RESIZE(vm->ctx, vm->ret_stack, 
+            struct wist_vm_ret_frame, vm->ret_stack_len, new_len);
+    vm->ret_stack_len = new_len;
+    return true;
 }
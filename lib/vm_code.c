@@ -0,0 +1,159 @@
+/* === lib/vm_code.c - Stack tier code area ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/* For mmap under -std=c99. */
+#define _DEFAULT_SOURCE
+
+#include <wist/vm_code.h>
+#include <wist/vm.h>
+#include <wist/ctx.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIST_VM_CODE_MMAP
+#include <sys/mman.h>
+#endif
+
+/* === PROTOTYPES === */
+
+static bool commit(struct wist_vm *vm, size_t *start, size_t len);
+#ifndef WIST_VM_CODE_MMAP
+static size_t chunk_offset(int k);
+#endif
+
+/* === PUBLICS === */
+
+void wist_vm_code_init(struct wist_vm *vm) {
+    struct wist_vm_code_area *area = &vm->code_area;
+    area->len = 0;
+    area->committed = 0;
+
+#ifdef WIST_VM_CODE_MMAP
+    void *base = mmap(NULL, WIST_VM_CODE_AREA_WORDS * sizeof(uint32_t),
+            PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    area->base = base == MAP_FAILED ? NULL : (uint32_t *) base;
+#else
+    area->chunk_count = 0;
+#endif
+}
+
+void wist_vm_code_finish(struct wist_vm *vm) {
+    struct wist_vm_code_area *area = &vm->code_area;
+
+#ifdef WIST_VM_CODE_MMAP
+    if (area->base != NULL) {
+        munmap(area->base, WIST_VM_CODE_AREA_WORDS * sizeof(uint32_t));
+    }
+#else
+    for (int k = 0; k < area->chunk_count; k++) {
+        if (area->chunks[k] != NULL) {
+            WIST_CTX_FREE_ARR(vm->ctx, area->chunks[k], uint32_t,
+                    WIST_VM_CODE_CHUNK_WORDS << k);
+        }
+    }
+#endif
+}
+
+uint32_t *wist_vm_code_add(struct wist_vm *vm, const uint32_t *code,
+        size_t len) {
+    struct wist_vm_code_area *area = &vm->code_area;
+    /* Chunks and the area are 8 byte aligned, so an even offset is too. */
+    size_t start = area->len + area->len % 2;
+    if (len > WIST_VM_CODE_AREA_WORDS || start > WIST_VM_CODE_AREA_WORDS - len
+            || !commit(vm, &start, len)) {
+        printf("Out of room for %zu words of code\n", len);
+        return NULL;
+    }
+
+    uint32_t *dst = WIST_VM_CODE_AT(vm, start);
+    memcpy(dst, code, len * sizeof(uint32_t));
+    area->len = start + len;
+    return dst;
+}
+
+#ifndef WIST_VM_CODE_MMAP
+size_t wist_vm_code_offset(struct wist_vm_code_area *area, const uint32_t *pc) {
+    uintptr_t addr = (uintptr_t) pc;
+    for (int k = 0; k < area->chunk_count; k++) {
+        uintptr_t chunk = (uintptr_t) area->chunks[k];
+        if (chunk != 0 && addr >= chunk && addr < chunk
+                + (WIST_VM_CODE_CHUNK_WORDS << k) * sizeof(uint32_t)) {
+            return chunk_offset(k) + (addr - chunk) / sizeof(uint32_t);
+        }
+    }
+    assert(!"code pointer is not in the code area");
+    return 0;
+}
+
+uint32_t *wist_vm_code_at(struct wist_vm_code_area *area, size_t offset) {
+    int k = 0;
+    while (offset >= chunk_offset(k + 1)) {
+        k++;
+    }
+    return area->chunks[k] + (offset - chunk_offset(k));
+}
+#endif
+
+/* === PRIVATES === */
+
+/*
+ * Makes sure [len] words from offset [start] can be written, a chunk at a
+ * time.  Without mmap, code never straddles two chunks, so [start] may move
+ * on to the first chunk big enough.
+ */
+static bool commit(struct wist_vm *vm, size_t *start, size_t len) {
+    struct wist_vm_code_area *area = &vm->code_area;
+    if (*start + len <= area->committed) {
+        return true;
+    }
+
+#ifdef WIST_VM_CODE_MMAP
+    if (area->base == NULL) {
+        return false;
+    }
+    size_t committed = (*start + len + WIST_VM_CODE_CHUNK_WORDS - 1)
+        / WIST_VM_CODE_CHUNK_WORDS * WIST_VM_CODE_CHUNK_WORDS;
+    if (mprotect(area->base + area->committed,
+                (committed - area->committed) * sizeof(uint32_t),
+                PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    area->committed = committed;
+    return true;
+#else
+    int k = area->chunk_count;
+    while (k < WIST_VM_CODE_CHUNK_COUNT
+            && (WIST_VM_CODE_CHUNK_WORDS << k) < len) {
+        k++;
+    }
+    if (k == WIST_VM_CODE_CHUNK_COUNT
+            || chunk_offset(k) > WIST_VM_CODE_AREA_WORDS - len) {
+        return false;
+    }
+    uint32_t *chunk = WIST_CTX_NEW_ARR(vm->ctx, uint32_t,
+            WIST_VM_CODE_CHUNK_WORDS << k);
+    if (chunk == NULL) {
+        return false;
+    }
+
+    while (area->chunk_count < k) {
+        area->chunks[area->chunk_count++] = NULL;
+    }
+    area->chunks[area->chunk_count++] = chunk;
+    *start = chunk_offset(k);
+    area->committed = chunk_offset(k + 1);
+    return true;
+#endif
+}
+
+#ifndef WIST_VM_CODE_MMAP
+/* Where chunk [k] starts, chunk sizes doubling from the first. */
+static size_t chunk_offset(int k) {
+    return WIST_VM_CODE_CHUNK_WORDS * (((size_t) 1 << k) - 1);
+}
+#endif
@@ -1,38 +1,1372 @@
-/* === lib/vm_gc.c - VM garbage collector === 
+/* === lib/vm_gc.c - VM garbage collector ===
  * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
  * Part of the Wist reference implementation, under the MIT license.
  * See LICENSE.txt for license information.
 */
 
+/* For pthreads, sched_yield, clock_gettime and madvise under -std=c99. */
+#define _DEFAULT_SOURCE
+
 #include <wist/vm_gc.h>
 #include <wist/vm_obj.h>
+#include <wist/vm.h>
 #include <wist/ctx.h>
+#include <wist/toplevel.h>
+
+#include <time.h>
+
+#ifdef WIST_VM_GC_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef WIST_VM_GC_MMAP
+#include <sys/mman.h>
+#endif
+
+#define IS_YOUNG(_gc, _hdr)                                                    \
+    ((uint8_t *) (_hdr) >= (_gc)->nursery                                      \
+     && (uint8_t *) (_hdr) < (_gc)->nursery_end)
+
+/* The [_i]th slot of a page of [_size] byte slots. */
+#define PAGE_SLOT(_page, _size, _i)                                            \
+    ((struct wist_vm_gc_hdr *) ((uint8_t *) ((_page) + 1) + (_size) * (_i)))
+
+#define ELAPSED_US(_start) ((size_t) (now_us() - (_start)))
+
+/* Called on every root slot, which it may update. */
+typedef void (*visit_fn)(struct wist_vm_gc *gc, struct wist_vm_obj *slot);
+
+#ifdef WIST_VM_GC_THREADS
+
+/* The gray objects a worker keeps to itself, half of which it may share. */
+#define PAR_LOCAL_SIZE 256
+/* How many objects a worker scans between checks for idle workers. */
+#define PAR_IDLE_CHECK 64
+
+struct par_worker {
+    struct par_collection *par;
+    pthread_t thread;
+    bool started;
+    struct wist_vm_gc_hdr *local[PAR_LOCAL_SIZE];
+    size_t local_len, scanned, bytes_marked;
+    /* The gray objects other workers may steal, under [lock]. */
+    pthread_mutex_t lock;
+    struct wist_vector shared; /* struct wist_vm_gc_hdr * */
+};
+
+struct par_collection {
+    struct wist_vm_gc *gc;
+    struct par_worker *workers;
+    size_t worker_count;
+    /* The workers still marking, which is 0 once they have all run out. */
+    size_t active;
+    /* Held around anything that may call the context's allocator. */
+    pthread_mutex_t alloc_lock;
+    /* Every page, claimed to sweep by [next_page], and how many are live. */
+    struct wist_vm_gc_page **pages;
+    size_t *live;
+    size_t page_count, next_page;
+};
+
+#endif /* WIST_VM_GC_THREADS */
+
+/* === PROTOTYPES === */
+
+static void collect(struct wist_vm *vm, bool full);
+static void set_limit(struct wist_vm_gc *gc);
+static uint64_t now_us(void);
+static void record_pause(struct wist_vm_gc *gc, uint64_t start);
+static void report(struct wist_vm_gc *gc, enum wist_vm_gc_event event);
+static void report_major(struct wist_vm_gc *gc);
+static void count_young(struct wist_vm_gc *gc,
+        struct wist_vm_gc_stats *stats);
+static void count_obj(struct wist_vm_gc_stats *stats,
+        struct wist_vm_gc_hdr *hdr);
+
+static struct wist_vm_gc_hdr *alloc_old(struct wist_vm_gc *gc,
+        size_t field_count);
+static struct wist_vm_gc_page *new_page(struct wist_vm_gc *gc,
+        size_t field_count);
+static struct wist_vm_gc_page *page_alloc(struct wist_vm_gc *gc);
+static void page_free(struct wist_vm_gc *gc, struct wist_vm_gc_page *page);
+#ifdef WIST_VM_GC_MMAP
+static struct wist_vm_gc_region *region_map(struct wist_vm_gc *gc);
+#endif
+static void release_regions(struct wist_vm_gc *gc);
+static void visit_roots(struct wist_vm *vm, visit_fn visit, bool globals);
+static void visit_arr(struct wist_vm_gc *gc, struct wist_vm_obj *objs,
+        size_t count, visit_fn visit);
+
+static void forward_slot(struct wist_vm_gc *gc, struct wist_vm_obj *slot);
+static void minor(struct wist_vm *vm);
+static void set_due(struct wist_vm_gc *gc, size_t used, size_t us);
+
+static void mark_root(struct wist_vm_gc *gc, struct wist_vm_obj *slot);
+static void start_major(struct wist_vm *vm, bool background);
+static size_t step_budget(struct wist_vm_gc *gc);
+static void step(struct wist_vm_gc *gc, size_t budget_us, uint64_t start);
+static bool marker_busy(struct wist_vm_gc *gc);
+static size_t mark_some(struct wist_vm_gc *gc);
+static void start_sweep(struct wist_vm_gc *gc);
+static size_t sweep_some(struct wist_vm_gc *gc);
+static size_t sweep_page(struct wist_vm_gc *gc, struct wist_vm_gc_page *page);
+static void finish_major(struct wist_vm_gc *gc);
+
+static void plan_class(struct wist_vm_gc_class *class);
+static void compact_slot(struct wist_vm_gc *gc, struct wist_vm_obj *slot);
+static void slide_class(struct wist_vm_gc *gc, struct wist_vm_gc_class *class);
+static void free_slots(struct wist_vm_gc_page *page, size_t from);
+
+#ifdef WIST_VM_GC_THREADS
+static void *marker_main(void *arg);
+static void join_marker(struct wist_vm_gc *gc);
+
+static void par_collect(struct wist_vm_gc *gc);
+static void par_free_empty_pages(struct par_collection *par);
+static void *par_main(void *arg);
+static void par_mark(struct par_worker *w);
+static void par_sweep(struct par_worker *w);
+static void par_scan(struct par_worker *w, struct wist_vm_gc_hdr *hdr);
+static bool par_claim(struct wist_vm_gc *gc, struct wist_vm_gc_hdr *hdr);
+static void par_share(struct par_worker *w, size_t count);
+static bool par_take(struct par_worker *w, struct par_worker *victim);
+static bool par_steal(struct par_worker *w);
+#endif
+
+/* === PUBLICS === */
 
 void wist_vm_gc_init(struct wist_ctx *ctx, struct wist_vm_gc *gc) {
     gc->ctx = ctx;
-    gc->objs = NULL;
+    gc->nursery = WIST_CTX_NEW_ARR(ctx, uint8_t, WIST_VM_GC_NURSERY_SIZE);
+    gc->nursery_top = gc->nursery;
+    gc->nursery_end = gc->nursery + WIST_VM_GC_NURSERY_SIZE;
+    gc->nursery_due = gc->nursery_end - WIST_VM_GC_NURSERY_SLACK;
+    gc->nursery_limit = gc->nursery_end;
+    WIST_VECTOR_INIT(ctx, &gc->remembered, struct wist_vm_gc_hdr *);
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        gc->classes[i].pages = NULL;
+        gc->classes[i].alloc = NULL;
+    }
+    gc->large = NULL;
+    gc->regions = NULL;
+    gc->huge_pages = false;
+    gc->bytes_allocated = 0;
+    gc->next_collect = WIST_VM_GC_MIN_HEAP;
+    memset(&gc->stats, 0, sizeof(gc->stats));
+    gc->callback = NULL;
+    gc->callback_ud = NULL;
+    gc->major_done = false;
+    gc->phase = WIST_VM_GC_IDLE;
+    gc->black = WIST_VM_GC_BLACK_A;
+    gc->budget_us = 0;
+    gc->threads = 1;
+    gc->concurrent = false;
+    gc->bytes_at_start = gc->bytes_marked = 0;
+    gc->globals = NULL;
+    gc->globals_scanned = 0;
+    gc->sweep_class = 0;
+    gc->sweep_page = NULL;
+    gc->sweep_large = NULL;
+    WIST_VECTOR_INIT(ctx, &gc->roots, struct wist_vm_gc_root);
+    WIST_VECTOR_INIT(ctx, &gc->gray, struct wist_vm_gc_hdr *);
+    WIST_VECTOR_INIT(ctx, &gc->copied, struct wist_vm_gc_hdr *);
 }
 
 void wist_vm_gc_finish(struct wist_vm_gc *gc) {
-    struct wist_vm_gc_hdr *iter = gc->objs, *follow = NULL; 
+    struct wist_vm_gc_hdr *iter = gc->large, *follow = NULL;
 
+#ifdef WIST_VM_GC_THREADS
+    if (gc->phase == WIST_VM_GC_BACKGROUND) {
+        pthread_join(gc->marker, NULL);
+    }
+#endif
     while (iter != NULL) {
         follow = iter;
         iter = iter->next;
-        WIST_CTX_FREE_ARR(gc->ctx, follow, uint8_t, 
-                follow->field_count * sizeof(struct wist_vm_obj) 
-              + sizeof(struct wist_vm_gc_hdr));
+        WIST_CTX_FREE_ARR(gc->ctx, follow, uint8_t,
+                WIST_VM_GC_HDR_SIZE(follow->field_count));
     }
+    /* Only pages that did not fit in a region are freed on their own. */
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        struct wist_vm_gc_page *page = gc->classes[i].pages;
+        while (page != NULL) {
+            struct wist_vm_gc_page *next = page->next;
+            if (page->region == NULL) {
+                WIST_CTX_FREE_ARR(gc->ctx, page, uint8_t,
+                        WIST_VM_GC_PAGE_SIZE);
+            }
+            page = next;
+        }
+    }
+    while (gc->regions != NULL) {
+        struct wist_vm_gc_region *region = gc->regions;
+        gc->regions = region->next;
+#ifdef WIST_VM_GC_MMAP
+        munmap(region->base, WIST_VM_GC_REGION_SIZE);
+#endif
+        WIST_CTX_FREE(gc->ctx, region, struct wist_vm_gc_region);
+    }
+    WIST_CTX_FREE_ARR(gc->ctx, gc->nursery, uint8_t, WIST_VM_GC_NURSERY_SIZE);
+    WIST_VECTOR_FINISH(gc->ctx, &gc->remembered);
+    WIST_VECTOR_FINISH(gc->ctx, &gc->roots);
+    WIST_VECTOR_FINISH(gc->ctx, &gc->gray);
+    WIST_VECTOR_FINISH(gc->ctx, &gc->copied);
 }
 
-struct wist_vm_gc_hdr *wist_vm_gc_alloc(struct wist_vm_gc *gc, 
+struct wist_vm_gc_hdr *wist_vm_gc_alloc(struct wist_vm_gc *gc,
         size_t field_count) {
-    struct wist_vm_gc_hdr *new = 
-        (struct wist_vm_gc_hdr *) WIST_CTX_NEW_ARR(gc->ctx, uint8_t, 
-                sizeof(struct wist_vm_gc_hdr) 
-              + sizeof(struct wist_vm_obj) * field_count);
+    size_t size = WIST_VM_GC_HDR_SIZE(field_count);
+
+    /* Only the marking and sweeping are done here, which never move. */
+    if (gc->phase != WIST_VM_GC_IDLE) {
+        if (!marker_busy(gc)) {
+            uint64_t start = now_us();
+            step(gc, step_budget(gc), start);
+            record_pause(gc, start);
+            report_major(gc);
+        }
+        set_limit(gc);
+    }
+
+    if ((size_t) (gc->nursery_end - gc->nursery_top) >= size) {
+        struct wist_vm_gc_hdr *new = (struct wist_vm_gc_hdr *) gc->nursery_top;
+        gc->nursery_top += size;
+        new->mark = 0x0;
+        new->site = 0;
+        new->field_count = field_count;
+        return new;
+    }
+
+    /* It is filled in after this, maybe with nursery objects. */
+    struct wist_vm_gc_hdr *new = alloc_old(gc, field_count);
+    WIST_VECTOR_PUSH(gc->ctx, &gc->remembered, struct wist_vm_gc_hdr *, &new);
+    return new;
+}
+
+void wist_vm_gc_collect(struct wist_vm *vm) {
+    collect(vm, false);
+}
+
+void wist_vm_gc_collect_full(struct wist_vm *vm) {
+    collect(vm, true);
+}
+
+/*
+ * Once the collection is done every page slot is free or live.  The live
+ * ones are given where they go, and everything pointing at them is pointed
+ * there before any of them move.
+ */
+void wist_vm_gc_compact(struct wist_vm *vm) {
+    struct wist_vm_gc *gc = &vm->gc;
+
+    collect(vm, true);
+    uint64_t start = now_us();
+
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        plan_class(&gc->classes[i]);
+    }
+
+    visit_roots(vm, compact_slot, true);
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        size_t size = WIST_VM_GC_HDR_SIZE(i);
+        for (struct wist_vm_gc_page *page = gc->classes[i].pages;
+                page != NULL; page = page->next) {
+            for (size_t j = 0; j < page->slot_count; j++) {
+                struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, j);
+                if (slot->tag != WIST_VM_GC_FREE_TAG) {
+                    visit_arr(gc, slot->fields, slot->field_count,
+                            compact_slot);
+                }
+            }
+        }
+    }
+    for (struct wist_vm_gc_hdr *hdr = gc->large; hdr != NULL;
+            hdr = hdr->next) {
+        visit_arr(gc, hdr->fields, hdr->field_count, compact_slot);
+    }
+
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        slide_class(gc, &gc->classes[i]);
+    }
+    release_regions(gc);
+    gc->stats.compactions++;
+    record_pause(gc, start);
+    report(gc, WIST_VM_GC_EVENT_COMPACT);
+}
+
+void wist_vm_gc_walk(struct wist_vm_gc *gc, wist_vm_gc_walk_fn visit,
+        void *ud) {
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        size_t size = WIST_VM_GC_HDR_SIZE(i);
+        for (struct wist_vm_gc_page *page = gc->classes[i].pages;
+                page != NULL; page = page->next) {
+            for (size_t j = 0; j < page->slot_count; j++) {
+                struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, j);
+                if (slot->tag != WIST_VM_GC_FREE_TAG) {
+                    visit(ud, slot);
+                }
+            }
+        }
+    }
+    for (struct wist_vm_gc_hdr *hdr = gc->large; hdr != NULL;
+            hdr = hdr->next) {
+        visit(ud, hdr);
+    }
+}
+
+void wist_vm_gc_get_stats(struct wist_vm_gc *gc,
+        struct wist_vm_gc_stats *stats) {
+    *stats = gc->stats;
+    stats->heap_bytes = gc->bytes_allocated;
+    count_young(gc, stats);
+}
+
+size_t wist_vm_gc_cpus(void) {
+#ifdef WIST_VM_GC_THREADS
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 1 ? (size_t) cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+void wist_vm_gc_shade(struct wist_vm_gc *gc, struct wist_vm_obj obj) {
+    if (!WIST_VM_OBJ_IS_GC(obj)) {
+        return;
+    }
+
+    /* Nursery objects are all kept until they are copied. */
+    struct wist_vm_gc_hdr *hdr = WIST_VM_OBJ_GET_GC(obj);
+    if (IS_YOUNG(gc, hdr) || hdr->mark == gc->black
+            || hdr->mark == WIST_VM_GC_GRAY) {
+        return;
+    }
+    hdr->mark = WIST_VM_GC_GRAY;
+    gc->bytes_marked += WIST_VM_GC_HDR_SIZE(hdr->field_count);
+    WIST_VECTOR_PUSH(gc->ctx, &gc->gray, struct wist_vm_gc_hdr *, &hdr);
+}
+
+void wist_vm_gc_push_root(struct wist_vm_gc *gc, struct wist_vm_obj *objs,
+        size_t count) {
+    struct wist_vm_gc_root root = { objs, count };
+    WIST_VECTOR_PUSH(gc->ctx, &gc->roots, struct wist_vm_gc_root, &root);
+}
+
+void wist_vm_gc_pop_root(struct wist_vm_gc *gc) {
+    WIST_VECTOR_POP(&gc->roots, struct wist_vm_gc_root);
+}
+
+/* === PRIVATES === */
+
+/*
+ * Empties the nursery, then starts or steps a major collection if one is due
+ * or running.  A [full] collection finishes the running one and does another
+ * to the end, since the first keeps everything allocated while it ran.
+ */
+static void collect(struct wist_vm *vm, bool full) {
+    struct wist_vm_gc *gc = &vm->gc;
+    uint64_t start = now_us();
+    size_t used = (size_t) (gc->nursery_top - gc->nursery);
+
+    minor(vm);
+    set_due(gc, used, ELAPSED_US(start));
+#ifdef WIST_VM_GC_THREADS
+    if (full && gc->phase == WIST_VM_GC_BACKGROUND) {
+        join_marker(gc);
+    }
+#endif
+    if (full && gc->phase != WIST_VM_GC_IDLE) {
+        step(gc, 0, start);
+    }
+    if (gc->phase == WIST_VM_GC_IDLE
+            && (full || gc->bytes_allocated >= gc->next_collect)) {
+        start_major(vm, gc->concurrent && !full);
+    }
+    if (gc->phase != WIST_VM_GC_IDLE) {
+        step(gc, full ? 0 : step_budget(gc), start);
+    }
+
+    /*
+     * Registers above the top may still hold values that were just moved or
+     * freed, and a frame can be entered there before writing all of them.
+     */
+    for (size_t i = vm->reg_sp; i < vm->reg_stack_len; i++) {
+        vm->reg_stack[i] = WIST_VM_OBJ_MAKE_UNDEFINED();
+    }
+
+    set_limit(gc);
+    record_pause(gc, start);
+    report(gc, WIST_VM_GC_EVENT_MINOR);
+    report_major(gc);
+}
+
+/* Makes bump allocation stop at the next step of a running collection. */
+static void set_limit(struct wist_vm_gc *gc) {
+    gc->nursery_limit = gc->nursery_end;
+    if (gc->phase != WIST_VM_GC_IDLE && (size_t) (gc->nursery_end
+                - gc->nursery_top) > WIST_VM_GC_STEP_BYTES) {
+        gc->nursery_limit = gc->nursery_top + WIST_VM_GC_STEP_BYTES;
+    }
+}
+
+/*
+ * Pauses are wall time where there are threads, since the CPU time of a
+ * parallel collection counts every thread.
+ */
+static uint64_t now_us(void) {
+#ifdef WIST_VM_GC_THREADS
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+#else
+    return (uint64_t) clock() * 1000000 / CLOCKS_PER_SEC;
+#endif
+}
+
+static void record_pause(struct wist_vm_gc *gc, uint64_t start) {
+    size_t us = ELAPSED_US(start), bucket = 0;
+
+    gc->stats.pause_us += us;
+    while (us > 0 && bucket < WIST_VM_GC_PAUSE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    gc->stats.pauses[bucket]++;
+}
+
+static void report(struct wist_vm_gc *gc, enum wist_vm_gc_event event) {
+    if (gc->callback != NULL) {
+        struct wist_vm_gc_stats stats;
+        wist_vm_gc_get_stats(gc, &stats);
+        gc->callback(gc->callback_ud, event, &stats);
+    }
+}
+
+/* Reports the major collection that finished in the last pause, if one did. */
+static void report_major(struct wist_vm_gc *gc) {
+    if (gc->major_done) {
+        gc->major_done = false;
+        report(gc, WIST_VM_GC_EVENT_MAJOR);
+    }
+}
+
+/*
+ * Counts what was allocated since the last minor collection into [stats]:
+ * the nursery objects, which lie one after another, and the old objects that
+ * did not fit there, which are all remembered.  Every one has its kind by
+ * now, since collections and steps only happen between allocations.
+ */
+static void count_young(struct wist_vm_gc *gc,
+        struct wist_vm_gc_stats *stats) {
+    uint8_t *iter = gc->nursery;
+    while (iter < gc->nursery_top) {
+        struct wist_vm_gc_hdr *hdr = (struct wist_vm_gc_hdr *) iter;
+        count_obj(stats, hdr);
+        iter += WIST_VM_GC_HDR_SIZE(hdr->field_count);
+    }
+    WIST_VECTOR_FOR_EACH(&gc->remembered, struct wist_vm_gc_hdr *, old) {
+        count_obj(stats, *old);
+    }
+}
+
+static void count_obj(struct wist_vm_gc_stats *stats,
+        struct wist_vm_gc_hdr *hdr) {
+    enum wist_vm_gc_kind kind = WIST_VM_GC_KIND_CLOSURE;
+
+    switch ((enum wist_vm_obj_kind) hdr->tag) {
+        case WIST_VM_OBJ_ENV:
+            kind = WIST_VM_GC_KIND_ENV;
+            break;
+        case WIST_VM_OBJ_TUPLE:
+            kind = WIST_VM_GC_KIND_TUPLE;
+            break;
+        case WIST_VM_OBJ_PAP:
+            kind = WIST_VM_GC_KIND_PARTIAL;
+            break;
+        default:
+            break;
+    }
+    stats->allocated[kind]++;
+    stats->allocated_bytes[kind] += WIST_VM_GC_HDR_SIZE(hdr->field_count);
+}
+
+static struct wist_vm_gc_hdr *alloc_old(struct wist_vm_gc *gc,
+        size_t field_count) {
+    struct wist_vm_gc_hdr *new = NULL;
+
+    if (field_count > WIST_VM_GC_SMALL_FIELDS) {
+        new = (struct wist_vm_gc_hdr *) WIST_CTX_NEW_ARR(gc->ctx, uint8_t,
+                WIST_VM_GC_HDR_SIZE(field_count));
+        new->next = gc->large;
+        gc->large = new;
+    } else {
+        struct wist_vm_gc_class *class = &gc->classes[field_count];
+        struct wist_vm_gc_page *page = class->alloc;
+        while (page != NULL && page->free == NULL) {
+            page = page->next;
+        }
+        if (page == NULL) {
+            page = new_page(gc, field_count);
+        }
+        class->alloc = page;
+        new = page->free;
+        page->free = new->next;
+    }
+
     new->field_count = field_count;
-    new->mark = 0x0;
+    new->mark = gc->black;
     new->tag = 0;
+    new->site = 0;
+    gc->bytes_allocated += WIST_VM_GC_HDR_SIZE(field_count);
     return new;
 }
+
+/* Adds a page to the front of its class, where sweeping will still see it. */
+static struct wist_vm_gc_page *new_page(struct wist_vm_gc *gc,
+        size_t field_count) {
+    struct wist_vm_gc_class *class = &gc->classes[field_count];
+    size_t size = WIST_VM_GC_HDR_SIZE(field_count);
+    struct wist_vm_gc_page *page = page_alloc(gc);
+
+    page->field_count = field_count;
+    page->slot_count = (WIST_VM_GC_PAGE_SIZE - sizeof(*page)) / size;
+    page->free = NULL;
+    page->next = class->pages;
+    class->pages = page;
+
+    /* Pushed from the end so the slots are handed out in address order. */
+    for (size_t i = page->slot_count; i-- > 0;) {
+        struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, i);
+        slot->mark = 0x0;
+        slot->field_count = field_count;
+        slot->tag = WIST_VM_GC_FREE_TAG;
+        slot->next = page->free;
+        page->free = slot;
+    }
+    return page;
+}
+
+/*
+ * Cuts a page from the region with free pages that has the most in use, so
+ * that empty regions stay given back for as long as possible.  If there is
+ * no room and no new region can be mapped, the page comes from the context.
+ */
+static struct wist_vm_gc_page *page_alloc(struct wist_vm_gc *gc) {
+    struct wist_vm_gc_region *region = NULL;
+
+#ifdef WIST_VM_GC_MMAP
+    for (struct wist_vm_gc_region *iter = gc->regions; iter != NULL;
+            iter = iter->next) {
+        if (iter->used_count < WIST_VM_GC_REGION_PAGES && (region == NULL
+                    || iter->used_count > region->used_count)) {
+            region = iter;
+        }
+    }
+    if (region == NULL) {
+        region = region_map(gc);
+    }
+#endif
+
+    if (region == NULL) {
+        struct wist_vm_gc_page *page =
+            (struct wist_vm_gc_page *) WIST_CTX_NEW_ARR(gc->ctx, uint8_t,
+                    WIST_VM_GC_PAGE_SIZE);
+        page->region = NULL;
+        return page;
+    }
+
+    size_t i = 0;
+    while (region->used[i] == UINT64_MAX) {
+        i++;
+    }
+    size_t bit = (size_t) __builtin_ctzll(~region->used[i]);
+    region->used[i] |= (uint64_t) 1 << bit;
+    region->used_count++;
+    region->released = false;
+
+    struct wist_vm_gc_page *page = (struct wist_vm_gc_page *) (region->base
+            + (i * 64 + bit) * WIST_VM_GC_PAGE_SIZE);
+    page->region = region;
+    return page;
+}
+
+static void page_free(struct wist_vm_gc *gc, struct wist_vm_gc_page *page) {
+    struct wist_vm_gc_region *region = page->region;
+
+    if (region == NULL) {
+        WIST_CTX_FREE_ARR(gc->ctx, page, uint8_t, WIST_VM_GC_PAGE_SIZE);
+        return;
+    }
+    size_t i = (size_t) ((uint8_t *) page - region->base)
+        / WIST_VM_GC_PAGE_SIZE;
+    region->used[i / 64] &= ~((uint64_t) 1 << (i % 64));
+    region->used_count--;
+}
+
+#ifdef WIST_VM_GC_MMAP
+
+/*
+ * Maps twice the size and unmaps what is either side of the aligned region
+ * in the middle, since only aligned memory can be backed by huge pages.
+ */
+static struct wist_vm_gc_region *region_map(struct wist_vm_gc *gc) {
+    size_t size = WIST_VM_GC_REGION_SIZE * 2;
+    uint8_t *raw = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint8_t *base = (uint8_t *) (((uintptr_t) raw + WIST_VM_GC_REGION_SIZE - 1)
+            & ~((uintptr_t) WIST_VM_GC_REGION_SIZE - 1));
+    if (base > raw) {
+        munmap(raw, (size_t) (base - raw));
+    }
+    if (base + WIST_VM_GC_REGION_SIZE < raw + size) {
+        munmap(base + WIST_VM_GC_REGION_SIZE,
+                (size_t) (raw + size - base - WIST_VM_GC_REGION_SIZE));
+    }
+#ifdef WIST_VM_GC_HUGE_PAGES
+    if (gc->huge_pages) {
+        madvise(base, WIST_VM_GC_REGION_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+
+    struct wist_vm_gc_region *region = WIST_CTX_NEW(gc->ctx,
+            struct wist_vm_gc_region);
+    region->base = base;
+    memset(region->used, 0, sizeof(region->used));
+    region->used_count = 0;
+    region->released = false;
+    region->next = gc->regions;
+    gc->regions = region;
+    return region;
+}
+
+#endif /* WIST_VM_GC_MMAP */
+
+/*
+ * Gives the memory of every empty region back to the OS, keeping it mapped
+ * for later.  This waits for the end of a collection, rather than the page
+ * that empties a region, so a region is not given back and faulted in again
+ * over and over.
+ */
+static void release_regions(struct wist_vm_gc *gc) {
+#ifdef WIST_VM_GC_MMAP
+    for (struct wist_vm_gc_region *region = gc->regions; region != NULL;
+            region = region->next) {
+        if (region->used_count == 0 && !region->released) {
+            madvise(region->base, WIST_VM_GC_REGION_SIZE, MADV_DONTNEED);
+            region->released = true;
+        }
+    }
+#else
+    IGNORE(gc);
+#endif
+}
+
+/*
+ * The stacks are visited up to the tops saved in the VM, which the
+ * interpreters keep current at every safe point.
+ */
+static void visit_roots(struct wist_vm *vm, visit_fn visit, bool globals) {
+    struct wist_vm_gc *gc = &vm->gc;
+
+    visit_arr(gc, vm->arg_stack, vm->arg_sp, visit);
+    /* Locals and saved frames both keep their value in [env]. */
+    for (size_t i = 0; i < vm->ret_sp; i++) {
+        visit(gc, &vm->ret_stack[i].env);
+    }
+    visit_arr(gc, vm->reg_stack, vm->reg_sp, visit);
+
+    for (size_t i = 0; i <= vm->cur_frame; i++) {
+        struct wist_handle_frame *frame = &vm->frames[i];
+        for (size_t j = 0; j < frame->cur_handle; j++) {
+            visit(gc, &frame->handles[j].obj);
+        }
+    }
+
+    if (globals && vm->toplvl != NULL) {
+        visit_arr(gc, WIST_VECTOR_DATA(&vm->toplvl->slots, struct wist_vm_obj),
+                WIST_VECTOR_LEN(&vm->toplvl->slots, struct wist_vm_obj), visit);
+    }
+
+    WIST_VECTOR_FOR_EACH(&gc->roots, struct wist_vm_gc_root, root) {
+        visit_arr(gc, root->objs, root->count, visit);
+    }
+}
+
+static void visit_arr(struct wist_vm_gc *gc, struct wist_vm_obj *objs,
+        size_t count, visit_fn visit) {
+    for (size_t i = 0; i < count; i++) {
+        visit(gc, &objs[i]);
+    }
+}
+
+/* Points [slot] at the old space copy of a nursery object, copying it first. */
+static void forward_slot(struct wist_vm_gc *gc, struct wist_vm_obj *slot) {
+    if (!WIST_VM_OBJ_IS_GC(*slot)) {
+        return;
+    }
+
+    struct wist_vm_gc_hdr *hdr = WIST_VM_OBJ_GET_GC(*slot);
+    if (!IS_YOUNG(gc, hdr)) {
+        return;
+    }
+
+    if (hdr->mark != WIST_VM_GC_FORWARDED) {
+        struct wist_vm_gc_hdr *copy = alloc_old(gc, hdr->field_count);
+        copy->tag = hdr->tag;
+        copy->site = hdr->site;
+        memcpy(copy->fields, hdr->fields,
+                sizeof(struct wist_vm_obj) * hdr->field_count);
+        hdr->mark = WIST_VM_GC_FORWARDED;
+        hdr->next = copy;
+        WIST_VECTOR_PUSH(gc->ctx, &gc->copied, struct wist_vm_gc_hdr *,
+                &copy);
+    }
+    *slot = wist_vm_obj_create_gc((enum wist_vm_obj_kind) hdr->next->tag,
+            hdr->next);
+}
+
+/*
+ * Copies everything reachable in the nursery to the old space.  The copies
+ * are scanned from a stack rather than in place, because the old space is
+ * not contiguous.  They are allocated black, so a running major collection
+ * keeps them.
+ */
+static void minor(struct wist_vm *vm) {
+    struct wist_vm_gc *gc = &vm->gc;
+    size_t old_bytes = gc->bytes_allocated;
+
+    count_young(gc, &gc->stats);
+    visit_roots(vm, forward_slot, true);
+    WIST_VECTOR_FOR_EACH(&gc->remembered, struct wist_vm_gc_hdr *, old) {
+        visit_arr(gc, (*old)->fields, (*old)->field_count, forward_slot);
+    }
+    while (WIST_VECTOR_LEN(&gc->copied, struct wist_vm_gc_hdr *) > 0) {
+        struct wist_vm_gc_hdr *copy = *WIST_VECTOR_INDEX(&gc->copied,
+                struct wist_vm_gc_hdr *,
+                WIST_VECTOR_LEN(&gc->copied, struct wist_vm_gc_hdr *) - 1);
+        WIST_VECTOR_POP(&gc->copied, struct wist_vm_gc_hdr *);
+        visit_arr(gc, copy->fields, copy->field_count, forward_slot);
+    }
+
+    gc->remembered.data_used = 0;
+    gc->nursery_top = gc->nursery;
+    gc->stats.promoted_bytes += gc->bytes_allocated - old_bytes;
+    gc->stats.minor_collections++;
+}
+
+/*
+ * With a budget, moves up when the next minor collection is due so that it
+ * takes about half of it, going by how long emptying [used] bytes just took.
+ */
+static void set_due(struct wist_vm_gc *gc, size_t used, size_t us) {
+    uint64_t due = WIST_VM_GC_NURSERY_SIZE - WIST_VM_GC_NURSERY_SLACK;
+
+    if (gc->budget_us != 0 && us > 0) {
+        uint64_t paced = (uint64_t) used * (gc->budget_us / 2) / us;
+        due = paced < WIST_VM_GC_MIN_DUE ? WIST_VM_GC_MIN_DUE
+            : paced < due ? paced : due;
+    }
+    gc->nursery_due = gc->nursery + due;
+}
+
+static void mark_root(struct wist_vm_gc *gc, struct wist_vm_obj *slot) {
+    wist_vm_gc_shade(gc, *slot);
+}
+
+/*
+ * Shades the roots other than the globals, which must run just after minor()
+ * so that none of them are in the nursery.  In the [background], the globals
+ * are shaded too and the rest is left to the marker thread.
+ */
+static void start_major(struct wist_vm *vm, bool background) {
+    struct wist_vm_gc *gc = &vm->gc;
+
+    gc->phase = WIST_VM_GC_MARK;
+    gc->black = gc->black == WIST_VM_GC_BLACK_A ? WIST_VM_GC_BLACK_B
+        : WIST_VM_GC_BLACK_A;
+    gc->bytes_at_start = gc->bytes_allocated;
+    gc->bytes_marked = 0;
+    /* Another is not due until this one is done. */
+    gc->next_collect = SIZE_MAX;
+    gc->globals = vm->toplvl != NULL ? &vm->toplvl->slots : NULL;
+    gc->globals_scanned = 0;
+    visit_roots(vm, mark_root, background);
+
+#ifdef WIST_VM_GC_THREADS
+    /*
+     * With one CPU, a marker thread could only take turns with evaluation,
+     * making longer the pauses it lands in, so the steps mark instead.
+     */
+    if (background) {
+        gc->globals = NULL;
+        gc->marked = false;
+        gc->phase = WIST_VM_GC_MARK;
+        if (wist_vm_gc_cpus() > 1 && pthread_create(&gc->marker, NULL,
+                    marker_main, gc) == 0) {
+            gc->phase = WIST_VM_GC_BACKGROUND;
+        }
+    }
+#endif
+}
+
+/*
+ * How long a step may take: the budget, or where marking is done in the
+ * background, short enough that sweeping afterwards is split up as well.
+ */
+static size_t step_budget(struct wist_vm_gc *gc) {
+    if (gc->budget_us == 0 && gc->concurrent) {
+        return WIST_VM_GC_SWEEP_US;
+    }
+    return gc->budget_us;
+}
+
+/*
+ * Marks and sweeps until the major collection is done, or [budget_us] has
+ * gone by since [start] if it is not 0.
+ */
+static void step(struct wist_vm_gc *gc, size_t budget_us, uint64_t start) {
+    size_t work = 0;
+
+#ifdef WIST_VM_GC_THREADS
+    if (gc->phase == WIST_VM_GC_BACKGROUND) {
+        if (marker_busy(gc)) {
+            return;
+        }
+        join_marker(gc);
+    }
+    if (budget_us == 0 && gc->threads > 1 && gc->phase == WIST_VM_GC_MARK) {
+        par_collect(gc);
+    }
+#endif
+
+    while (gc->phase != WIST_VM_GC_IDLE) {
+        work += gc->phase == WIST_VM_GC_MARK ? mark_some(gc) : sweep_some(gc);
+        if (budget_us != 0 && work >= WIST_VM_GC_CLOCK_WORK) {
+            if (ELAPSED_US(start) >= budget_us) {
+                return;
+            }
+            work = 0;
+        }
+    }
+}
+
+/* Whether marking is still going on in the background. */
+static bool marker_busy(struct wist_vm_gc *gc) {
+#ifdef WIST_VM_GC_THREADS
+    return gc->phase == WIST_VM_GC_BACKGROUND
+        && !__atomic_load_n(&gc->marked, __ATOMIC_ACQUIRE);
+#else
+    IGNORE(gc);
+    return false;
+#endif
+}
+
+/*
+ * Scans one gray object, or shades one global once there are none, and
+ * returns about how much work that was.
+ */
+static size_t mark_some(struct wist_vm_gc *gc) {
+    size_t gray_len = WIST_VECTOR_LEN(&gc->gray, struct wist_vm_gc_hdr *);
+    if (gray_len > 0) {
+        struct wist_vm_gc_hdr *hdr = *WIST_VECTOR_INDEX(&gc->gray,
+                struct wist_vm_gc_hdr *, gray_len - 1);
+        WIST_VECTOR_POP(&gc->gray, struct wist_vm_gc_hdr *);
+        hdr->mark = gc->black;
+        for (size_t i = 0; i < hdr->field_count; i++) {
+            wist_vm_gc_shade(gc, hdr->fields[i]);
+        }
+        return 1 + hdr->field_count;
+    }
+
+    if (gc->globals != NULL && gc->globals_scanned
+            < WIST_VECTOR_LEN(gc->globals, struct wist_vm_obj)) {
+        wist_vm_gc_shade(gc, *WIST_VECTOR_INDEX(gc->globals,
+                    struct wist_vm_obj, gc->globals_scanned));
+        gc->globals_scanned++;
+        return 1;
+    }
+
+    start_sweep(gc);
+    return 1;
+}
+
+static void start_sweep(struct wist_vm_gc *gc) {
+    gc->phase = WIST_VM_GC_SWEEP;
+    gc->sweep_class = 0;
+    gc->sweep_page = &gc->classes[0].pages;
+    gc->sweep_large = &gc->large;
+}
+
+/*
+ * Sweeps the next page, or the next large object once the pages are done,
+ * and returns about how much work that was.
+ */
+static size_t sweep_some(struct wist_vm_gc *gc) {
+    if (gc->sweep_class <= WIST_VM_GC_SMALL_FIELDS) {
+        struct wist_vm_gc_class *class = &gc->classes[gc->sweep_class];
+        struct wist_vm_gc_page *page = *gc->sweep_page;
+        if (page == NULL) {
+            class->alloc = class->pages;
+            gc->sweep_class++;
+            if (gc->sweep_class <= WIST_VM_GC_SMALL_FIELDS) {
+                gc->sweep_page = &gc->classes[gc->sweep_class].pages;
+            }
+            return 1;
+        }
+
+        size_t slot_count = page->slot_count;
+        if (sweep_page(gc, page) > 0) {
+            gc->sweep_page = &page->next;
+        } else {
+            *gc->sweep_page = page->next;
+            if (class->alloc == page) {
+                class->alloc = class->pages;
+            }
+            page_free(gc, page);
+        }
+        return slot_count;
+    }
+
+    struct wist_vm_gc_hdr *hdr = *gc->sweep_large;
+    if (hdr == NULL) {
+        finish_major(gc);
+    } else if (hdr->mark == gc->black) {
+        gc->sweep_large = &hdr->next;
+    } else {
+        *gc->sweep_large = hdr->next;
+        WIST_CTX_FREE_ARR(gc->ctx, hdr, uint8_t,
+                WIST_VM_GC_HDR_SIZE(hdr->field_count));
+    }
+    return 1;
+}
+
+/*
+ * Rebuilds the free list of a page from its free and white slots, and
+ * returns how many are still live.
+ */
+static size_t sweep_page(struct wist_vm_gc *gc, struct wist_vm_gc_page *page) {
+    size_t size = WIST_VM_GC_HDR_SIZE(page->field_count);
+    size_t live = 0;
+
+    page->free = NULL;
+    for (size_t i = page->slot_count; i-- > 0;) {
+        struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, i);
+        if (slot->tag != WIST_VM_GC_FREE_TAG) {
+            if (slot->mark == gc->black) {
+                live++;
+                continue;
+            }
+            slot->tag = WIST_VM_GC_FREE_TAG;
+        }
+        slot->next = page->free;
+        page->free = slot;
+    }
+
+    return live;
+}
+
+/* Everything marked and everything allocated since marking started is left. */
+static void finish_major(struct wist_vm_gc *gc) {
+    gc->phase = WIST_VM_GC_IDLE;
+    gc->bytes_allocated = gc->bytes_marked
+        + (gc->bytes_allocated - gc->bytes_at_start);
+    gc->next_collect = gc->bytes_allocated * WIST_VM_GC_GROWTH;
+    if (gc->next_collect < WIST_VM_GC_MIN_HEAP) {
+        gc->next_collect = WIST_VM_GC_MIN_HEAP;
+    }
+    gc->stats.live_bytes = gc->bytes_allocated;
+    gc->stats.major_collections++;
+    gc->major_done = true;
+    release_regions(gc);
+}
+
+/*
+ * Points the [next] of every live slot of [class] at where it will slide to,
+ * which is the next slot in page order that is not taken yet.
+ */
+static void plan_class(struct wist_vm_gc_class *class) {
+    struct wist_vm_gc_page *dest = class->pages;
+    size_t dest_i = 0;
+
+    for (struct wist_vm_gc_page *page = class->pages; page != NULL;
+            page = page->next) {
+        size_t size = WIST_VM_GC_HDR_SIZE(page->field_count);
+        for (size_t i = 0; i < page->slot_count; i++) {
+            struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, i);
+            if (slot->tag == WIST_VM_GC_FREE_TAG) {
+                continue;
+            }
+            slot->next = PAGE_SLOT(dest, size, dest_i);
+            if (++dest_i == dest->slot_count) {
+                dest = dest->next;
+                dest_i = 0;
+            }
+        }
+    }
+}
+
+/*
+ * Points [slot] at where the small old object it holds is going, which may
+ * still be a free slot or hold another object, so nothing is written there.
+ */
+static void compact_slot(struct wist_vm_gc *gc, struct wist_vm_obj *slot) {
+    IGNORE(gc);
+    if (!WIST_VM_OBJ_IS_GC(*slot)) {
+        return;
+    }
+
+    /* Large objects stay where they are, with [next] linking their list. */
+    struct wist_vm_gc_hdr *hdr = WIST_VM_OBJ_GET_GC(*slot);
+    if (hdr->field_count > WIST_VM_GC_SMALL_FIELDS) {
+        return;
+    }
+    *slot = WIST_VM_OBJ_MOVE_GC(*slot, hdr->next);
+}
+
+/*
+ * Moves the live slots of [class] where plan_class said, which is never
+ * after where they are, so none is overwritten before it has moved.  Then
+ * the pages past the last live slot are freed.
+ */
+static void slide_class(struct wist_vm_gc *gc, struct wist_vm_gc_class *class) {
+    struct wist_vm_gc_page *dest = class->pages;
+    size_t dest_i = 0;
+
+    for (struct wist_vm_gc_page *page = class->pages; page != NULL;
+            page = page->next) {
+        size_t size = WIST_VM_GC_HDR_SIZE(page->field_count);
+        for (size_t i = 0; i < page->slot_count; i++) {
+            struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, i);
+            if (slot->tag == WIST_VM_GC_FREE_TAG) {
+                continue;
+            }
+            if (slot->next != slot) {
+                memcpy(slot->next, slot, size);
+            }
+            if (++dest_i == dest->slot_count) {
+                dest->free = NULL;
+                dest = dest->next;
+                dest_i = 0;
+            }
+        }
+    }
+
+    /* [dest] is the first page with free slots, which is kept if not empty. */
+    struct wist_vm_gc_page **link = &class->pages;
+    while (*link != dest) {
+        link = &(*link)->next;
+    }
+    if (dest != NULL && dest_i > 0) {
+        free_slots(dest, dest_i);
+        link = &dest->next;
+    }
+    class->alloc = dest_i > 0 ? dest : NULL;
+    while (*link != NULL) {
+        struct wist_vm_gc_page *page = *link;
+        *link = page->next;
+        page_free(gc, page);
+    }
+}
+
+/* Frees every slot of [page] from [from] on, in address order. */
+static void free_slots(struct wist_vm_gc_page *page, size_t from) {
+    size_t size = WIST_VM_GC_HDR_SIZE(page->field_count);
+
+    page->free = NULL;
+    for (size_t i = page->slot_count; i-- > from;) {
+        struct wist_vm_gc_hdr *slot = PAGE_SLOT(page, size, i);
+        slot->mark = 0x0;
+        slot->tag = WIST_VM_GC_FREE_TAG;
+        slot->next = page->free;
+        page->free = slot;
+    }
+}
+
+#ifdef WIST_VM_GC_THREADS
+
+/*
+ * Scans gray objects until there are none.  Shading calls the context's
+ * allocator as [gray] grows, at the same time as the interpreter does.
+ */
+static void *marker_main(void *arg) {
+    struct wist_vm_gc *gc = arg;
+
+    while (WIST_VECTOR_LEN(&gc->gray, struct wist_vm_gc_hdr *) > 0) {
+        mark_some(gc);
+    }
+    __atomic_store_n(&gc->marked, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Waits for the marker thread to be done, then starts sweeping on this one. */
+static void join_marker(struct wist_vm_gc *gc) {
+    pthread_join(gc->marker, NULL);
+    start_sweep(gc);
+}
+
+/*
+ * Marks everything still gray and sweeps every page on [gc->threads]
+ * threads, leaving only the large objects to sweep.  Nothing is allocated
+ * or moved while it runs.
+ */
+static void par_collect(struct wist_vm_gc *gc) {
+    struct par_collection par;
+    par.gc = gc;
+    par.worker_count = gc->threads;
+    par.workers = WIST_CTX_NEW_ARR(gc->ctx, struct par_worker,
+            par.worker_count);
+    pthread_mutex_init(&par.alloc_lock, NULL);
+    for (size_t i = 0; i < par.worker_count; i++) {
+        struct par_worker *w = &par.workers[i];
+        w->par = &par;
+        w->started = i == 0;
+        w->local_len = w->scanned = w->bytes_marked = 0;
+        pthread_mutex_init(&w->lock, NULL);
+        WIST_VECTOR_INIT(gc->ctx, &w->shared, struct wist_vm_gc_hdr *);
+    }
+
+    /* The globals left are shaded first, then the gray objects dealt out. */
+    while (gc->globals != NULL && gc->globals_scanned
+            < WIST_VECTOR_LEN(gc->globals, struct wist_vm_obj)) {
+        wist_vm_gc_shade(gc, *WIST_VECTOR_INDEX(gc->globals,
+                    struct wist_vm_obj, gc->globals_scanned));
+        gc->globals_scanned++;
+    }
+    size_t dealt = 0;
+    WIST_VECTOR_FOR_EACH(&gc->gray, struct wist_vm_gc_hdr *, hdr) {
+        (*hdr)->mark = gc->black;
+        WIST_VECTOR_PUSH(gc->ctx,
+                &par.workers[dealt++ % par.worker_count].shared,
+                struct wist_vm_gc_hdr *, hdr);
+    }
+    gc->gray.data_used = 0;
+
+    par.page_count = 0;
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        for (struct wist_vm_gc_page *page = gc->classes[i].pages;
+                page != NULL; page = page->next) {
+            par.page_count++;
+        }
+    }
+    par.pages = WIST_CTX_NEW_ARR(gc->ctx, struct wist_vm_gc_page *,
+            par.page_count);
+    par.live = WIST_CTX_NEW_ARR(gc->ctx, size_t, par.page_count);
+    par.next_page = 0;
+    for (size_t i = 0, j = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        for (struct wist_vm_gc_page *page = gc->classes[i].pages;
+                page != NULL; page = page->next) {
+            par.pages[j++] = page;
+        }
+    }
+
+    /* The work dealt to a worker that could not be started is stolen. */
+    par.active = par.worker_count;
+    for (size_t i = 1; i < par.worker_count; i++) {
+        struct par_worker *w = &par.workers[i];
+        w->started = pthread_create(&w->thread, NULL, par_main, w) == 0;
+        if (!w->started) {
+            __atomic_sub_fetch(&par.active, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    par_main(&par.workers[0]);
+
+    for (size_t i = 1; i < par.worker_count; i++) {
+        if (par.workers[i].started) {
+            pthread_join(par.workers[i].thread, NULL);
+        }
+    }
+    for (size_t i = 0; i < par.worker_count; i++) {
+        struct par_worker *w = &par.workers[i];
+        gc->bytes_marked += w->bytes_marked;
+        pthread_mutex_destroy(&w->lock);
+        WIST_VECTOR_FINISH(gc->ctx, &w->shared);
+    }
+    par_free_empty_pages(&par);
+
+    gc->phase = WIST_VM_GC_SWEEP;
+    gc->sweep_class = WIST_VM_GC_SMALL_FIELDS + 1;
+    gc->sweep_large = &gc->large;
+
+    WIST_CTX_FREE_ARR(gc->ctx, par.pages, struct wist_vm_gc_page *,
+            par.page_count);
+    WIST_CTX_FREE_ARR(gc->ctx, par.live, size_t, par.page_count);
+    WIST_CTX_FREE_ARR(gc->ctx, par.workers, struct par_worker,
+            par.worker_count);
+    pthread_mutex_destroy(&par.alloc_lock);
+}
+
+/* Unlinks the pages nothing was left in, which are in the same order. */
+static void par_free_empty_pages(struct par_collection *par) {
+    struct wist_vm_gc *gc = par->gc;
+    size_t j = 0;
+
+    for (size_t i = 0; i <= WIST_VM_GC_SMALL_FIELDS; i++) {
+        struct wist_vm_gc_class *class = &gc->classes[i];
+        struct wist_vm_gc_page **link = &class->pages;
+        while (*link != NULL) {
+            struct wist_vm_gc_page *page = *link;
+            if (par->live[j++] > 0) {
+                link = &page->next;
+            } else {
+                *link = page->next;
+                page_free(gc, page);
+            }
+        }
+        class->alloc = class->pages;
+    }
+}
+
+/* Every worker marks until they have all run out, then sweeps. */
+static void *par_main(void *arg) {
+    struct par_worker *w = arg;
+    par_mark(w);
+    par_sweep(w);
+    return NULL;
+}
+
+static void par_mark(struct par_worker *w) {
+    struct par_collection *par = w->par;
+
+    for (;;) {
+        while (w->local_len > 0) {
+            par_scan(w, w->local[--w->local_len]);
+            if (++w->scanned % PAR_IDLE_CHECK == 0 && w->local_len > 1
+                    && __atomic_load_n(&par->active, __ATOMIC_SEQ_CST)
+                        < par->worker_count) {
+                par_share(w, w->local_len / 2);
+            }
+        }
+        if (par_take(w, w) || par_steal(w)) {
+            continue;
+        }
+
+        /*
+         * Only active workers share, so once none are there is nothing
+         * left anywhere.  Until then, keep looking for something to steal.
+         */
+        __atomic_sub_fetch(&par->active, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&par->active, __ATOMIC_SEQ_CST) == 0) {
+                return;
+            }
+            sched_yield();
+            __atomic_add_fetch(&par->active, 1, __ATOMIC_SEQ_CST);
+            if (par_steal(w)) {
+                break;
+            }
+            __atomic_sub_fetch(&par->active, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+static void par_sweep(struct par_worker *w) {
+    struct par_collection *par = w->par;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&par->next_page, 1, __ATOMIC_RELAXED);
+        if (i >= par->page_count) {
+            return;
+        }
+        par->live[i] = sweep_page(par->gc, par->pages[i]);
+    }
+}
+
+static void par_scan(struct par_worker *w, struct wist_vm_gc_hdr *hdr) {
+    struct wist_vm_gc *gc = w->par->gc;
+
+    for (size_t i = 0; i < hdr->field_count; i++) {
+        struct wist_vm_obj field = hdr->fields[i];
+        if (!WIST_VM_OBJ_IS_GC(field)) {
+            continue;
+        }
+
+        struct wist_vm_gc_hdr *child = WIST_VM_OBJ_GET_GC(field);
+        if (!par_claim(gc, child)) {
+            continue;
+        }
+        w->bytes_marked += WIST_VM_GC_HDR_SIZE(child->field_count);
+        if (w->local_len == PAR_LOCAL_SIZE) {
+            par_share(w, PAR_LOCAL_SIZE / 2);
+        }
+        w->local[w->local_len++] = child;
+    }
+}
+
+/* Blackens [hdr] if it is white, and returns whether this thread did. */
+static bool par_claim(struct wist_vm_gc *gc, struct wist_vm_gc_hdr *hdr) {
+    uint8_t old = __atomic_load_n(&hdr->mark, __ATOMIC_RELAXED);
+
+    if (IS_YOUNG(gc, hdr)) {
+        return false;
+    }
+    do {
+        if (old == gc->black || old == WIST_VM_GC_GRAY) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&hdr->mark, &old, gc->black, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
+
+/* Moves the oldest [count] local objects to where others can steal them. */
+static void par_share(struct par_worker *w, size_t count) {
+    struct par_collection *par = w->par;
+    size_t size = count * sizeof(struct wist_vm_gc_hdr *);
+
+    pthread_mutex_lock(&w->lock);
+    bool grows = w->shared.data_used + size >= w->shared.data_alloc;
+    if (grows) {
+        pthread_mutex_lock(&par->alloc_lock);
+    }
+    WIST_VECTOR_PUSH_ARR(par->gc->ctx, &w->shared, struct wist_vm_gc_hdr *,
+            w->local, count);
+    if (grows) {
+        pthread_mutex_unlock(&par->alloc_lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    w->local_len -= count;
+    memmove(w->local, w->local + count,
+            w->local_len * sizeof(struct wist_vm_gc_hdr *));
+}
+
+/*
+ * Fills the empty local stack of [w] from the shared stack of [victim],
+ * taking half of it from other workers.
+ */
+static bool par_take(struct par_worker *w, struct par_worker *victim) {
+    pthread_mutex_lock(&victim->lock);
+    size_t len = WIST_VECTOR_LEN(&victim->shared, struct wist_vm_gc_hdr *);
+    size_t count = victim == w ? len : (len + 1) / 2;
+    if (count > PAR_LOCAL_SIZE / 2) {
+        count = PAR_LOCAL_SIZE / 2;
+    }
+    memcpy(w->local, WIST_VECTOR_INDEX(&victim->shared,
+                struct wist_vm_gc_hdr *, len - count),
+            count * sizeof(struct wist_vm_gc_hdr *));
+    victim->shared.data_used -= count * sizeof(struct wist_vm_gc_hdr *);
+    pthread_mutex_unlock(&victim->lock);
+
+    w->local_len = count;
+    return count > 0;
+}
+
+static bool par_steal(struct par_worker *w) {
+    struct par_collection *par = w->par;
+    size_t self = (size_t) (w - par->workers);
+
+    for (size_t i = 1; i <= par->worker_count; i++) {
+        if (par_take(w, &par->workers[(self + i) % par->worker_count])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif /* WIST_VM_GC_THREADS */
@@ -8,15 +8,61 @@
 #include <wist/lir.h>
 #include <wist/compiler.h>
 #include <wist/vm.h>
+#include <wist/vm_reg.h>
 #include <wist/vm_obj.h>
 #include <wist/vector.h>
 
 #include <stdio.h>
 #include <inttypes.h>
 
+/* An INT64, with its constant's index in the operand until the code is placed. */
+struct const_ref {
+    /* Where the instruction starts, and the word the operand is in. */
+    size_t insn, word;
+};
+
 struct code_builder {
     struct wist_ctx *ctx;
-    struct wist_vector code;
+    struct wist_vector code; /* uint32_t */
+    /* The pool of constants placed after the code, and what refers to them. */
+    struct wist_vector consts; /* int64_t */
+    struct wist_vector const_refs; /* struct const_ref */
+    /* Where the last op starts, if it can still be fused with the next. */
+    size_t last_op;
+    /* The VM that sites go to while the heap profiler is on, or NULL. */
+    struct wist_vm *vm;
+    struct wist_srcloc_index *srclocs;
+    /* The declaration being generated, and the site of the lambda we are in. */
+    size_t decl, lambda;
+    /* The first site of this code, which is placed with it. */
+    size_t first_site;
+    /* Set once some expression could not be generated, after saying why. */
+    bool failed;
+};
+
+static const uint8_t prim_to_op[] = {
+    [WIST_LIR_PRIM_ADD] = WIST_VM_OP_ADD,
+    [WIST_LIR_PRIM_SUB] = WIST_VM_OP_SUB,
+    [WIST_LIR_PRIM_MUL] = WIST_VM_OP_MUL,
+    [WIST_LIR_PRIM_DIV] = WIST_VM_OP_DIV,
+    [WIST_LIR_PRIM_REM] = WIST_VM_OP_REM,
+    [WIST_LIR_PRIM_LT] = WIST_VM_OP_LT,
+    [WIST_LIR_PRIM_LE] = WIST_VM_OP_LE,
+    [WIST_LIR_PRIM_GT] = WIST_VM_OP_GT,
+    [WIST_LIR_PRIM_GE] = WIST_VM_OP_GE,
+    [WIST_LIR_PRIM_EQ] = WIST_VM_OP_EQ,
+    [WIST_LIR_PRIM_NE] = WIST_VM_OP_NE,
+};
+
+/* Only the primitives wist_lir_prim_imm_form can return are filled in. */
+static const uint8_t prim_to_imm_op[] = {
+    [WIST_LIR_PRIM_ADD] = WIST_VM_OP_ADDI,
+    [WIST_LIR_PRIM_LT] = WIST_VM_OP_LTI,
+    [WIST_LIR_PRIM_LE] = WIST_VM_OP_LEI,
+    [WIST_LIR_PRIM_GT] = WIST_VM_OP_GTI,
+    [WIST_LIR_PRIM_GE] = WIST_VM_OP_GEI,
+    [WIST_LIR_PRIM_EQ] = WIST_VM_OP_EQI,
+    [WIST_LIR_PRIM_NE] = WIST_VM_OP_NEI,
 };
 
 /* === PROTOTYPES === */
@@ -25,14 +71,25 @@ struct code_builder {
 static void code_builder_init(struct wist_ctx *ctx, 
         struct code_builder *builder);
 
-static void code_builder_add_8(struct code_builder *builder, uint8_t byte);
-static void code_builder_add_16(struct code_builder *builder, uint16_t u16);
-static void code_builder_add_64(struct code_builder *builder, uint64_t u64);
+static void code_builder_add_word(struct code_builder *builder, 
+        uint32_t word);
+static size_t code_builder_add_op(struct code_builder *builder, uint8_t op, 
+        uint32_t arg);
+static void code_builder_add_arg_count(struct code_builder *builder, 
+        uint8_t op, size_t count);
+static void code_builder_add_int(struct code_builder *builder, int64_t val);
 static size_t code_builder_count(struct code_builder *builder);
-static size_t code_builder_add_16_uninit(struct code_builder *builder);
+static void code_builder_profile(struct code_builder *builder, 
+        struct wist_compiler *comp, struct wist_vm *vm, const uint8_t *name, 
+        size_t name_len);
+static size_t code_builder_add_site(struct code_builder *builder, 
+        enum wist_vm_prof_kind t, struct wist_lir_expr *expr);
+static uint32_t *code_builder_place(struct code_builder *builder, 
+        struct wist_vm *vm);
 
 static void gen_expr_rec(struct code_builder *builder, 
         struct wist_lir_expr *expr);
+static void gen_prim(struct code_builder *builder, struct wist_lir_expr *expr);
 
 /* === PUBLICS === */
 
@@ -40,25 +97,30 @@ struct wist_handle *wist_compiler_vm_gen_expr(struct wist_compiler *comp,
         struct wist_vm *vm, struct wist_ast_expr *expr) {
     struct code_builder builder;
 
+    if (vm->tier == WIST_VM_TIER_REG) {
+        return wist_compiler_vm_reg_gen_expr(comp, vm, expr);
+    }
+
     struct wist_lir_expr *lir_expr = wist_compiler_lir_gen_expr(comp, expr);
+    wist_lir_resolve_captures(comp, lir_expr);
 
     wist_lir_print_expr(lir_expr);
 
     code_builder_init(comp->ctx, &builder);
+    code_builder_profile(&builder, comp, vm, NULL, 0);
 
     gen_expr_rec(&builder, lir_expr);
 
-    code_builder_add_8(&builder, WIST_VM_OP_RETURN);
+    code_builder_add_op(&builder, WIST_VM_OP_RETURN, 0);
+    uint32_t *code = code_builder_place(&builder, vm);
+    wist_lir_expr_destroy(comp, lir_expr);
+    if (code == NULL) {
+        return NULL;
+    }
 
     struct wist_vm_obj clo = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
     WIST_VM_OBJ_FIELD1(clo) = WIST_VM_GC_ALLOC(&vm->gc, 0, WIST_VM_OBJ_ENV);
-    WIST_VM_OBJ_FIELD2(clo).idx = WIST_VECTOR_LEN(&vm->code_area, uint8_t);
-
-    WIST_VECTOR_PUSH_ARR(vm->ctx, &vm->code_area, uint8_t, 
-            WIST_VECTOR_DATA(&builder.code, uint8_t), 
-            WIST_VECTOR_LEN(&builder.code, uint8_t));
-
-    wist_lir_expr_destroy(comp, lir_expr);
+    WIST_VM_OBJ_FIELD2(clo) = WIST_VM_OBJ_MAKE_CODE(code);
     wist_vm_obj_print_clo(vm, clo);
 
     struct wist_handle *handle = wist_vm_add_handle(vm);
@@ -69,29 +131,42 @@ struct wist_handle *wist_compiler_vm_gen_expr(struct wist_compiler *comp,
 
 struct wist_handle *wist_compiler_vm_gen_decl(struct wist_compiler *comp, 
         struct wist_vm *vm, struct wist_ast_decl *decl) {
+    if (vm->tier == WIST_VM_TIER_REG) {
+        return wist_compiler_vm_reg_gen_decl(comp, vm, decl);
+    }
+
     switch (decl->t) {
         case WIST_AST_DECL_BIND: {
             struct code_builder builder;
             struct wist_lir_expr *lir = wist_compiler_lir_gen_expr(comp, 
                     decl->bind.body);
+            wist_lir_resolve_captures(comp, lir);
             code_builder_init(comp->ctx, &builder);
+            code_builder_profile(&builder, comp, vm, decl->bind.sym->str, 
+                    decl->bind.sym->str_len);
 
             gen_expr_rec(&builder, lir);
 
-            code_builder_add_8(&builder, WIST_VM_OP_SETGLOBAL);
-            code_builder_add_64(&builder, (uint64_t) decl->bind.sym);
-            code_builder_add_8(&builder, WIST_VM_OP_RETURN);
+            struct wist_toplvl_entry *entry = wist_toplvl_find(&comp->toplvl,
+                    decl->bind.sym);
+            if (entry->slot > WIST_VM_INSN_ARG_MAX) {
+                printf("Global slot %" PRIu32 " is too big for SETGLOBAL\n", 
+                        entry->slot);
+                builder.failed = true;
+            }
+            code_builder_add_op(&builder, WIST_VM_OP_SETGLOBAL, entry->slot);
+            code_builder_add_op(&builder, WIST_VM_OP_RETURN, 0);
+            uint32_t *code = code_builder_place(&builder, vm);
+            wist_lir_expr_destroy(comp, lir);
+            if (code == NULL) {
+                return NULL;
+            }
+
             struct wist_vm_obj clo = WIST_VM_GC_ALLOC(&vm->gc, 2, 
                     WIST_VM_OBJ_CLO);
             WIST_VM_OBJ_FIELD1(clo) = WIST_VM_GC_ALLOC(&vm->gc, 0, 
                     WIST_VM_OBJ_ENV);
-            WIST_VM_OBJ_FIELD2(clo).idx = WIST_VECTOR_LEN(&vm->code_area, 
-                    uint8_t);
-
-            WIST_VECTOR_PUSH_ARR(vm->ctx, &vm->code_area, uint8_t, 
-                    WIST_VECTOR_DATA(&builder.code, uint8_t), 
-                    WIST_VECTOR_LEN(&builder.code, uint8_t));
-            wist_lir_expr_destroy(comp, lir);
+            WIST_VM_OBJ_FIELD2(clo) = WIST_VM_OBJ_MAKE_CODE(code);
             wist_vm_obj_print_clo(vm, clo);
 
             struct wist_handle *handle = wist_vm_add_handle(vm);
@@ -108,40 +183,177 @@ struct wist_handle *wist_compiler_vm_gen_decl(struct wist_compiler *comp,
 static void code_builder_init(struct wist_ctx *ctx, 
         struct code_builder *builder) {
     builder->ctx = ctx;
-    WIST_VECTOR_INIT(ctx, &builder->code, uint8_t);
+    WIST_VECTOR_INIT(ctx, &builder->code, uint32_t);
+    WIST_VECTOR_INIT(ctx, &builder->consts, int64_t);
+    WIST_VECTOR_INIT(ctx, &builder->const_refs, struct const_ref);
+    builder->last_op = SIZE_MAX;
+    builder->vm = NULL;
+    builder->failed = false;
 }
 
-static void code_builder_add_8(struct code_builder *builder, uint8_t byte) {
-    WIST_VECTOR_PUSH(builder->ctx, &builder->code, uint8_t, &byte);
+static void code_builder_add_word(struct code_builder *builder, 
+        uint32_t word) {
+    WIST_VECTOR_PUSH(builder->ctx, &builder->code, uint32_t, &word);
 }
 
-static void code_builder_add_16(struct code_builder *builder, uint16_t _u16) {
-    uint8_t *u16 = (uint8_t *) &_u16;
-    code_builder_add_8(builder, u16[0]);
-    code_builder_add_8(builder, u16[1]);
+/* 
+ * Adds an op with its operand, which is fused with the one before into a 
+ * superinstruction when vm_ops.h has one for them.  Returns where the 
+ * instruction it ended up in starts. 
+ */
+static size_t code_builder_add_op(struct code_builder *builder, uint8_t op, 
+        uint32_t arg) {
+    if (builder->last_op != SIZE_MAX) {
+        size_t start = builder->last_op;
+        uint32_t *last = WIST_VECTOR_INDEX(&builder->code, uint32_t, start);
+        uint8_t first = WIST_VM_INSN_OP(*last);
+        uint8_t fused = wist_vm_obj_fuse_ops(first, op);
+        if (fused != __WIST_VM_OP_COUNT) {
+            builder->last_op = SIZE_MAX;
+            if (wist_vm_obj_superop_packed(first, op)) {
+                arg = WIST_VM_INSN_ARG(*last) 
+                    | arg << wist_vm_obj_op_arg_bits(first);
+                *last = WIST_VM_INSN(fused, arg);
+            } else {
+                *last = WIST_VM_INSN(fused, WIST_VM_INSN_ARG(*last));
+                code_builder_add_word(builder, WIST_VM_INSN(op, arg));
+            }
+            return start;
+        }
+    }
+
+    builder->last_op = code_builder_count(builder);
+    code_builder_add_word(builder, WIST_VM_INSN(op, arg));
+    return builder->last_op;
 }
 
-static void code_builder_add_64(struct code_builder *builder, uint64_t _u64) {
-    uint8_t *u64 = (uint8_t *) &_u64;
-    code_builder_add_8(builder, u64[0]);
-    code_builder_add_8(builder, u64[1]);
-    code_builder_add_8(builder, u64[2]);
-    code_builder_add_8(builder, u64[3]);
-    code_builder_add_8(builder, u64[4]);
-    code_builder_add_8(builder, u64[5]);
-    code_builder_add_8(builder, u64[6]);
-    code_builder_add_8(builder, u64[7]);
+/* Adds an APPLY or APPTERM with its argument count, if it fits. */
+static void code_builder_add_arg_count(struct code_builder *builder, 
+        uint8_t op, size_t count) {
+    if (count > UINT8_MAX) {
+        printf("Cannot apply to %zu arguments\n", count);
+        builder->failed = true;
+        return;
+    }
+    code_builder_add_op(builder, op, count);
+}
+
+/* 
+ * Adds an INTI of [val] when it fits, and otherwise an INT64 of it, which 
+ * shares a constant in the pool with every other INT64 of the same value. 
+ * Fails if [val] does not fit in a value at all.
+ */
+static void code_builder_add_int(struct code_builder *builder, int64_t val) {
+    if (val < WIST_VM_OBJ_INT_MIN || val > WIST_VM_OBJ_INT_MAX) {
+        printf("Integer %" PRId64 " is too big for a value\n", val);
+        builder->failed = true;
+        return;
+    }
+    if (val >= WIST_VM_INSN_SARG_MIN && val <= WIST_VM_INSN_SARG_MAX) {
+        code_builder_add_op(builder, WIST_VM_OP_INTI, 
+                (uint32_t) val & WIST_VM_INSN_ARG_MAX);
+        return;
+    }
+
+    size_t idx = 0;
+    size_t count = WIST_VECTOR_LEN(&builder->consts, int64_t);
+    int64_t *consts = WIST_VECTOR_DATA(&builder->consts, int64_t);
+    while (idx < count && consts[idx] != val) {
+        idx++;
+    }
+    if (idx == count) {
+        WIST_VECTOR_PUSH(builder->ctx, &builder->consts, int64_t, &val);
+    }
+
+    struct const_ref ref;
+    ref.insn = code_builder_add_op(builder, WIST_VM_OP_INT64, idx);
+    ref.word = code_builder_count(builder) - 1;
+    WIST_VECTOR_PUSH(builder->ctx, &builder->const_refs, struct const_ref, 
+            &ref);
 }
 
 static size_t code_builder_count(struct code_builder *builder) {
-    return WIST_VECTOR_LEN(&builder->code, uint8_t);
+    return WIST_VECTOR_LEN(&builder->code, uint32_t);
 }
 
-static size_t code_builder_add_16_uninit(struct code_builder *builder) {
-    size_t idx = WIST_VECTOR_LEN(&builder->code, uint8_t);
-    code_builder_add_8(builder, 0);
-    code_builder_add_8(builder, 0);
-    return idx;
+/* Records sites for the heap profiler if it is on. */
+static void code_builder_profile(struct code_builder *builder, 
+        struct wist_compiler *comp, struct wist_vm *vm, const uint8_t *name, 
+        size_t name_len) {
+    if (!vm->prof.enabled) {
+        return;
+    }
+
+    builder->vm = vm;
+    builder->srclocs = &comp->srclocs;
+    builder->decl = wist_vm_prof_add_decl(vm, name, name_len);
+    builder->lambda = 0;
+    builder->first_site = WIST_VECTOR_LEN(&vm->prof.sites, 
+            struct wist_vm_prof_site);
+}
+
+/* Records the site of the op about to be added, which allocates for [expr]. */
+static size_t code_builder_add_site(struct code_builder *builder, 
+        enum wist_vm_prof_kind t, struct wist_lir_expr *expr) {
+    if (builder->vm == NULL) {
+        return 0;
+    }
+
+    return wist_vm_prof_add_site(builder->vm, builder->srclocs, t, 
+            code_builder_count(builder), builder->lambda, builder->decl, 
+            expr->loc);
+}
+
+/* 
+ * Adds the code to the end of the code area followed by its constant pool, 
+ * and its sites with it, then frees the builder.  Returns where the code 
+ * starts, or NULL if it failed to generate or there was no room for it. 
+ */
+static uint32_t *code_builder_place(struct code_builder *builder, 
+        struct wist_vm *vm) {
+    size_t len = code_builder_count(builder);
+    /* Code starts 8 byte aligned, so pad for the constants to be too. */
+    size_t pool = len + len % 2;
+
+    uint32_t *code = WIST_VECTOR_DATA(&builder->code, uint32_t);
+    WIST_VECTOR_FOR_EACH(&builder->const_refs, struct const_ref, ref) {
+        size_t idx = WIST_VM_INSN_ARG(code[ref->word]);
+        size_t dist = pool + 2 * idx - ref->insn;
+        if (dist > WIST_VM_INSN_ARG_MAX) {
+            printf("Constant %zu words away is too far for INT64\n", dist);
+            builder->failed = true;
+            break;
+        }
+        code[ref->word] = WIST_VM_INSN(WIST_VM_INSN_OP(code[ref->word]), 
+                dist);
+    }
+    while (code_builder_count(builder) < pool) {
+        code_builder_add_word(builder, 0);
+    }
+    WIST_VECTOR_PUSH_ARR(builder->ctx, &builder->code, uint32_t, 
+            WIST_VECTOR_DATA(&builder->consts, uint32_t), 
+            2 * WIST_VECTOR_LEN(&builder->consts, int64_t));
+    uint32_t *start = NULL;
+    if (!builder->failed) {
+        start = wist_vm_code_add(vm, 
+                WIST_VECTOR_DATA(&builder->code, uint32_t), 
+                code_builder_count(builder));
+    }
+
+    if (builder->vm != NULL && start != NULL) {
+        wist_vm_prof_place_sites(vm, builder->first_site, 
+                WIST_VM_CODE_OFFSET(vm, start));
+    } else if (builder->vm != NULL) {
+        /* Sites are kept sorted by where their code was placed. */
+        while (WIST_VECTOR_LEN(&vm->prof.sites, struct wist_vm_prof_site) 
+                > builder->first_site) {
+            WIST_VECTOR_POP(&vm->prof.sites, struct wist_vm_prof_site);
+        }
+    }
+    WIST_VECTOR_FINISH(builder->ctx, &builder->code);
+    WIST_VECTOR_FINISH(builder->ctx, &builder->consts);
+    WIST_VECTOR_FINISH(builder->ctx, &builder->const_refs);
+    return start;
 }
 
 static void gen_expr_tco_rec(struct code_builder *builder,
@@ -149,21 +361,28 @@ static void gen_expr_tco_rec(struct code_builder *builder,
     switch (expr->t) {
         case WIST_LIR_EXPR_APP:
             struct wist_lir_expr *fun = expr;
+            size_t arg_count = 0;
             while (fun->t == WIST_LIR_EXPR_APP) {
                 gen_expr_rec(builder, fun->app.arg);
-                code_builder_add_8(builder, WIST_VM_OP_PUSH);
+                code_builder_add_op(builder, WIST_VM_OP_PUSH, 0);
                 fun = fun->app.fun;
+                arg_count++;
             }
             gen_expr_rec(builder, fun);
-            code_builder_add_8(builder, WIST_VM_OP_APPTERM);
+            code_builder_add_arg_count(builder, WIST_VM_OP_APPTERM, arg_count);
             break;
-        case WIST_LIR_EXPR_LAM:
-            code_builder_add_8(builder, WIST_VM_OP_GRAB);
+        case WIST_LIR_EXPR_LAM: {
+            size_t lambda = builder->lambda;
+            builder->lambda = code_builder_add_site(builder, 
+                    WIST_VM_PROF_CLOSURE, expr);
+            code_builder_add_op(builder, WIST_VM_OP_GRABENV, 0);
             gen_expr_tco_rec(builder, expr->lam.body);
+            builder->lambda = lambda;
             break;
+        }
         case WIST_LIR_EXPR_LET: 
             gen_expr_rec(builder, expr->let.val);
-            code_builder_add_8(builder, WIST_VM_OP_LET); 
+            code_builder_add_op(builder, WIST_VM_OP_LET, 0); 
             gen_expr_tco_rec(builder, expr->let.body);
             break;
         default:
@@ -175,67 +394,150 @@ static void gen_expr_rec(struct code_builder *builder,
         struct wist_lir_expr *expr) {
     switch (expr->t) {
         case WIST_LIR_EXPR_INT: 
-            code_builder_add_8(builder, WIST_VM_OP_INT64); 
-            code_builder_add_64(builder, expr->i.val); 
+            code_builder_add_int(builder, expr->i.val); 
             break;
         case WIST_LIR_EXPR_LAM: {
-            code_builder_add_8(builder, WIST_VM_OP_CLOSURE);
-            size_t closure_size_idx = code_builder_add_16_uninit(builder);
+            size_t lambda = builder->lambda;
+            size_t capture_count = WIST_VECTOR_LEN(&expr->lam.captures, int);
+            if (capture_count > UINT8_MAX) {
+                printf("Closure captures too many variables (%zu)\n", 
+                        capture_count);
+                builder->failed = true;
+                return;
+            }
+            WIST_VECTOR_FOR_EACH(&expr->lam.captures, int, capture) {
+                if (*capture > UINT8_MAX) {
+                    printf("Captured slot %d is too deep for CLOSURE\n", 
+                            *capture);
+                    builder->failed = true;
+                    return;
+                }
+            }
+            size_t site = code_builder_add_site(builder, WIST_VM_PROF_CLOSURE, 
+                    expr);
+            size_t closure_idx = code_builder_add_op(builder, 
+                    WIST_VM_OP_CLOSURE, 0);
+            for (size_t i = 0; i < WIST_VM_CAPTURE_WORDS(capture_count); i++) {
+                code_builder_add_word(builder, 0);
+            }
+            uint8_t *captures = (uint8_t *) WIST_VECTOR_INDEX(&builder->code, 
+                    uint32_t, closure_idx + 1);
+            for (size_t i = 0; i < capture_count; i++) {
+                captures[i] = *WIST_VECTOR_INDEX(&expr->lam.captures, int, i);
+            }
             size_t op_count_before = code_builder_count(builder);
+            builder->lambda = site;
+
+            /* Directly nested lambdas take all their arguments in one GRAB. */
+            struct wist_lir_expr *body = expr->lam.body;
+            uint8_t grab_count = 0;
+            while (body->t == WIST_LIR_EXPR_LAM && grab_count < UINT8_MAX) {
+                grab_count++;
+                body = body->lam.body;
+            }
+            if (grab_count > 0) {
+                code_builder_add_site(builder, WIST_VM_PROF_PARTIAL, expr);
+                code_builder_add_op(builder, WIST_VM_OP_GRAB, grab_count);
+            }
 
-            gen_expr_tco_rec(builder, expr->lam.body);
+            gen_expr_tco_rec(builder, body);
 
-            code_builder_add_8(builder, WIST_VM_OP_RETURN);
+            code_builder_add_op(builder, WIST_VM_OP_RETURN, 0);
 
-            size_t op_count_after = code_builder_count(builder);
-            uint16_t *closure_pos = (uint16_t *)
-                WIST_VECTOR_INDEX(&builder->code, uint8_t, closure_size_idx);
-            uint16_t closure_sz = (uint16_t) (op_count_after - op_count_before);
-            *closure_pos = closure_sz;
+            size_t closure_sz = code_builder_count(builder) - op_count_before;
+            if (closure_sz > UINT16_MAX) {
+                printf("Closure of %zu words is too long for CLOSURE\n", 
+                        closure_sz);
+                builder->failed = true;
+            }
+            *WIST_VECTOR_INDEX(&builder->code, uint32_t, closure_idx) = 
+                WIST_VM_INSN_AB(WIST_VM_OP_CLOSURE, capture_count, closure_sz);
+            builder->lambda = lambda;
             break;
         }
         case WIST_LIR_EXPR_APP: {
-            code_builder_add_8(builder, WIST_VM_OP_PUSHMARK);
+            code_builder_add_op(builder, WIST_VM_OP_PUSHMARK, 0);
             struct wist_lir_expr *fun = expr;
+            size_t arg_count = 0;
             while (fun->t == WIST_LIR_EXPR_APP) {
                 gen_expr_rec(builder, fun->app.arg);
-                code_builder_add_8(builder, WIST_VM_OP_PUSH);
+                code_builder_add_op(builder, WIST_VM_OP_PUSH, 0);
                 fun = fun->app.fun;
+                arg_count++;
             }
             gen_expr_rec(builder, fun);
-            code_builder_add_8(builder, WIST_VM_OP_APPLY);
+            code_builder_add_arg_count(builder, WIST_VM_OP_APPLY, arg_count);
             break;
         }
         case WIST_LIR_EXPR_VAR: {
-            code_builder_add_8(builder, WIST_VM_OP_ACCESS);
-            code_builder_add_8(builder, expr->var.index);
+            if (expr->var.index > UINT8_MAX) {
+                printf("Variable slot %d is too deep for ACCESS\n", 
+                        expr->var.index);
+                builder->failed = true;
+                return;
+            }
+            code_builder_add_op(builder, WIST_VM_OP_ACCESS, expr->var.index);
             break;
         }
         case WIST_LIR_EXPR_GVAR: {
-            code_builder_add_8(builder, WIST_VM_OP_GETGLOBAL);
-            code_builder_add_64(builder, (uint64_t) expr->gvar.sym);
+            if (expr->gvar.slot > WIST_VM_INSN_ARG_MAX) {
+                printf("Global slot %" PRIu32 " is too big for GETGLOBAL\n", 
+                        expr->gvar.slot);
+                builder->failed = true;
+                return;
+            }
+            code_builder_add_op(builder, WIST_VM_OP_GETGLOBAL, 
+                    expr->gvar.slot);
             break;
         }
         case WIST_LIR_EXPR_MKB: {
             WIST_VECTOR_FOR_EACH(&expr->mkb.fields, struct wist_lir_expr *, field) {
                 gen_expr_rec(builder, *field);
-                code_builder_add_8(builder, WIST_VM_OP_PUSH);
+                code_builder_add_op(builder, WIST_VM_OP_PUSH, 0);
             }
-            code_builder_add_8(builder, WIST_VM_OP_MKB);
-            code_builder_add_16(builder, 
+            code_builder_add_site(builder, WIST_VM_PROF_TUPLE, expr);
+            code_builder_add_op(builder, WIST_VM_OP_MKB, 
                     WIST_VECTOR_LEN(&expr->mkb.fields, struct wist_lir_expr *));
             break;
         }
         case WIST_LIR_EXPR_LET: 
             gen_expr_rec(builder, expr->let.val);
-            code_builder_add_8(builder, WIST_VM_OP_LET); 
+            code_builder_add_op(builder, WIST_VM_OP_LET, 0); 
             
             gen_expr_rec(builder, expr->let.body);
-            code_builder_add_8(builder, WIST_VM_OP_ENDLET); 
+            code_builder_add_op(builder, WIST_VM_OP_ENDLET, 0); 
 
+            break;
+        case WIST_LIR_EXPR_PRIM:
+            gen_prim(builder, expr);
             break;
         default: 
             printf("Cannot generate vm code for expression %d\n", expr->t);
+            builder->failed = true;
             return;
     }
 }
+
+/* 
+ * Uses an immediate form when either operand is a constant that fits in an 
+ * operand, and otherwise evaluates the right operand onto the argument stack 
+ * and the left into the accumulator.
+ */
+static void gen_prim(struct code_builder *builder, struct wist_lir_expr *expr) {
+    enum wist_lir_prim_kind imm_t;
+    struct wist_lir_expr *operand;
+    int32_t imm;
+
+    if (wist_lir_prim_imm_form(expr, &imm_t, &operand, &imm)
+            && imm >= WIST_VM_INSN_SARG_MIN && imm <= WIST_VM_INSN_SARG_MAX) {
+        gen_expr_rec(builder, operand);
+        code_builder_add_op(builder, prim_to_imm_op[imm_t], 
+                (uint32_t) imm & WIST_VM_INSN_ARG_MAX);
+        return;
+    }
+
+    gen_expr_rec(builder, expr->prim.rhs);
+    code_builder_add_op(builder, WIST_VM_OP_PUSH, 0);
+    gen_expr_rec(builder, expr->prim.lhs);
+    code_builder_add_op(builder, prim_to_op[expr->prim.t], 0);
+}
@@ -0,0 +1,800 @@
+/* === lib/vm_jit.c - Baseline JIT for the stack VM ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+/* For mmap and getpid under -std=c99. */
+#define _DEFAULT_SOURCE
+
+#include <wist/vm_jit.h>
+#include <wist/vm.h>
+#include <wist/ctx.h>
+#include <wist/defs.h>
+#include <wist/toplevel.h>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef WIST_VM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Native code keeps the interpreter registers in callee saved machine
+ * registers: the state in rbx, the argument stack pointer in r12, the return
+ * stack pointer in r13, the accumulator in r14 and the environment in r15.
+ * rax, rcx, rdx, rsi and rdi are scratch.
+ *
+ * Every closure is entered with exactly one local, so the number of locals
+ * at each instruction is known while compiling and ACCESS becomes a single
+ * load.  Anything that might need the stacks to grow or an error to be
+ * raised leaves to the interpreter at that instruction instead.
+ */
+enum x64_reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum x64_cond {
+    COND_B = 0x2,
+    COND_AE = 0x3,
+    COND_E = 0x4,
+    COND_NE = 0x5,
+    COND_BE = 0x6,
+    COND_L = 0xc,
+    COND_GE = 0xd,
+    COND_LE = 0xe,
+    COND_G = 0xf,
+};
+
+/* The one byte opcodes of the two operand ALU instructions, r/m <- r. */
+enum x64_alu {
+    ALU_ADD = 0x01,
+    ALU_SUB = 0x29,
+    ALU_CMP = 0x39,
+};
+
+/* The /digit of the same instructions with a 32 bit immediate. */
+enum x64_alu_imm {
+    ALU_IMM_ADD = 0,
+    ALU_IMM_SUB = 5,
+    ALU_IMM_CMP = 7,
+};
+
+#define STATE_OFF(_field) ((int32_t) offsetof(struct wist_vm_jit_state, _field))
+#define FRAME_SIZE ((int32_t) sizeof(struct wist_vm_ret_frame))
+#define FRAME_ENV_OFF ((int32_t) offsetof(struct wist_vm_ret_frame, env))
+#define FIELDS_OFF ((int32_t) offsetof(struct wist_vm_gc_hdr, fields))
+#define OBJ_SIZE ((int32_t) sizeof(struct wist_vm_obj))
+
+struct jit_builder {
+    struct wist_ctx *ctx;
+    struct wist_vector code; /* uint8_t */
+};
+
+/* === PROTOTYPES === */
+
+static void emit_8(struct jit_builder *b, uint8_t byte);
+static void emit_32(struct jit_builder *b, uint32_t u32);
+static void emit_64(struct jit_builder *b, uint64_t u64);
+static void emit_rex_w(struct jit_builder *b, int reg, int rm);
+static void emit_mem(struct jit_builder *b, int reg, int base, int32_t disp);
+static void emit_load(struct jit_builder *b, int dst, int base, int32_t disp);
+static void emit_store(struct jit_builder *b, int base, int32_t disp, int src);
+static void emit_lea(struct jit_builder *b, int dst, int base, int32_t disp);
+static void emit_mov_imm(struct jit_builder *b, int dst, uint64_t imm);
+static void emit_mov(struct jit_builder *b, int dst, int src);
+static void emit_alu(struct jit_builder *b, enum x64_alu op, int dst, int src);
+static void emit_alu_imm(struct jit_builder *b, enum x64_alu_imm op, int dst,
+        int32_t imm);
+static void emit_cmp_mem(struct jit_builder *b, int reg, int base,
+        int32_t disp);
+static void emit_sar_1(struct jit_builder *b, int reg);
+static void emit_tag(struct jit_builder *b, int dst, int src);
+static void emit_call(struct jit_builder *b, void *fn);
+static size_t emit_jcc(struct jit_builder *b, enum x64_cond cond);
+static void patch_jump(struct jit_builder *b, size_t at);
+
+static void emit_prologue(struct jit_builder *b);
+static void emit_exit(struct jit_builder *b, size_t offset,
+        uint32_t extra_args);
+static void emit_exit_unless(struct jit_builder *b, enum x64_cond cond,
+        size_t offset, uint32_t extra_args);
+
+static bool compile(struct wist_vm *vm, size_t offset,
+        struct jit_builder *b);
+static wist_vm_jit_fn install(struct wist_vm *vm, struct jit_builder *b,
+        size_t offset);
+static void abandon_chunk(struct wist_vm *vm, struct wist_vm_jit_chunk *chunk);
+
+static struct wist_vm_jit_entry *find_entry(struct wist_vm *vm,
+        size_t offset);
+static bool grow_entries(struct wist_vm *vm);
+
+static struct wist_vm_obj jit_closure(struct wist_vm_jit_state *state,
+        size_t offset, uint32_t extra_args);
+static struct wist_vm_obj jit_mkb(struct wist_vm_jit_state *state,
+        size_t field_count);
+static void jit_setglobal(struct wist_vm_jit_state *state, uint32_t slot,
+        struct wist_vm_obj value);
+
+/* === PUBLICS === */
+
+void wist_vm_jit_init(struct wist_vm *vm) {
+    vm->jit.enabled = false;
+    vm->jit.entries = NULL;
+    vm->jit.entries_len = vm->jit.entries_used = 0;
+    vm->jit.chunks = NULL;
+    vm->jit.perf_map = NULL;
+}
+
+void wist_vm_jit_finish(struct wist_vm *vm) {
+    struct wist_vm_jit_chunk *chunk = vm->jit.chunks, *next;
+    while (chunk != NULL) {
+        next = chunk->next;
+        munmap(chunk->mem, WIST_VM_JIT_CHUNK_SIZE);
+        WIST_CTX_FREE(vm->ctx, chunk, struct wist_vm_jit_chunk);
+        chunk = next;
+    }
+    if (vm->jit.perf_map != NULL) {
+        fclose(vm->jit.perf_map);
+    }
+    if (vm->jit.entries != NULL) {
+        WIST_CTX_FREE_ARR(vm->ctx, vm->jit.entries, struct wist_vm_jit_entry,
+                vm->jit.entries_len);
+    }
+}
+
+bool wist_vm_set_jit(struct wist_vm *vm, bool enabled) {
+    vm->jit.enabled = enabled;
+    return enabled;
+}
+
+wist_vm_jit_fn wist_vm_jit_enter(struct wist_vm *vm, size_t offset) {
+    struct wist_vm_jit_entry *entry = find_entry(vm, offset);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (entry->fn != NULL || entry->rejected
+            || ++entry->count < WIST_VM_JIT_HOT_COUNT) {
+        return entry->fn;
+    }
+
+    struct jit_builder b;
+    b.ctx = vm->ctx;
+    WIST_VECTOR_INIT(vm->ctx, &b.code, uint8_t);
+    if (compile(vm, offset, &b)) {
+        entry->fn = install(vm, &b, offset);
+    }
+    entry->rejected = entry->fn == NULL;
+    WIST_VECTOR_FINISH(vm->ctx, &b.code);
+    return entry->fn;
+}
+
+/* === PRIVATES === */
+
+static void emit_8(struct jit_builder *b, uint8_t byte) {
+    WIST_VECTOR_PUSH(b->ctx, &b->code, uint8_t, &byte);
+}
+
+static void emit_32(struct jit_builder *b, uint32_t u32) {
+    WIST_VECTOR_PUSH_ARR(b->ctx, &b->code, uint8_t, (uint8_t *) &u32, 4);
+}
+
+static void emit_64(struct jit_builder *b, uint64_t u64) {
+    WIST_VECTOR_PUSH_ARR(b->ctx, &b->code, uint8_t, (uint8_t *) &u64, 8);
+}
+
+static void emit_rex_w(struct jit_builder *b, int reg, int rm) {
+    emit_8(b, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+/* A [base + disp32] operand, which needs a SIB byte for rsp and r12. */
+static void emit_mem(struct jit_builder *b, int reg, int base, int32_t disp) {
+    emit_8(b, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        emit_8(b, 0x24);
+    }
+    emit_32(b, (uint32_t) disp);
+}
+
+static void emit_load(struct jit_builder *b, int dst, int base, int32_t disp) {
+    emit_rex_w(b, dst, base);
+    emit_8(b, 0x8b);
+    emit_mem(b, dst, base, disp);
+}
+
+static void emit_store(struct jit_builder *b, int base, int32_t disp, int src) {
+    emit_rex_w(b, src, base);
+    emit_8(b, 0x89);
+    emit_mem(b, src, base, disp);
+}
+
+static void emit_lea(struct jit_builder *b, int dst, int base, int32_t disp) {
+    emit_rex_w(b, dst, base);
+    emit_8(b, 0x8d);
+    emit_mem(b, dst, base, disp);
+}
+
+static void emit_mov_imm(struct jit_builder *b, int dst, uint64_t imm) {
+    emit_rex_w(b, 0, dst);
+    emit_8(b, 0xb8 + (dst & 7));
+    emit_64(b, imm);
+}
+
+static void emit_mov(struct jit_builder *b, int dst, int src) {
+    emit_alu(b, 0x89, dst, src);
+}
+
+static void emit_alu(struct jit_builder *b, enum x64_alu op, int dst, int src) {
+    emit_rex_w(b, src, dst);
+    emit_8(b, op);
+    emit_8(b, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void emit_alu_imm(struct jit_builder *b, enum x64_alu_imm op, int dst,
+        int32_t imm) {
+    emit_rex_w(b, 0, dst);
+    emit_8(b, 0x81);
+    emit_8(b, 0xc0 | (op << 3) | (dst & 7));
+    emit_32(b, (uint32_t) imm);
+}
+
+static void emit_cmp_mem(struct jit_builder *b, int reg, int base,
+        int32_t disp) {
+    emit_rex_w(b, reg, base);
+    emit_8(b, 0x3b);
+    emit_mem(b, reg, base, disp);
+}
+
+static void emit_sar_1(struct jit_builder *b, int reg) {
+    emit_rex_w(b, 0, reg);
+    emit_8(b, 0xd1);
+    emit_8(b, 0xf8 | (reg & 7));
+}
+
+/* lea dst, [src + src + 1], which turns an integer into its value. */
+static void emit_tag(struct jit_builder *b, int dst, int src) {
+    emit_8(b, 0x48 | ((dst >> 3) << 2) | ((src >> 3) << 1) | (src >> 3));
+    emit_8(b, 0x8d);
+    emit_8(b, 0x44 | ((dst & 7) << 3));
+    emit_8(b, ((src & 7) << 3) | (src & 7));
+    emit_8(b, 1);
+}
+
+static void emit_call(struct jit_builder *b, void *fn) {
+    emit_mov_imm(b, RAX, (uint64_t) (uintptr_t) fn);
+    emit_8(b, 0xff);
+    emit_8(b, 0xd0);
+}
+
+/* Emits a conditional jump to be patched, and returns where to patch it. */
+static size_t emit_jcc(struct jit_builder *b, enum x64_cond cond) {
+    emit_8(b, 0x0f);
+    emit_8(b, 0x80 | cond);
+    size_t at = WIST_VECTOR_LEN(&b->code, uint8_t);
+    emit_32(b, 0);
+    return at;
+}
+
+/* Points the jump at [at] to the current end of the code. */
+static void patch_jump(struct jit_builder *b, size_t at) {
+    int32_t rel = (int32_t) (WIST_VECTOR_LEN(&b->code, uint8_t) - (at + 4));
+    memcpy(WIST_VECTOR_INDEX(&b->code, uint8_t, at), &rel, 4);
+}
+
+static void emit_prologue(struct jit_builder *b) {
+    emit_8(b, 0x53); /* push rbx */
+    emit_8(b, 0x55); /* push rbp */
+    emit_8(b, 0x41); emit_8(b, 0x54); /* push r12 */
+    emit_8(b, 0x41); emit_8(b, 0x55); /* push r13 */
+    emit_8(b, 0x41); emit_8(b, 0x56); /* push r14 */
+    emit_8(b, 0x41); emit_8(b, 0x57); /* push r15 */
+    /* Realign the stack for calls to C. */
+    emit_alu_imm(b, ALU_IMM_SUB, RSP, 8);
+    emit_mov(b, RBX, RDI);
+    emit_load(b, R12, RBX, STATE_OFF(asp));
+    emit_load(b, R13, RBX, STATE_OFF(rsp));
+    emit_load(b, R14, RBX, STATE_OFF(accum));
+    emit_load(b, R15, RBX, STATE_OFF(env));
+}
+
+/* Hands the instruction at [offset] back to the interpreter. */
+static void emit_exit(struct jit_builder *b, size_t offset,
+        uint32_t extra_args) {
+    emit_store(b, RBX, STATE_OFF(asp), R12);
+    emit_store(b, RBX, STATE_OFF(rsp), R13);
+    emit_store(b, RBX, STATE_OFF(accum), R14);
+    /* mov dword [rbx + extra_args], imm32 */
+    emit_8(b, 0xc7);
+    emit_mem(b, 0, RBX, STATE_OFF(extra_args));
+    emit_32(b, extra_args);
+    /* mov eax, imm32 */
+    emit_8(b, 0xb8);
+    emit_32(b, (uint32_t) offset);
+    emit_alu_imm(b, ALU_IMM_ADD, RSP, 8);
+    emit_8(b, 0x41); emit_8(b, 0x5f); /* pop r15 */
+    emit_8(b, 0x41); emit_8(b, 0x5e); /* pop r14 */
+    emit_8(b, 0x41); emit_8(b, 0x5d); /* pop r13 */
+    emit_8(b, 0x41); emit_8(b, 0x5c); /* pop r12 */
+    emit_8(b, 0x5d); /* pop rbp */
+    emit_8(b, 0x5b); /* pop rbx */
+    emit_8(b, 0xc3); /* ret */
+}
+
+/* Exits unless the flags satisfy [cond]. */
+static void emit_exit_unless(struct jit_builder *b, enum x64_cond cond,
+        size_t offset, uint32_t extra_args) {
+    size_t skip = emit_jcc(b, cond);
+    emit_exit(b, offset, extra_args);
+    patch_jump(b, skip);
+}
+
+/*
+ * Compiles the closure code at [offset] into [b].  Returns false if it would
+ * leave to the interpreter straight away.
+ */
+static bool compile(struct wist_vm *vm, size_t offset,
+        struct jit_builder *b) {
+    /* A closure's code is all in one place, even if the area is not. */
+    uint32_t *code = WIST_VM_CODE_AT(vm, offset);
+    uint32_t *pc = code;
+    uint32_t extra_args = 1;
+    bool any = false;
+    /* 
+     * The word of the second op of a superinstruction, which is compiled 
+     * next with the offset of the first, since the interpreter cannot start 
+     * in between. 
+     */
+    uint32_t second = 0;
+    bool has_second = false;
+    size_t op_offset = 0;
+
+    emit_prologue(b);
+
+    while (1) {
+        uint32_t insn;
+        if (has_second) {
+            insn = second;
+            has_second = false;
+        } else {
+            op_offset = offset + (pc - code);
+            insn = *pc++;
+            has_second = wist_vm_obj_split_insn(insn, &pc, &insn, &second);
+        }
+        uint8_t op = WIST_VM_INSN_OP(insn);
+        uint32_t arg = WIST_VM_INSN_ARG(insn);
+
+        switch (op) {
+            case WIST_VM_OP_INT64: {
+                int64_t *val = (int64_t *) (code + (op_offset - offset) + arg);
+                emit_mov_imm(b, R14, WIST_VM_OBJ_MAKE_INT(*val).bits);
+                break;
+            }
+            case WIST_VM_OP_INTI:
+                emit_mov_imm(b, R14, 
+                        WIST_VM_OBJ_MAKE_INT(WIST_VM_INSN_SARG(insn)).bits);
+                break;
+            case WIST_VM_OP_ACCESS: {
+                uint8_t idx = (uint8_t) arg;
+                if (idx < extra_args) {
+                    emit_load(b, R14, R13,
+                            -(1 + idx) * FRAME_SIZE + FRAME_ENV_OFF);
+                } else {
+                    emit_load(b, R14, R15,
+                            FIELDS_OFF + (idx - extra_args) * OBJ_SIZE);
+                }
+                break;
+            }
+            case WIST_VM_OP_PUSH:
+            case WIST_VM_OP_PUSHMARK:
+                emit_cmp_mem(b, R12, RBX, STATE_OFF(arg_end));
+                emit_exit_unless(b, COND_B, op_offset, extra_args);
+                if (op == WIST_VM_OP_PUSH) {
+                    emit_store(b, R12, 0, R14);
+                } else {
+                    emit_mov_imm(b, RAX, WIST_VM_OBJ_MAKE_MARK().bits);
+                    emit_store(b, R12, 0, RAX);
+                }
+                emit_alu_imm(b, ALU_IMM_ADD, R12, OBJ_SIZE);
+                break;
+            case WIST_VM_OP_LET:
+                emit_cmp_mem(b, R13, RBX, STATE_OFF(ret_end));
+                emit_exit_unless(b, COND_B, op_offset, extra_args);
+                emit_store(b, R13, FRAME_ENV_OFF, R14);
+                emit_alu_imm(b, ALU_IMM_ADD, R13, FRAME_SIZE);
+                extra_args++;
+                break;
+            case WIST_VM_OP_ENDLET:
+                emit_alu_imm(b, ALU_IMM_SUB, R13, FRAME_SIZE);
+                extra_args--;
+                break;
+            case WIST_VM_OP_GRAB: {
+                /* Building a partial application is left to the interpreter. */
+                uint8_t count = (uint8_t) arg;
+                emit_mov_imm(b, RCX, WIST_VM_OBJ_MAKE_MARK().bits);
+                for (uint8_t i = 0; i < count; i++) {
+                    emit_load(b, RAX, R12, -(1 + i) * OBJ_SIZE);
+                    emit_alu(b, ALU_CMP, RAX, RCX);
+                    emit_exit_unless(b, COND_NE, op_offset, extra_args);
+                }
+                emit_lea(b, RAX, R13, count * FRAME_SIZE);
+                emit_cmp_mem(b, RAX, RBX, STATE_OFF(ret_end));
+                emit_exit_unless(b, COND_BE, op_offset, extra_args);
+                for (uint8_t i = 0; i < count; i++) {
+                    emit_load(b, RAX, R12, -(1 + i) * OBJ_SIZE);
+                    emit_store(b, R13, i * FRAME_SIZE + FRAME_ENV_OFF, RAX);
+                }
+                emit_alu_imm(b, ALU_IMM_SUB, R12, count * OBJ_SIZE);
+                emit_alu_imm(b, ALU_IMM_ADD, R13, count * FRAME_SIZE);
+                extra_args += count;
+                break;
+            }
+            case WIST_VM_OP_GRABENV:
+                /* Capturing the frame is left to the interpreter. */
+                emit_load(b, RAX, R12, -OBJ_SIZE);
+                emit_mov_imm(b, RCX, WIST_VM_OBJ_MAKE_MARK().bits);
+                emit_alu(b, ALU_CMP, RAX, RCX);
+                emit_exit_unless(b, COND_NE, op_offset, extra_args);
+                emit_cmp_mem(b, R13, RBX, STATE_OFF(ret_end));
+                emit_exit_unless(b, COND_B, op_offset, extra_args);
+                emit_alu_imm(b, ALU_IMM_SUB, R12, OBJ_SIZE);
+                emit_store(b, R13, FRAME_ENV_OFF, RAX);
+                emit_alu_imm(b, ALU_IMM_ADD, R13, FRAME_SIZE);
+                extra_args++;
+                break;
+            case WIST_VM_OP_GETGLOBAL:
+                /* The slots can move when globals are added, so load them. */
+                emit_mov_imm(b, RAX, (uint64_t) (uintptr_t)
+                        &vm->toplvl->slots.data);
+                emit_load(b, RAX, RAX, 0);
+                emit_load(b, R14, RAX, arg * OBJ_SIZE);
+                break;
+            case WIST_VM_OP_SETGLOBAL:
+                emit_mov(b, RDI, RBX);
+                emit_mov_imm(b, RSI, arg);
+                emit_mov(b, RDX, R14);
+                emit_call(b, (void *) jit_setglobal);
+                break;
+            case WIST_VM_OP_CLOSURE: {
+                pc += WIST_VM_CAPTURE_WORDS(WIST_VM_INSN_A(insn)) 
+                    + WIST_VM_INSN_B(insn);
+                emit_store(b, RBX, STATE_OFF(rsp), R13);
+                emit_mov(b, RDI, RBX);
+                emit_mov_imm(b, RSI, op_offset);
+                emit_mov_imm(b, RDX, extra_args);
+                emit_call(b, (void *) jit_closure);
+                emit_mov(b, R14, RAX);
+                break;
+            }
+            case WIST_VM_OP_MKB:
+                emit_store(b, RBX, STATE_OFF(asp), R12);
+                emit_mov(b, RDI, RBX);
+                emit_mov_imm(b, RSI, arg);
+                emit_call(b, (void *) jit_mkb);
+                emit_mov(b, R14, RAX);
+                emit_load(b, R12, RBX, STATE_OFF(asp));
+                break;
+            case WIST_VM_OP_ADD:
+            case WIST_VM_OP_SUB:
+            case WIST_VM_OP_MUL:
+            case WIST_VM_OP_DIV:
+            case WIST_VM_OP_REM:
+            case WIST_VM_OP_LT:
+            case WIST_VM_OP_LE:
+            case WIST_VM_OP_GT:
+            case WIST_VM_OP_GE:
+            case WIST_VM_OP_EQ:
+            case WIST_VM_OP_NE:
+                emit_load(b, RCX, R12, -OBJ_SIZE);
+                if (op == WIST_VM_OP_DIV || op == WIST_VM_OP_REM) {
+                    /* Zero and -1 divisors take the interpreter's paths. */
+                    emit_sar_1(b, RCX);
+                    emit_alu_imm(b, ALU_IMM_CMP, RCX, 0);
+                    emit_exit_unless(b, COND_NE, op_offset, extra_args);
+                    emit_alu_imm(b, ALU_IMM_CMP, RCX, -1);
+                    emit_exit_unless(b, COND_NE, op_offset, extra_args);
+                }
+                emit_alu_imm(b, ALU_IMM_SUB, R12, OBJ_SIZE);
+                /* Falls through to the code shared with the immediate forms. */
+                goto int_op;
+            case WIST_VM_OP_ADDI:
+            case WIST_VM_OP_LTI:
+            case WIST_VM_OP_LEI:
+            case WIST_VM_OP_GTI:
+            case WIST_VM_OP_GEI:
+            case WIST_VM_OP_EQI:
+            case WIST_VM_OP_NEI: {
+                int64_t imm = WIST_VM_INSN_SARG(insn);
+                emit_mov_imm(b, RCX, WIST_VM_OBJ_MAKE_INT(imm).bits);
+int_op:
+                /* rcx holds the right operand, still tagged except for division. */
+                switch (op) {
+                    case WIST_VM_OP_ADD:
+                    case WIST_VM_OP_ADDI:
+                        emit_alu(b, ALU_ADD, R14, RCX);
+                        emit_alu_imm(b, ALU_IMM_SUB, R14, 1);
+                        break;
+                    case WIST_VM_OP_SUB:
+                        emit_alu(b, ALU_SUB, R14, RCX);
+                        emit_alu_imm(b, ALU_IMM_ADD, R14, 1);
+                        break;
+                    case WIST_VM_OP_MUL:
+                        emit_mov(b, RAX, R14);
+                        emit_alu_imm(b, ALU_IMM_SUB, RAX, 1);
+                        emit_sar_1(b, RCX);
+                        /* imul rax, rcx */
+                        emit_8(b, 0x48); emit_8(b, 0x0f); emit_8(b, 0xaf);
+                        emit_8(b, 0xc1);
+                        emit_alu_imm(b, ALU_IMM_ADD, RAX, 1);
+                        emit_mov(b, R14, RAX);
+                        break;
+                    case WIST_VM_OP_DIV:
+                    case WIST_VM_OP_REM:
+                        emit_mov(b, RAX, R14);
+                        emit_sar_1(b, RAX);
+                        emit_8(b, 0x48); emit_8(b, 0x99); /* cqo */
+                        emit_8(b, 0x48); emit_8(b, 0xf7); /* idiv rcx */
+                        emit_8(b, 0xf9);
+                        emit_tag(b, R14, op == WIST_VM_OP_DIV ? RAX : RDX);
+                        break;
+                    default: {
+                        enum x64_cond cond;
+                        switch (op) {
+                            case WIST_VM_OP_LT: case WIST_VM_OP_LTI:
+                                cond = COND_L;
+                                break;
+                            case WIST_VM_OP_LE: case WIST_VM_OP_LEI:
+                                cond = COND_LE;
+                                break;
+                            case WIST_VM_OP_GT: case WIST_VM_OP_GTI:
+                                cond = COND_G;
+                                break;
+                            case WIST_VM_OP_GE: case WIST_VM_OP_GEI:
+                                cond = COND_GE;
+                                break;
+                            case WIST_VM_OP_EQ: case WIST_VM_OP_EQI:
+                                cond = COND_E;
+                                break;
+                            default:
+                                cond = COND_NE;
+                                break;
+                        }
+                        /* Tagging keeps the order, so compare as they are. */
+                        emit_alu(b, ALU_CMP, R14, RCX);
+                        emit_8(b, 0x0f); emit_8(b, 0x90 | cond); /* setcc al */
+                        emit_8(b, 0xc0);
+                        emit_8(b, 0x0f); emit_8(b, 0xb6); /* movzx eax, al */
+                        emit_8(b, 0xc0);
+                        emit_tag(b, R14, RAX);
+                        break;
+                    }
+                }
+                break;
+            }
+            default:
+                /* 
+                 * The calls, in every quickened form, and RETURN, RESTART and 
+                 * REGENTER. 
+                 */
+                emit_exit(b, op_offset, extra_args);
+                return any;
+        }
+        any = true;
+    }
+}
+
+/* Copies [b] into executable memory and returns its entry point. */
+static wist_vm_jit_fn install(struct wist_vm *vm, struct jit_builder *b,
+        size_t offset) {
+    size_t len = WIST_VECTOR_LEN(&b->code, uint8_t);
+    if (len > WIST_VM_JIT_CHUNK_SIZE) {
+        return NULL;
+    }
+
+    struct wist_vm_jit_chunk *chunk = vm->jit.chunks;
+    if (chunk == NULL || chunk->used + len > WIST_VM_JIT_CHUNK_SIZE) {
+        void *mem = mmap(NULL, WIST_VM_JIT_CHUNK_SIZE, PROT_READ | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            printf("Failed to map memory for JIT code\n");
+            return NULL;
+        }
+        chunk = WIST_CTX_NEW(vm->ctx, struct wist_vm_jit_chunk);
+        chunk->mem = mem;
+        chunk->used = 0;
+        chunk->next = vm->jit.chunks;
+        vm->jit.chunks = chunk;
+    }
+
+    /* Pages are never writable and executable at the same time. */
+    if (mprotect(chunk->mem, WIST_VM_JIT_CHUNK_SIZE,
+                PROT_READ | PROT_WRITE) != 0) {
+        abandon_chunk(vm, chunk);
+        return NULL;
+    }
+    uint8_t *start = chunk->mem + chunk->used;
+    memcpy(start, WIST_VECTOR_DATA(&b->code, uint8_t), len);
+    /* Keep entry points 16 byte aligned. */
+    chunk->used += (len + 15) & ~(size_t) 15;
+    if (mprotect(chunk->mem, WIST_VM_JIT_CHUNK_SIZE,
+                PROT_READ | PROT_EXEC) != 0) {
+        abandon_chunk(vm, chunk);
+        return NULL;
+    }
+
+    if (vm->jit.perf_map == NULL) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+        vm->jit.perf_map = fopen(path, "a");
+    }
+    if (vm->jit.perf_map != NULL) {
+        fprintf(vm->jit.perf_map, "%lx %zx wist_closure_%zu\n",
+                (unsigned long) (uintptr_t) start, len, offset);
+        fflush(vm->jit.perf_map);
+    }
+
+    wist_vm_jit_fn fn;
+    void *start_ptr = start;
+    memcpy(&fn, &start_ptr, sizeof(fn));
+    return fn;
+}
+
+/*
+ * Forgets all native code in [chunk], which may no longer be executable, and
+ * turns the JIT off so nothing new is put there either.
+ */
+static void abandon_chunk(struct wist_vm *vm, struct wist_vm_jit_chunk *chunk) {
+    printf("Failed to protect JIT code, turning the JIT off\n");
+    vm->jit.enabled = false;
+
+    uintptr_t start = (uintptr_t) chunk->mem;
+    for (size_t i = 0; i < vm->jit.entries_len; i++) {
+        struct wist_vm_jit_entry *entry = &vm->jit.entries[i];
+        uintptr_t fn;
+        memcpy(&fn, &entry->fn, sizeof(fn));
+        if (entry->fn != NULL && fn >= start
+                && fn < start + WIST_VM_JIT_CHUNK_SIZE) {
+            entry->fn = NULL;
+            entry->count = 0;
+        }
+    }
+}
+
+/*
+ * Returns the entry for the closure at [offset], adding a fresh one if it
+ * has none, or NULL if there is no memory for it.
+ */
+static struct wist_vm_jit_entry *find_entry(struct wist_vm *vm,
+        size_t offset) {
+    if ((vm->jit.entries_used + 1) * 2 > vm->jit.entries_len
+            && !grow_entries(vm)) {
+        return NULL;
+    }
+
+    /* Closure offsets are spread out, so their low bits hash well enough. */
+    size_t mask = vm->jit.entries_len - 1;
+    size_t i = offset & mask;
+    struct wist_vm_jit_entry *entry = &vm->jit.entries[i];
+    while (entry->offset != offset) {
+        if (entry->offset == SIZE_MAX) {
+            entry->offset = offset;
+            vm->jit.entries_used++;
+            break;
+        }
+        i = (i + 1) & mask;
+        entry = &vm->jit.entries[i];
+    }
+    return entry;
+}
+
+/* Doubles the table of entries, putting every entry back in its place. */
+static bool grow_entries(struct wist_vm *vm) {
+    size_t old_len = vm->jit.entries_len;
+    size_t new_len = old_len > 0 ? old_len * 2 : WIST_VM_JIT_ENTRIES_LEN;
+    struct wist_vm_jit_entry *old = vm->jit.entries;
+    struct wist_vm_jit_entry *new = WIST_CTX_NEW_ARR(vm->ctx,
+            struct wist_vm_jit_entry, new_len);
+    if (new == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < new_len; i++) {
+        new[i] = (struct wist_vm_jit_entry) { SIZE_MAX, NULL, 0, false };
+    }
+
+    size_t mask = new_len - 1;
+    for (size_t i = 0; i < old_len; i++) {
+        if (old[i].offset == SIZE_MAX) {
+            continue;
+        }
+        size_t j = old[i].offset & mask;
+        while (new[j].offset != SIZE_MAX) {
+            j = (j + 1) & mask;
+        }
+        new[j] = old[i];
+    }
+
+    if (old != NULL) {
+        WIST_CTX_FREE_ARR(vm->ctx, old, struct wist_vm_jit_entry, old_len);
+    }
+    vm->jit.entries = new;
+    vm->jit.entries_len = new_len;
+    return true;
+}
+
+/* Does what the interpreter's CLOSURE does at [offset]. */
+static struct wist_vm_obj jit_closure(struct wist_vm_jit_state *state,
+        size_t offset, uint32_t extra_args) {
+    struct wist_vm *vm = state->vm;
+    uint32_t *pc = WIST_VM_CODE_AT(vm, offset);
+    uint8_t capture_count = WIST_VM_INSN_A(*pc++);
+    uint8_t *captures = (uint8_t *) pc;
+    pc += WIST_VM_CAPTURE_WORDS(capture_count);
+
+    struct wist_vm_obj clo_env = WIST_VM_GC_ALLOC(&vm->gc, capture_count,
+            WIST_VM_OBJ_ENV);
+    for (uint8_t i = 0; i < capture_count; i++) {
+        uint8_t idx = captures[i];
+        if (idx < extra_args) {
+            WIST_VM_OBJ_FIELD(clo_env, i) = (state->rsp - (1 + idx))->env;
+        } else {
+            WIST_VM_OBJ_FIELD(clo_env, i) =
+                WIST_VM_OBJ_FIELD(state->env, idx - extra_args);
+        }
+    }
+    struct wist_vm_obj clo = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
+    WIST_VM_OBJ_FIELD1(clo) = clo_env;
+    WIST_VM_OBJ_FIELD2(clo) = WIST_VM_OBJ_MAKE_CODE(pc);
+    return clo;
+}
+
+/* Does what the interpreter's MKB does, popping the fields off [state]. */
+static struct wist_vm_obj jit_mkb(struct wist_vm_jit_state *state,
+        size_t field_count) {
+    struct wist_vm_obj tuple = WIST_VM_GC_ALLOC(&state->vm->gc, field_count,
+            WIST_VM_OBJ_TUPLE);
+    for (size_t i = field_count; i > 0; i--) {
+        WIST_VM_OBJ_FIELD(tuple, i - 1) = *(--state->asp);
+    }
+    return tuple;
+}
+
+/* Stores a global behind the collector's barrier. */
+static void jit_setglobal(struct wist_vm_jit_state *state, uint32_t slot,
+        struct wist_vm_obj value) {
+    struct wist_vm *vm = state->vm;
+    WIST_VM_GC_BARRIER(&vm->gc, WIST_TOPLVL_SLOT(vm->toplvl, slot));
+    WIST_TOPLVL_SLOT(vm->toplvl, slot) = value;
+}
+
+#else
+
+void wist_vm_jit_init(struct wist_vm *vm) {
+    vm->jit.enabled = false;
+    vm->jit.entries = NULL;
+    vm->jit.entries_len = vm->jit.entries_used = 0;
+    vm->jit.chunks = NULL;
+    vm->jit.perf_map = NULL;
+}
+
+void wist_vm_jit_finish(struct wist_vm *vm) {
+    IGNORE(vm);
+}
+
+bool wist_vm_set_jit(struct wist_vm *vm, bool enabled) {
+    IGNORE(enabled);
+    vm->jit.enabled = false;
+    return false;
+}
+
+wist_vm_jit_fn wist_vm_jit_enter(struct wist_vm *vm, size_t offset) {
+    IGNORE(vm);
+    IGNORE(offset);
+    return NULL;
+}
+
+#endif /* WIST_VM_JIT */
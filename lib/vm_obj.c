@@ -6,6 +6,7 @@
 
 #include <wist/vm_obj.h>
 #include <wist/vm.h>
+#include <wist/toplevel.h>
 
 #include <stdio.h>
 #include <stddef.h>
@@ -17,83 +18,216 @@ static const char *vm_op_to_string[] = {
 #undef OPCODE
 };
 
+/* The operand bits of each ordinary op, which are 0 for superinstructions. */
+static const uint8_t op_arg_bits[__WIST_VM_OP_COUNT] = {
+#define OPCODE(name, bits) [WIST_VM_OP_##name] = bits,
+#define SUPEROP(first, second)
+#include <wist/vm_ops.h>
+#undef SUPEROP
+#undef OPCODE
+};
+
+/* The ops of each superinstruction, which are both 0 for ordinary ops. */
+static const uint8_t superop_parts[__WIST_VM_OP_COUNT][2] = {
+#define OPCODE(name, _bits)
+#define SUPEROP(first, second)                                                 \
+    [WIST_VM_OP_##first##_##second] = {                                        \
+        WIST_VM_OP_##first, WIST_VM_OP_##second                                \
+    },
+#include <wist/vm_ops.h>
+#undef SUPEROP
+#undef OPCODE
+};
+
+static bool print_operands(struct wist_vm *vm, uint32_t insn, uint32_t *start,
+        uint32_t **pc_ptr, int *clo_count);
+
 void wist_vm_obj_print_op(uint8_t op) {
         printf("%s\n", vm_op_to_string[op]);
 }
 
+const char *wist_vm_obj_op_name(uint8_t op) {
+    return vm_op_to_string[op];
+}
+
+uint8_t wist_vm_obj_fuse_ops(uint8_t first, uint8_t second) {
+#define OPCODE(name, _bits)
+#define SUPEROP(_first, _second)                                               \
+    if (first == WIST_VM_OP_##_first && second == WIST_VM_OP_##_second) {      \
+        return WIST_VM_OP_##_first##_##_second;                                \
+    }
+#include <wist/vm_ops.h>
+#undef SUPEROP
+#undef OPCODE
+    return __WIST_VM_OP_COUNT;
+}
+
+bool wist_vm_obj_split_op(uint8_t op, uint8_t *first_out, 
+        uint8_t *second_out) {
+    if (superop_parts[op][0] == superop_parts[op][1]) {
+        return false;
+    }
+
+    *first_out = superop_parts[op][0];
+    *second_out = superop_parts[op][1];
+    return true;
+}
+
+uint8_t wist_vm_obj_op_arg_bits(uint8_t op) {
+    return op_arg_bits[op];
+}
+
+bool wist_vm_obj_superop_packed(uint8_t first, uint8_t second) {
+    return op_arg_bits[first] + op_arg_bits[second] <= WIST_VM_INSN_ARG_BITS;
+}
+
+bool wist_vm_obj_split_insn(uint32_t insn, uint32_t **pc_ptr, 
+        uint32_t *first_out, uint32_t *second_out) {
+    uint8_t first, second;
+    if (!wist_vm_obj_split_op(WIST_VM_INSN_OP(insn), &first, &second)) {
+        return false;
+    }
+
+    uint8_t bits = op_arg_bits[first];
+    uint32_t arg = WIST_VM_INSN_ARG(insn);
+    *first_out = WIST_VM_INSN(first, arg & ((1u << bits) - 1));
+    if (wist_vm_obj_superop_packed(first, second)) {
+        *second_out = WIST_VM_INSN(second, arg >> bits);
+    } else {
+        *second_out = WIST_VM_INSN(second, WIST_VM_INSN_ARG(*(*pc_ptr)++));
+    }
+    return true;
+}
+
 void wist_vm_obj_print_clo(struct wist_vm *vm, struct wist_vm_obj clo) {
     int clo_count = 0;
-    uint8_t *pc = WIST_VM_OBJ_CLO_PC(vm, clo);
-    uint8_t op;
+    uint32_t *pc = WIST_VM_OBJ_CLO_PC(clo);
 
     while (1) {
-        op = *(pc++);
-        printf("%s", vm_op_to_string[op]);
-        switch (op) {
-            case WIST_VM_OP_INT64: {
-                uint64_t *val = (uint64_t *) pc;
-                pc += 8;
-                printf(" : %" PRIu64, *val);
-                break;
-            }
-            case WIST_VM_OP_CLOSURE: {
-                clo_count++;
-                uint16_t *val = (uint16_t *) pc;
-                pc += 2;
-                printf(" : %" PRIu16, *val);
-                break;
-            }
-            case WIST_VM_OP_MKB: {
-                uint16_t *val = (uint16_t *) pc;
-                pc += 2;
-                printf(" : %" PRIu16, *val);
-                break;
-            }
-            case WIST_VM_OP_ACCESS: {
-                uint8_t *val = (uint8_t *) pc;
-                pc += 1;
-                printf(" : %" PRIu8, *val);
-                break;
-            }
-            case WIST_VM_OP_RETURN:
-                if (clo_count == 0){
-                    printf("\n");
-                    return;
-                }
-                clo_count--;
-                break;
-            case WIST_VM_OP_SETGLOBAL: {
-                struct wist_sym *sym = *((struct wist_sym **) pc);
-                pc += sizeof(struct wist_sym **);
-                printf(" : '%.*s'", (int) sym->str_len, 
-                        (const uint8_t *) sym->str);
-                break;
-            }
-            case WIST_VM_OP_GETGLOBAL: {
-                struct wist_sym *sym = *((struct wist_sym **) pc);
-                pc += sizeof(struct wist_sym **);
-                printf(" : '%.*s'", (int) sym->str_len, 
-                        (const uint8_t *) sym->str);
-                break;
-            }
-            case WIST_VM_OP_PUSH:
-            case WIST_VM_OP_PUSHMARK:
-            case WIST_VM_OP_APPLY:
-            case WIST_VM_OP_APPTERM:
-            case WIST_VM_OP_GRAB:
-            case WIST_VM_OP_LET:
-            case WIST_VM_OP_ENDLET:
-                break;
+        uint32_t *start = pc;
+        uint32_t insn = *(pc++);
+        printf("%s", vm_op_to_string[WIST_VM_INSN_OP(insn)]);
+
+        uint32_t first, second;
+        bool end;
+        if (wist_vm_obj_split_insn(insn, &pc, &first, &second)) {
+            /* Only the second op can be a RETURN. */
+            print_operands(vm, first, start, &pc, &clo_count);
+            end = print_operands(vm, second, start, &pc, &clo_count);
+        } else {
+            end = print_operands(vm, insn, start, &pc, &clo_count);
         }
         printf("\n");
+        if (end) {
+            return;
+        }
     }
 }
 
 struct wist_vm_obj wist_vm_obj_create_gc(enum wist_vm_obj_kind t, 
         struct wist_vm_gc_hdr *gc) {
+    gc->tag = t;
+#ifdef WIST_VM_WIDE_OBJ
     struct wist_vm_obj obj = {
         .t = t,
         .gc = gc,
     };
+#else
+    struct wist_vm_obj obj = {
+        .bits = (uintptr_t) gc,
+    };
+#endif
     return obj;
 }
+
+/* 
+ * Prints the operands of the instruction word [insn], which is part of the 
+ * instruction at [start], and moves past any words after it.  Returns true 
+ * if it ends the closure being printed. 
+ */
+static bool print_operands(struct wist_vm *vm, uint32_t insn, uint32_t *start,
+        uint32_t **pc_ptr, int *clo_count) {
+    uint32_t *pc = *pc_ptr;
+    uint32_t arg = WIST_VM_INSN_ARG(insn);
+    bool end = false;
+
+    switch (WIST_VM_INSN_OP(insn)) {
+        case WIST_VM_OP_INT64: {
+            uint64_t *val = (uint64_t *) (start + arg);
+            printf(" : %" PRIu64, *val);
+            break;
+        }
+        case WIST_VM_OP_CLOSURE: {
+            (*clo_count)++;
+            uint8_t capture_count = WIST_VM_INSN_A(insn);
+            uint8_t *captures = (uint8_t *) pc;
+            pc += WIST_VM_CAPTURE_WORDS(capture_count);
+            printf(" : %" PRIu16 " :", WIST_VM_INSN_B(insn));
+            for (uint8_t i = 0; i < capture_count; i++) {
+                printf(" %" PRIu8, captures[i]);
+            }
+            break;
+        }
+        case WIST_VM_OP_MKB:
+            printf(" : %" PRIu32, arg);
+            break;
+        case WIST_VM_OP_RETURN:
+            if (*clo_count == 0) {
+                end = true;
+            } else {
+                (*clo_count)--;
+            }
+            break;
+        case WIST_VM_OP_INTI:
+        case WIST_VM_OP_ADDI:
+        case WIST_VM_OP_LTI:
+        case WIST_VM_OP_LEI:
+        case WIST_VM_OP_GTI:
+        case WIST_VM_OP_GEI:
+        case WIST_VM_OP_EQI:
+        case WIST_VM_OP_NEI:
+            printf(" : %" PRId32, WIST_VM_INSN_SARG(insn));
+            break;
+        case WIST_VM_OP_ACCESS:
+        case WIST_VM_OP_GRAB:
+        case WIST_VM_OP_APPLY:
+        case WIST_VM_OP_APPLY_EXACT:
+        case WIST_VM_OP_APPLY_ANY:
+        case WIST_VM_OP_APPTERM:
+        case WIST_VM_OP_APPTERM_EXACT:
+        case WIST_VM_OP_APPTERM_ANY:
+            printf(" : %" PRIu8, (uint8_t) arg);
+            break;
+        case WIST_VM_OP_REGENTER:
+            printf(" : %" PRIu32, *pc++);
+            break;
+        case WIST_VM_OP_SETGLOBAL:
+        case WIST_VM_OP_GETGLOBAL: {
+            struct wist_sym *sym = WIST_TOPLVL_SLOT_SYM(vm->toplvl, arg);
+            printf(" : %" PRIu32 " '%.*s'", arg, (int) sym->str_len, 
+                    (const uint8_t *) sym->str);
+            break;
+        }
+        case WIST_VM_OP_PUSH:
+        case WIST_VM_OP_PUSHMARK:
+        case WIST_VM_OP_GRABENV:
+        case WIST_VM_OP_RESTART:
+        case WIST_VM_OP_LET:
+        case WIST_VM_OP_ENDLET:
+        case WIST_VM_OP_ADD:
+        case WIST_VM_OP_SUB:
+        case WIST_VM_OP_MUL:
+        case WIST_VM_OP_DIV:
+        case WIST_VM_OP_REM:
+        case WIST_VM_OP_LT:
+        case WIST_VM_OP_LE:
+        case WIST_VM_OP_GT:
+        case WIST_VM_OP_GE:
+        case WIST_VM_OP_EQ:
+        case WIST_VM_OP_NE:
+            break;
+    }
+
+    *pc_ptr = pc;
+    return end;
+}
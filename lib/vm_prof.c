@@ -0,0 +1,291 @@
+/* === lib/vm_prof.c - VM heap profiler ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#include <wist/vm_prof.h>
+#include <wist/vm.h>
+#include <wist/vm_gc.h>
+#include <wist/ctx.h>
+#include <wist/defs.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Adds up the sampled objects left in the heap for a live profile. */
+struct live_count {
+    struct wist_vm_prof *prof;
+    size_t *values;
+    bool bytes;
+};
+
+static const char *kind_to_string_map[] = {
+    [WIST_VM_PROF_CLOSURE] = "closure",
+    [WIST_VM_PROF_PARTIAL] = "partial",
+    [WIST_VM_PROF_TUPLE] = "tuple",
+    [WIST_VM_PROF_UNKNOWN] = "code without sites",
+};
+
+/* === PROTOTYPES === */
+
+static size_t next_countdown(struct wist_vm_prof *prof);
+static size_t find_site(struct wist_vm_prof *prof, size_t pc);
+static void weigh(struct wist_vm_prof *prof, size_t size, size_t *objects_out,
+        size_t *bytes_out);
+static void copy_text(char *dst, const uint8_t *src, size_t src_len);
+static void count_live(void *ud, struct wist_vm_gc_hdr *hdr);
+static void write_frames(FILE *out, struct wist_vm_prof *prof,
+        struct wist_vm_prof_site *site, bool leaf);
+
+/* === PUBLICS === */
+
+void wist_vm_prof_init(struct wist_vm *vm) {
+    struct wist_vm_prof *prof = &vm->prof;
+
+    prof->enabled = false;
+    prof->rate = WIST_VM_PROF_DEFAULT_RATE;
+    prof->random = 0x9e3779b97f4a7c15;
+    prof->countdown = next_countdown(prof);
+    WIST_VECTOR_INIT(vm->ctx, &prof->sites, struct wist_vm_prof_site);
+    WIST_VECTOR_INIT(vm->ctx, &prof->decls, struct wist_vm_prof_decl);
+
+    struct wist_vm_prof_site unknown = {
+        .pc = 0,
+        .t = WIST_VM_PROF_UNKNOWN,
+        .parent = 0,
+        .decl = SIZE_MAX,
+        .line = 0,
+        .col = 0,
+        .text = "",
+        .allocated = 0,
+        .allocated_bytes = 0,
+    };
+    WIST_VECTOR_PUSH(vm->ctx, &prof->sites, struct wist_vm_prof_site,
+            &unknown);
+}
+
+void wist_vm_prof_finish(struct wist_vm *vm) {
+    WIST_VECTOR_FINISH(vm->ctx, &vm->prof.sites);
+    WIST_VECTOR_FINISH(vm->ctx, &vm->prof.decls);
+}
+
+size_t wist_vm_prof_add_decl(struct wist_vm *vm, const uint8_t *name,
+        size_t name_len) {
+    struct wist_vm_prof_decl decl;
+    if (name != NULL) {
+        copy_text(decl.name, name, name_len);
+    } else {
+        strcpy(decl.name, "<expr>");
+    }
+
+    WIST_VECTOR_PUSH(vm->ctx, &vm->prof.decls, struct wist_vm_prof_decl,
+            &decl);
+    return WIST_VECTOR_LEN(&vm->prof.decls, struct wist_vm_prof_decl) - 1;
+}
+
+size_t wist_vm_prof_add_site(struct wist_vm *vm,
+        struct wist_srcloc_index *srclocs, enum wist_vm_prof_kind t,
+        size_t pc, size_t parent, size_t decl, struct wist_srcloc loc) {
+    struct wist_vm_prof *prof = &vm->prof;
+    size_t id = WIST_VECTOR_LEN(&prof->sites, struct wist_vm_prof_site);
+    if (id >= WIST_VM_PROF_MAX_SITES) {
+        return 0;
+    }
+
+    struct wist_vm_prof_site site = {
+        .pc = pc,
+        .t = t,
+        .parent = parent,
+        .decl = decl,
+        .line = 0,
+        .col = 0,
+        .text = "",
+        .allocated = 0,
+        .allocated_bytes = 0,
+    };
+    size_t line, col, text_len;
+    if (wist_srcloc_index_locate(srclocs, loc, &line, &col)) {
+        site.line = (uint32_t) line;
+        site.col = (uint32_t) col;
+        const uint8_t *text = wist_srcloc_index_slice(srclocs, loc,
+                &text_len);
+        copy_text(site.text, text, text_len);
+    }
+
+    WIST_VECTOR_PUSH(vm->ctx, &prof->sites, struct wist_vm_prof_site, &site);
+    return id;
+}
+
+void wist_vm_prof_place_sites(struct wist_vm *vm, size_t first, size_t base) {
+    size_t count = WIST_VECTOR_LEN(&vm->prof.sites, struct wist_vm_prof_site);
+    for (size_t i = first; i < count; i++) {
+        WIST_VECTOR_INDEX(&vm->prof.sites, struct wist_vm_prof_site, i)->pc
+            += base;
+    }
+}
+
+void wist_vm_prof_sample(struct wist_vm *vm, struct wist_vm_obj obj,
+        size_t pc) {
+    struct wist_vm_prof *prof = &vm->prof;
+    struct wist_vm_gc_hdr *hdr = WIST_VM_OBJ_GET_GC(obj);
+    size_t size = WIST_VM_GC_HDR_SIZE(hdr->field_count);
+
+    if (size < prof->countdown) {
+        prof->countdown -= size;
+        return;
+    }
+    prof->countdown = next_countdown(prof);
+
+    size_t id = find_site(prof, pc);
+    struct wist_vm_prof_site *site = WIST_VECTOR_INDEX(&prof->sites,
+            struct wist_vm_prof_site, id);
+    size_t objects, bytes;
+    weigh(prof, size, &objects, &bytes);
+    site->allocated += objects;
+    site->allocated_bytes += bytes;
+    hdr->site = (uint16_t) (id + 1);
+}
+
+void wist_vm_prof_write(struct wist_vm *vm, FILE *out,
+        enum wist_vm_heap_profile what) {
+    struct wist_vm_prof *prof = &vm->prof;
+    size_t count = WIST_VECTOR_LEN(&prof->sites, struct wist_vm_prof_site);
+    size_t *values = WIST_CTX_NEW_ARR(vm->ctx, size_t, count);
+    memset(values, 0, sizeof(size_t) * count);
+
+    if (what == WIST_VM_HEAP_PROFILE_LIVE_BYTES
+            || what == WIST_VM_HEAP_PROFILE_LIVE_OBJECTS) {
+        /* Nothing dead is left after a full collection. */
+        wist_vm_gc_collect_full(vm);
+        struct live_count live = {
+            prof, values, what == WIST_VM_HEAP_PROFILE_LIVE_BYTES
+        };
+        wist_vm_gc_walk(&vm->gc, count_live, &live);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            struct wist_vm_prof_site *site = WIST_VECTOR_INDEX(&prof->sites,
+                    struct wist_vm_prof_site, i);
+            values[i] = what == WIST_VM_HEAP_PROFILE_ALLOCATED_BYTES
+                ? site->allocated_bytes : site->allocated;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] > 0) {
+            write_frames(out, prof, WIST_VECTOR_INDEX(&prof->sites,
+                        struct wist_vm_prof_site, i), true);
+            fprintf(out, " %zu\n", values[i]);
+        }
+    }
+
+    WIST_CTX_FREE_ARR(vm->ctx, values, size_t, count);
+}
+
+/* === PRIVATES === */
+
+/*
+ * Spreads samples evenly between 1 and twice the rate bytes apart, so they
+ * do not fall in step with code that allocates the same thing in a loop.
+ */
+static size_t next_countdown(struct wist_vm_prof *prof) {
+    if (prof->rate <= 1) {
+        return 0;
+    }
+
+    /* xorshift64 */
+    prof->random ^= prof->random << 13;
+    prof->random ^= prof->random >> 7;
+    prof->random ^= prof->random << 17;
+    return 1 + (size_t) (prof->random % (2 * prof->rate - 1));
+}
+
+/* Finds the site of the op at [pc], or 0 if none was recorded there. */
+static size_t find_site(struct wist_vm_prof *prof, size_t pc) {
+    size_t low = 1;
+    size_t high = WIST_VECTOR_LEN(&prof->sites, struct wist_vm_prof_site);
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        size_t mid_pc = WIST_VECTOR_INDEX(&prof->sites,
+                struct wist_vm_prof_site, mid)->pc;
+        if (mid_pc == pc) {
+            return mid;
+        } else if (mid_pc < pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return 0;
+}
+
+/*
+ * An object smaller than the rate is sampled about [size] in [rate] times,
+ * so each sample stands for [rate] bytes of objects like it.
+ */
+static void weigh(struct wist_vm_prof *prof, size_t size, size_t *objects_out,
+        size_t *bytes_out) {
+    if (size >= prof->rate) {
+        *objects_out = 1;
+        *bytes_out = size;
+    } else {
+        *objects_out = (prof->rate + size / 2) / size;
+        *bytes_out = prof->rate;
+    }
+}
+
+/*
+ * Keeps the start of [src] on one line, without the semicolons and spaces
+ * that separate frames and values in folded stacks.
+ */
+static void copy_text(char *dst, const uint8_t *src, size_t src_len) {
+    size_t len = src_len < WIST_VM_PROF_TEXT ? src_len : WIST_VM_PROF_TEXT;
+
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = src[i] == ';' || src[i] < ' ' ? ' ' : (char) src[i];
+    }
+    if (src_len > WIST_VM_PROF_TEXT) {
+        memcpy(dst + WIST_VM_PROF_TEXT - 3, "...", 3);
+    }
+    dst[len] = '\0';
+}
+
+static void count_live(void *ud, struct wist_vm_gc_hdr *hdr) {
+    struct live_count *live = ud;
+    if (hdr->site == 0) {
+        return;
+    }
+
+    size_t objects, bytes;
+    weigh(live->prof, WIST_VM_GC_HDR_SIZE(hdr->field_count), &objects,
+            &bytes);
+    live->values[hdr->site - 1] += live->bytes ? bytes : objects;
+}
+
+/*
+ * Writes the declaration, then the lambdas [site] is in from the outside,
+ * then the site itself, which only says what it allocates as the [leaf].
+ */
+static void write_frames(FILE *out, struct wist_vm_prof *prof,
+        struct wist_vm_prof_site *site, bool leaf) {
+    if (site->parent != 0) {
+        write_frames(out, prof, WIST_VECTOR_INDEX(&prof->sites,
+                    struct wist_vm_prof_site, site->parent), false);
+        fprintf(out, ";");
+    } else if (site->decl != SIZE_MAX) {
+        fprintf(out, "%s;", WIST_VECTOR_INDEX(&prof->decls,
+                    struct wist_vm_prof_decl, site->decl)->name);
+    }
+
+    if (site->t == WIST_VM_PROF_UNKNOWN) {
+        fprintf(out, "%s", kind_to_string_map[site->t]);
+        return;
+    }
+    if (leaf) {
+        fprintf(out, "%s ", kind_to_string_map[site->t]);
+    }
+    fprintf(out, "%s at %" PRIu32 ":%" PRIu32, site->text, site->line,
+            site->col);
+}
@@ -0,0 +1,571 @@
+/* === lib/vm_reg.c - Register based VM tier ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#include <wist/vm_reg.h>
+#include <wist/vm.h>
+#include <wist/ctx.h>
+#include <wist/defs.h>
+#include <wist/toplevel.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* The same dispatch choice as the stack tier, see vm.c. */
+#if defined(__GNUC__) && !defined(WIST_VM_SWITCH_DISPATCH)
+#define WIST_VM_THREADED_DISPATCH
+#endif
+
+#ifdef WIST_VM_THREADED_DISPATCH
+#define VM_CASE(_name) op_##_name
+#define VM_NEXT() goto *dispatch_table[*pc++]
+#define VM_DISPATCH_BEGIN VM_NEXT();
+#define VM_DISPATCH_END
+#else
+#define VM_CASE(_name) case WIST_VM_REG_OP_##_name
+#define VM_NEXT() break
+#define VM_DISPATCH_BEGIN while (1) { switch (*pc++) {
+#define VM_DISPATCH_END                                                        \
+            default:                                                           \
+                printf("unimplemented op case in wist_vm_reg_interpret : %d\n",\
+                        *(pc - 1));                                            \
+                break;                                                         \
+        }                                                                      \
+    }
+#endif
+
+#define VM_WRAP(_lhs, _op, _rhs)                                               \
+    ((int64_t) ((uint64_t) (_lhs) _op (uint64_t) (_rhs)))
+
+/*
+ * Makes sure the registers from [base] up to [_top] exist, growing the
+ * register stack if needed.  The stack may move, so [regs] is recomputed.
+ */
+#define VM_RESERVE_REGS(_top)                                                  \
+    if ((_top) > vm->reg_stack_len || (_top) > vm->stack_limit) {              \
+        if (!grow_reg_stack(vm, (_top))) {                                     \
+            goto stack_overflow;                                               \
+        }                                                                      \
+    }                                                                          \
+    regs = vm->reg_stack + base;
+
+/* Collects garbage if it is due, with every register up to this frame's live. */
+#define VM_GC_SAFEPOINT()                                                      \
+    if (WIST_VM_GC_DUE(&vm->gc)) {                                             \
+        size_t _reg_sp = vm->reg_sp;                                           \
+        vm->reg_sp = base + frame_size;                                        \
+        wist_vm_gc_collect(vm);                                                \
+        vm->reg_sp = _reg_sp;                                                  \
+    }
+
+#define VM_RESERVE_FRAME()                                                     \
+    if (fsp + 1 > vm->reg_frames_len || fsp + 1 > vm->stack_limit) {          \
+        if (!grow_reg_frames(vm, fsp + 1)) {                                   \
+            goto stack_overflow;                                               \
+        }                                                                      \
+    }
+
+/* Defines the handler for an integer primitive on two registers. */
+#define VM_INT_OP(_name, _result)                                              \
+    VM_CASE(_name): {                                                          \
+        uint8_t dst = pc[0];                                                   \
+        int64_t lhs = WIST_VM_OBJ_GET_INT(regs[pc[1]]);                        \
+        int64_t rhs = WIST_VM_OBJ_GET_INT(regs[pc[2]]);                        \
+        pc += 3;                                                               \
+        regs[dst] = WIST_VM_OBJ_MAKE_INT(_result);                             \
+        VM_NEXT();                                                             \
+    }
+
+/* The same, but with [rhs] read from the instruction stream. */
+#define VM_INT_IMM_OP(_name, _result)                                          \
+    VM_CASE(_name): {                                                          \
+        uint8_t dst = pc[0];                                                   \
+        int64_t lhs = WIST_VM_OBJ_GET_INT(regs[pc[1]]);                        \
+        int64_t rhs = read_i32(pc + 2);                                 \
+        pc += 6;                                                               \
+        regs[dst] = WIST_VM_OBJ_MAKE_INT(_result);                             \
+        VM_NEXT();                                                             \
+    }
+
+static const char *vm_reg_op_to_string[] = {
+#define OPCODE(name, _size) [WIST_VM_REG_OP_##name] = #name,
+#include <wist/vm_reg_ops.h>
+#undef OPCODE
+};
+
+/* === PROTOTYPES === */
+
+static bool grow_reg_stack(struct wist_vm *vm, size_t needed);
+static bool grow_reg_frames(struct wist_vm *vm, size_t needed);
+static bool closure_reg_fn(struct wist_vm_obj clo, uint32_t *fn_out);
+static struct wist_vm_obj apply_args(struct wist_vm *vm,
+        struct wist_vm_obj fun, struct wist_vm_obj *args, uint8_t argc);
+static void enter_fn(struct wist_vm_obj *regs, struct wist_vm_obj env,
+        struct wist_vm_obj arg);
+static uint32_t read_u32(const uint8_t *p);
+static int32_t read_i32(const uint8_t *p);
+static int64_t read_i64(const uint8_t *p);
+
+/* === PUBLICS === */
+
+void wist_vm_set_tier(struct wist_vm *vm, enum wist_vm_tier tier) {
+    vm->tier = tier;
+}
+
+struct wist_vm_obj wist_vm_reg_interpret(struct wist_vm *vm, uint32_t fn,
+        struct wist_vm_obj env, struct wist_vm_obj arg) {
+    /*
+     * Like the stack tier this runs above whatever the register stack already
+     * holds, and everything is kept as indices because the stacks can move.
+     */
+    size_t reg_base = vm->reg_sp;
+    size_t base = reg_base;
+    size_t frame_base = vm->reg_frame_sp;
+    size_t fsp = frame_base;
+    struct wist_vm_obj *regs;
+    struct wist_vm_obj result;
+    /* Arguments are copied out here whenever the frame they sit in is reused. */
+    struct wist_vm_obj args[UINT8_MAX];
+
+    struct wist_vm_reg_fn_hdr *hdr = WIST_VM_REG_FN_HDR(vm, fn);
+    uint16_t frame_size = hdr->frame_size;
+    uint8_t *pc = (uint8_t *) (hdr + 1);
+
+    VM_RESERVE_REGS(base + frame_size);
+    enter_fn(regs, env, arg);
+
+#ifdef WIST_VM_THREADED_DISPATCH
+    static void *dispatch_table[] = {
+#define OPCODE(name, _args) [WIST_VM_REG_OP_##name] = &&op_##name,
+#include <wist/vm_reg_ops.h>
+#undef OPCODE
+    };
+#endif
+
+    VM_DISPATCH_BEGIN
+        VM_CASE(LOADI): {
+            regs[pc[0]] = WIST_VM_OBJ_MAKE_INT(read_i64(pc + 1));
+            pc += 9;
+            VM_NEXT();
+        }
+        VM_CASE(GETGLOBAL): {
+            regs[pc[0]] = WIST_TOPLVL_SLOT(vm->toplvl,
+                    read_u32(pc + 1));
+            pc += 5;
+            VM_NEXT();
+        }
+        VM_CASE(SETGLOBAL): {
+            uint32_t slot = read_u32(pc + 1);
+            WIST_VM_GC_BARRIER(&vm->gc, WIST_TOPLVL_SLOT(vm->toplvl, slot));
+            WIST_TOPLVL_SLOT(vm->toplvl, slot) = regs[pc[0]];
+            pc += 5;
+            VM_NEXT();
+        }
+        VM_CASE(CLOSURE): {
+            VM_GC_SAFEPOINT();
+            uint8_t dst = pc[0];
+            uint32_t stub = read_u32(pc + 1);
+            uint8_t capture_count = pc[5];
+            pc += 6;
+            struct wist_vm_obj clo_env = WIST_VM_GC_ALLOC(&vm->gc,
+                    capture_count, WIST_VM_OBJ_ENV);
+            for (uint8_t i = 0; i < capture_count; i++) {
+                WIST_VM_OBJ_FIELD(clo_env, i) = regs[*pc++];
+            }
+            struct wist_vm_obj clo = WIST_VM_GC_ALLOC(&vm->gc, 2,
+                    WIST_VM_OBJ_CLO);
+            WIST_VM_OBJ_FIELD1(clo) = clo_env;
+            WIST_VM_OBJ_FIELD2(clo) = WIST_VM_OBJ_MAKE_CODE(
+                    WIST_VM_CODE_AT(vm, stub));
+            regs[dst] = clo;
+            VM_NEXT();
+        }
+        VM_CASE(MKB): {
+            VM_GC_SAFEPOINT();
+            uint8_t dst = pc[0];
+            uint8_t field_count = pc[1];
+            pc += 2;
+            struct wist_vm_obj tuple = WIST_VM_GC_ALLOC(&vm->gc, field_count,
+                    WIST_VM_OBJ_TUPLE);
+            for (uint8_t i = 0; i < field_count; i++) {
+                WIST_VM_OBJ_FIELD(tuple, i) = regs[*pc++];
+            }
+            regs[dst] = tuple;
+            VM_NEXT();
+        }
+        VM_CASE(CALL): {
+            uint8_t dst = pc[0];
+            struct wist_vm_obj fun = regs[pc[1]];
+            uint8_t argc = pc[2];
+            uint8_t *arg_regs = pc + 3;
+            pc = arg_regs + argc;
+
+            uint32_t callee;
+            if (closure_reg_fn(fun, &callee)) {
+                struct wist_vm_reg_fn_hdr *callee_hdr =
+                    WIST_VM_REG_FN_HDR(vm, callee);
+                struct wist_vm_obj callee_env = WIST_VM_OBJ_FIELD1(fun);
+
+                if (callee_hdr->remaining == argc || argc == 1) {
+                    VM_RESERVE_FRAME();
+                    struct wist_vm_reg_frame *frame = &vm->reg_frames[fsp++];
+                    frame->pc = pc;
+                    frame->base = base;
+                    frame->frame_size = frame_size;
+                    frame->dst = dst;
+                    size_t caller_base = base;
+                    base += frame_size;
+
+                    /* The new frame is above the caller's, so they never overlap. */
+                    if (callee_hdr->remaining == argc) {
+                        /* Every argument is here, so go straight to the body. */
+                        uint8_t held = callee_hdr->held;
+                        callee_hdr = WIST_VM_REG_FN_HDR(vm, callee_hdr->body);
+                        frame_size = callee_hdr->frame_size;
+                        VM_RESERVE_REGS(base + frame_size);
+                        struct wist_vm_obj *caller = vm->reg_stack 
+                            + caller_base;
+                        regs[0] = caller[arg_regs[argc - 1]];
+                        for (uint8_t i = 0; i < held; i++) {
+                            regs[1 + i] = WIST_VM_OBJ_FIELD(callee_env, i);
+                        }
+                        for (uint8_t i = 0; i + 1 < argc; i++) {
+                            regs[1 + held + i] = caller[arg_regs[i]];
+                        }
+                        size_t env_count = WIST_VM_OBJ_FIELD_COUNT(callee_env);
+                        for (size_t i = held; i < env_count; i++) {
+                            regs[argc + i] = WIST_VM_OBJ_FIELD(callee_env, i);
+                        }
+                    } else {
+                        frame_size = callee_hdr->frame_size;
+                        VM_RESERVE_REGS(base + frame_size);
+                        enter_fn(regs, callee_env, 
+                                vm->reg_stack[caller_base + arg_regs[0]]);
+                    }
+                    pc = (uint8_t *) (callee_hdr + 1);
+                    VM_NEXT();
+                }
+            }
+
+            for (uint8_t i = 0; i < argc; i++) {
+                args[i] = regs[arg_regs[i]];
+            }
+            vm->reg_sp = base + frame_size;
+            vm->reg_frame_sp = fsp;
+            wist_vm_gc_push_root(&vm->gc, args, argc);
+            result = apply_args(vm, fun, args, argc);
+            wist_vm_gc_pop_root(&vm->gc);
+            if (vm->err != WIST_VM_ERR_NONE) {
+                goto error;
+            }
+            regs = vm->reg_stack + base;
+            regs[dst] = result;
+            VM_NEXT();
+        }
+        VM_CASE(TAILCALL): {
+            struct wist_vm_obj fun = regs[pc[0]];
+            uint8_t argc = pc[1];
+            pc += 2;
+            for (uint8_t i = 0; i < argc; i++) {
+                args[i] = regs[*pc++];
+            }
+
+            uint32_t callee;
+            if (closure_reg_fn(fun, &callee)) {
+                struct wist_vm_reg_fn_hdr *callee_hdr =
+                    WIST_VM_REG_FN_HDR(vm, callee);
+                struct wist_vm_obj callee_env = WIST_VM_OBJ_FIELD1(fun);
+
+                /* The same as CALL, but reusing the frame at [base]. */
+                if (callee_hdr->remaining == argc) {
+                    uint8_t held = callee_hdr->held;
+                    callee_hdr = WIST_VM_REG_FN_HDR(vm, callee_hdr->body);
+                    frame_size = callee_hdr->frame_size;
+                    VM_RESERVE_REGS(base + frame_size);
+                    regs[0] = args[argc - 1];
+                    for (uint8_t i = 0; i < held; i++) {
+                        regs[1 + i] = WIST_VM_OBJ_FIELD(callee_env, i);
+                    }
+                    for (uint8_t i = 0; i + 1 < argc; i++) {
+                        regs[1 + held + i] = args[i];
+                    }
+                    size_t env_count = WIST_VM_OBJ_FIELD_COUNT(callee_env);
+                    for (size_t i = held; i < env_count; i++) {
+                        regs[argc + i] = WIST_VM_OBJ_FIELD(callee_env, i);
+                    }
+                    pc = (uint8_t *) (callee_hdr + 1);
+                    VM_NEXT();
+                } else if (argc == 1) {
+                    frame_size = callee_hdr->frame_size;
+                    VM_RESERVE_REGS(base + frame_size);
+                    enter_fn(regs, callee_env, args[0]);
+                    pc = (uint8_t *) (callee_hdr + 1);
+                    VM_NEXT();
+                }
+            }
+
+            vm->reg_sp = base + frame_size;
+            vm->reg_frame_sp = fsp;
+            wist_vm_gc_push_root(&vm->gc, args, argc);
+            result = apply_args(vm, fun, args, argc);
+            wist_vm_gc_pop_root(&vm->gc);
+            if (vm->err != WIST_VM_ERR_NONE) {
+                goto error;
+            }
+            goto do_return;
+        }
+        VM_CASE(RET): {
+            result = regs[*pc];
+do_return:
+            if (fsp == frame_base) {
+                goto done;
+            }
+            struct wist_vm_reg_frame *frame = &vm->reg_frames[--fsp];
+            pc = frame->pc;
+            base = frame->base;
+            frame_size = frame->frame_size;
+            regs = vm->reg_stack + base;
+            regs[frame->dst] = result;
+            VM_NEXT();
+        }
+        VM_INT_OP(ADD, VM_WRAP(lhs, +, rhs))
+        VM_INT_OP(SUB, VM_WRAP(lhs, -, rhs))
+        VM_INT_OP(MUL, VM_WRAP(lhs, *, rhs))
+        VM_CASE(DIV): {
+            uint8_t dst = pc[0];
+            int64_t lhs = WIST_VM_OBJ_GET_INT(regs[pc[1]]);
+            int64_t rhs = WIST_VM_OBJ_GET_INT(regs[pc[2]]);
+            pc += 3;
+            if (rhs == 0) {
+                goto div_by_zero;
+            }
+            regs[dst] = WIST_VM_OBJ_MAKE_INT(rhs == -1 ? VM_WRAP(0, -, lhs)
+                    : lhs / rhs);
+            VM_NEXT();
+        }
+        VM_CASE(REM): {
+            uint8_t dst = pc[0];
+            int64_t lhs = WIST_VM_OBJ_GET_INT(regs[pc[1]]);
+            int64_t rhs = WIST_VM_OBJ_GET_INT(regs[pc[2]]);
+            pc += 3;
+            if (rhs == 0) {
+                goto div_by_zero;
+            }
+            regs[dst] = WIST_VM_OBJ_MAKE_INT(rhs == -1 ? 0 : lhs % rhs);
+            VM_NEXT();
+        }
+        VM_INT_OP(LT, lhs < rhs)
+        VM_INT_OP(LE, lhs <= rhs)
+        VM_INT_OP(GT, lhs > rhs)
+        VM_INT_OP(GE, lhs >= rhs)
+        VM_INT_OP(EQ, lhs == rhs)
+        VM_INT_OP(NE, lhs != rhs)
+        VM_INT_IMM_OP(ADDI, VM_WRAP(lhs, +, rhs))
+        VM_INT_IMM_OP(LTI, lhs < rhs)
+        VM_INT_IMM_OP(LEI, lhs <= rhs)
+        VM_INT_IMM_OP(GTI, lhs > rhs)
+        VM_INT_IMM_OP(GEI, lhs >= rhs)
+        VM_INT_IMM_OP(EQI, lhs == rhs)
+        VM_INT_IMM_OP(NEI, lhs != rhs)
+    VM_DISPATCH_END
+
+stack_overflow:
+    vm->err = WIST_VM_ERR_STACK_OVERFLOW;
+    goto error;
+
+div_by_zero:
+    vm->err = WIST_VM_ERR_DIV_BY_ZERO;
+
+error:
+    result = WIST_VM_OBJ_MAKE_UNDEFINED();
+
+done:
+    vm->reg_sp = reg_base;
+    vm->reg_frame_sp = frame_base;
+    return result;
+}
+
+void wist_vm_reg_print_fn(struct wist_vm *vm, uint32_t fn) {
+    struct wist_vm_reg_fn_hdr *hdr = WIST_VM_REG_FN_HDR(vm, fn);
+    uint8_t *pc = (uint8_t *) (hdr + 1);
+    uint8_t *end = WIST_VECTOR_DATA(&vm->reg_code_area, uint8_t)
+        + WIST_VECTOR_LEN(&vm->reg_code_area, uint8_t);
+
+    printf("fn %" PRIu32 " : frame %" PRIu16 " held %" PRIu8
+            " remaining %" PRIu8 " body %" PRIu32 "\n", fn, hdr->frame_size,
+            hdr->held, hdr->remaining, hdr->body);
+
+    /* A function always ends with the first RET or TAILCALL at its top. */
+    while (pc < end) {
+        uint8_t op = *pc++;
+        printf("%s", vm_reg_op_to_string[op]);
+        switch (op) {
+            case WIST_VM_REG_OP_LOADI:
+                printf(" r%" PRIu8 " : %" PRId64, pc[0],
+                        read_i64(pc + 1));
+                pc += 9;
+                break;
+            case WIST_VM_REG_OP_GETGLOBAL:
+            case WIST_VM_REG_OP_SETGLOBAL: {
+                uint32_t slot = read_u32(pc + 1);
+                struct wist_sym *sym = WIST_TOPLVL_SLOT_SYM(vm->toplvl, slot);
+                printf(" r%" PRIu8 " : %" PRIu32 " '%.*s'", pc[0], slot,
+                        (int) sym->str_len, (const uint8_t *) sym->str);
+                pc += 5;
+                break;
+            }
+            case WIST_VM_REG_OP_CLOSURE: {
+                uint8_t capture_count = pc[5];
+                printf(" r%" PRIu8 " : %" PRIu32 " :", pc[0],
+                        read_u32(pc + 1));
+                pc += 6;
+                for (uint8_t i = 0; i < capture_count; i++) {
+                    printf(" r%" PRIu8, *pc++);
+                }
+                break;
+            }
+            case WIST_VM_REG_OP_MKB: {
+                uint8_t field_count = pc[1];
+                printf(" r%" PRIu8 " :", pc[0]);
+                pc += 2;
+                for (uint8_t i = 0; i < field_count; i++) {
+                    printf(" r%" PRIu8, *pc++);
+                }
+                break;
+            }
+            case WIST_VM_REG_OP_CALL:
+            case WIST_VM_REG_OP_TAILCALL: {
+                if (op == WIST_VM_REG_OP_CALL) {
+                    printf(" r%" PRIu8, *pc++);
+                }
+                uint8_t argc = pc[1];
+                printf(" r%" PRIu8 " :", pc[0]);
+                pc += 2;
+                for (uint8_t i = 0; i < argc; i++) {
+                    printf(" r%" PRIu8, *pc++);
+                }
+                if (op == WIST_VM_REG_OP_TAILCALL) {
+                    printf("\n");
+                    return;
+                }
+                break;
+            }
+            case WIST_VM_REG_OP_RET:
+                printf(" r%" PRIu8 "\n", pc[0]);
+                return;
+            case WIST_VM_REG_OP_ADDI:
+            case WIST_VM_REG_OP_LTI:
+            case WIST_VM_REG_OP_LEI:
+            case WIST_VM_REG_OP_GTI:
+            case WIST_VM_REG_OP_GEI:
+            case WIST_VM_REG_OP_EQI:
+            case WIST_VM_REG_OP_NEI:
+                printf(" r%" PRIu8 " r%" PRIu8 " : %" PRId32, pc[0], pc[1],
+                        read_i32(pc + 2));
+                pc += 6;
+                break;
+            default:
+                printf(" r%" PRIu8 " r%" PRIu8 " r%" PRIu8, pc[0], pc[1],
+                        pc[2]);
+                pc += 3;
+                break;
+        }
+        printf("\n");
+    }
+}
+
+/* === PRIVATES === */
+
+static bool grow_reg_stack(struct wist_vm *vm, size_t needed) {
+    size_t new_len = wist_vm_stack_grow_len(vm, vm->reg_stack_len, needed);
+    if (new_len == 0) {
+        return false;
+    }
+
+    vm->reg_stack = WIST_CTX_RESIZE(vm->ctx, vm->reg_stack,
+            struct wist_vm_obj, vm->reg_stack_len, new_len);
+    /* The collector may scan registers before a frame writes them. */
+    for (size_t i = vm->reg_stack_len; i < new_len; i++) {
+        vm->reg_stack[i] = WIST_VM_OBJ_MAKE_UNDEFINED();
+    }
+    vm->reg_stack_len = new_len;
+    return true;
+}
+
+static bool grow_reg_frames(struct wist_vm *vm, size_t needed) {
+    size_t new_len = wist_vm_stack_grow_len(vm, vm->reg_frames_len, needed);
+    if (new_len == 0) {
+        return false;
+    }
+
+    vm->reg_frames = WIST_CTX_RESIZE(vm->ctx, vm->reg_frames,
+            struct wist_vm_reg_frame, vm->reg_frames_len, new_len);
+    vm->reg_frames_len = new_len;
+    return true;
+}
+
+/* Checks if [clo] is a register tier closure, and finds its function if so. */
+static bool closure_reg_fn(struct wist_vm_obj clo, uint32_t *fn_out) {
+    uint32_t *code = WIST_VM_OBJ_CLO_PC(clo);
+    if (WIST_VM_INSN_OP(*code) != WIST_VM_OP_REGENTER) {
+        return false;
+    }
+    *fn_out = code[1];
+    return true;
+}
+
+/*
+ * Applies [fun] to [args] one at a time from C, for the calls the
+ * interpreter loop can not enter itself.  The caller's frame must already be
+ * below vm->reg_sp.
+ */
+static struct wist_vm_obj apply_args(struct wist_vm *vm,
+        struct wist_vm_obj fun, struct wist_vm_obj *args, uint8_t argc) {
+    /* Each partial result is only held here until the next application. */
+    wist_vm_gc_push_root(&vm->gc, &fun, 1);
+    for (uint8_t i = 0; i < argc; i++) {
+        uint32_t fn;
+        if (closure_reg_fn(fun, &fn)) {
+            fun = wist_vm_reg_interpret(vm, fn, WIST_VM_OBJ_FIELD1(fun),
+                    args[i]);
+        } else {
+            fun = wist_vm_apply(vm, fun, args[i]);
+        }
+        if (vm->err != WIST_VM_ERR_NONE) {
+            break;
+        }
+    }
+    wist_vm_gc_pop_root(&vm->gc);
+    return fun;
+}
+
+/* Fills in the start of a fresh frame for one argument application. */
+static void enter_fn(struct wist_vm_obj *regs, struct wist_vm_obj env,
+        struct wist_vm_obj arg) {
+    regs[0] = arg;
+    for (size_t i = 0; i < WIST_VM_OBJ_FIELD_COUNT(env); i++) {
+        regs[1 + i] = WIST_VM_OBJ_FIELD(env, i);
+    }
+}
+
+/* Operands follow single byte opcodes, so they are read byte-wise. */
+static uint32_t read_u32(const uint8_t *p) {
+    uint32_t u32;
+    memcpy(&u32, p, sizeof(u32));
+    return u32;
+}
+
+static int32_t read_i32(const uint8_t *p) {
+    int32_t i32;
+    memcpy(&i32, p, sizeof(i32));
+    return i32;
+}
+
+static int64_t read_i64(const uint8_t *p) {
+    int64_t i64;
+    memcpy(&i64, p, sizeof(i64));
+    return i64;
+}
@@ -0,0 +1,578 @@
+/* === lib/vm_reg_gen.c - Code generation for the register VM tier ===
+ * Copyright (C) 2022 Gavin Ratcliff - All Rights Reserved
+ * Part of the Wist reference implementation, under the MIT license.
+ * See LICENSE.txt for license information.
+*/
+
+#include <wist.h>
+#include <wist/lir.h>
+#include <wist/compiler.h>
+#include <wist/toplevel.h>
+#include <wist/vm.h>
+#include <wist/vm_reg.h>
+#include <wist/vector.h>
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * A function being generated.  Variables are found by their raw de Bruijn
+ * index: the first [locals] innermost ones are registers of this frame, and
+ * the rest are looked up in [captures], which live in the registers from
+ * [first_cap] on.  Once [failed] is set, after saying why, the code is only
+ * generated to be thrown away.
+ */
+struct reg_fn {
+    struct wist_ctx *ctx;
+    struct wist_vector code; /* uint8_t */
+    struct wist_vector locals; /* uint8_t register, innermost last */
+    struct wist_vector captures; /* int index in the enclosing scope */
+    int first_cap;
+    int next_reg, max_reg;
+    bool failed;
+};
+
+static const uint8_t prim_to_op[] = {
+    [WIST_LIR_PRIM_ADD] = WIST_VM_REG_OP_ADD,
+    [WIST_LIR_PRIM_SUB] = WIST_VM_REG_OP_SUB,
+    [WIST_LIR_PRIM_MUL] = WIST_VM_REG_OP_MUL,
+    [WIST_LIR_PRIM_DIV] = WIST_VM_REG_OP_DIV,
+    [WIST_LIR_PRIM_REM] = WIST_VM_REG_OP_REM,
+    [WIST_LIR_PRIM_LT] = WIST_VM_REG_OP_LT,
+    [WIST_LIR_PRIM_LE] = WIST_VM_REG_OP_LE,
+    [WIST_LIR_PRIM_GT] = WIST_VM_REG_OP_GT,
+    [WIST_LIR_PRIM_GE] = WIST_VM_REG_OP_GE,
+    [WIST_LIR_PRIM_EQ] = WIST_VM_REG_OP_EQ,
+    [WIST_LIR_PRIM_NE] = WIST_VM_REG_OP_NE,
+};
+
+/* Only the primitives wist_lir_prim_imm_form can return are filled in. */
+static const uint8_t prim_to_imm_op[] = {
+    [WIST_LIR_PRIM_ADD] = WIST_VM_REG_OP_ADDI,
+    [WIST_LIR_PRIM_LT] = WIST_VM_REG_OP_LTI,
+    [WIST_LIR_PRIM_LE] = WIST_VM_REG_OP_LEI,
+    [WIST_LIR_PRIM_GT] = WIST_VM_REG_OP_GTI,
+    [WIST_LIR_PRIM_GE] = WIST_VM_REG_OP_GEI,
+    [WIST_LIR_PRIM_EQ] = WIST_VM_REG_OP_EQI,
+    [WIST_LIR_PRIM_NE] = WIST_VM_REG_OP_NEI,
+};
+
+/* === PROTOTYPES === */
+
+static void reg_fn_init(struct wist_ctx *ctx, struct reg_fn *fn,
+        int first_cap);
+static void reg_fn_finish(struct reg_fn *fn);
+static void emit_8(struct reg_fn *fn, uint8_t byte);
+static void emit_32(struct reg_fn *fn, uint32_t u32);
+static void emit_64(struct reg_fn *fn, uint64_t u64);
+static uint8_t alloc_reg(struct reg_fn *fn);
+static void push_local(struct reg_fn *fn, uint8_t reg);
+static uint8_t lookup_var(struct reg_fn *fn, int index);
+
+static uint32_t add_fn(struct wist_vm *vm, struct reg_fn *fn, uint8_t held,
+        uint8_t remaining, bool is_body, uint32_t body);
+static uint32_t add_stub(struct wist_vm *vm, uint32_t fn);
+static struct wist_handle *add_thunk(struct wist_vm *vm, uint32_t stub);
+
+static void collect_free(struct wist_ctx *ctx, struct wist_lir_expr *expr, 
+        int depth, struct wist_vector *out);
+
+static uint8_t gen_expr(struct wist_vm *vm, struct reg_fn *fn,
+        struct wist_lir_expr *expr);
+static void gen_tail(struct wist_vm *vm, struct reg_fn *fn,
+        struct wist_lir_expr *expr);
+static uint32_t gen_lam_chain(struct wist_vm *vm, struct wist_lir_expr *lam,
+        struct wist_vector *captures);
+
+/* === PUBLICS === */
+
+struct wist_handle *wist_compiler_vm_reg_gen_expr(struct wist_compiler *comp,
+        struct wist_vm *vm, struct wist_ast_expr *expr) {
+    struct reg_fn fn;
+
+    struct wist_lir_expr *lir_expr = wist_compiler_lir_gen_expr(comp, expr);
+    wist_lir_print_expr(lir_expr);
+
+    /* A thunk has no argument, but register 0 is still set aside for one. */
+    reg_fn_init(comp->ctx, &fn, 1);
+    gen_tail(vm, &fn, lir_expr);
+    bool failed = fn.failed;
+    uint32_t thunk = failed ? 0 : add_fn(vm, &fn, 0, 0, true, 0);
+    reg_fn_finish(&fn);
+
+    wist_lir_expr_destroy(comp, lir_expr);
+    if (failed) {
+        return NULL;
+    }
+    return add_thunk(vm, add_stub(vm, thunk));
+}
+
+struct wist_handle *wist_compiler_vm_reg_gen_decl(struct wist_compiler *comp,
+        struct wist_vm *vm, struct wist_ast_decl *decl) {
+    switch (decl->t) {
+        case WIST_AST_DECL_BIND: {
+            struct reg_fn fn;
+            struct wist_lir_expr *lir = wist_compiler_lir_gen_expr(comp,
+                    decl->bind.body);
+            struct wist_toplvl_entry *entry = wist_toplvl_find(&comp->toplvl,
+                    decl->bind.sym);
+
+            reg_fn_init(comp->ctx, &fn, 1);
+            uint8_t val = gen_expr(vm, &fn, lir);
+            emit_8(&fn, WIST_VM_REG_OP_SETGLOBAL);
+            emit_8(&fn, val);
+            emit_32(&fn, entry->slot);
+            emit_8(&fn, WIST_VM_REG_OP_RET);
+            emit_8(&fn, val);
+            bool failed = fn.failed;
+            uint32_t thunk = failed ? 0 : add_fn(vm, &fn, 0, 0, true, 0);
+            reg_fn_finish(&fn);
+
+            wist_lir_expr_destroy(comp, lir);
+            if (failed) {
+                return NULL;
+            }
+            return add_thunk(vm, add_stub(vm, thunk));
+        }
+    }
+    return NULL;
+}
+
+/* === PRIVATES === */
+
+static void reg_fn_init(struct wist_ctx *ctx, struct reg_fn *fn,
+        int first_cap) {
+    fn->ctx = ctx;
+    WIST_VECTOR_INIT(ctx, &fn->code, uint8_t);
+    WIST_VECTOR_INIT(ctx, &fn->locals, uint8_t);
+    WIST_VECTOR_INIT(ctx, &fn->captures, int);
+    fn->first_cap = first_cap;
+    fn->next_reg = fn->max_reg = first_cap;
+    fn->failed = false;
+}
+
+static void reg_fn_finish(struct reg_fn *fn) {
+    WIST_VECTOR_FINISH(fn->ctx, &fn->code);
+    WIST_VECTOR_FINISH(fn->ctx, &fn->locals);
+    WIST_VECTOR_FINISH(fn->ctx, &fn->captures);
+}
+
+static void emit_8(struct reg_fn *fn, uint8_t byte) {
+    WIST_VECTOR_PUSH(fn->ctx, &fn->code, uint8_t, &byte);
+}
+
+static void emit_32(struct reg_fn *fn, uint32_t u32) {
+    WIST_VECTOR_PUSH_ARR(fn->ctx, &fn->code, uint8_t, (uint8_t *) &u32, 4);
+}
+
+static void emit_64(struct reg_fn *fn, uint64_t u64) {
+    WIST_VECTOR_PUSH_ARR(fn->ctx, &fn->code, uint8_t, (uint8_t *) &u64, 8);
+}
+
+static uint8_t alloc_reg(struct reg_fn *fn) {
+    if (fn->next_reg > UINT8_MAX) {
+        if (!fn->failed) {
+            printf("Function needs more than %d registers\n", UINT8_MAX + 1);
+        }
+        fn->failed = true;
+        return 0;
+    }
+    uint8_t reg = fn->next_reg++;
+    if (fn->next_reg > fn->max_reg) {
+        fn->max_reg = fn->next_reg;
+    }
+    return reg;
+}
+
+static void push_local(struct reg_fn *fn, uint8_t reg) {
+    WIST_VECTOR_PUSH(fn->ctx, &fn->locals, uint8_t, &reg);
+}
+
+static uint8_t lookup_var(struct reg_fn *fn, int index) {
+    int local_count = WIST_VECTOR_LEN(&fn->locals, uint8_t);
+    if (index < local_count) {
+        return *WIST_VECTOR_INDEX(&fn->locals, uint8_t,
+                local_count - 1 - index);
+    }
+
+    int outer = index - local_count;
+    int capture_count = WIST_VECTOR_LEN(&fn->captures, int);
+    for (int i = 0; i < capture_count; i++) {
+        if (*WIST_VECTOR_INDEX(&fn->captures, int, i) == outer) {
+            return fn->first_cap + i;
+        }
+    }
+    printf("Variable %d was not captured\n", index);
+    fn->failed = true;
+    return 0;
+}
+
+/*
+ * Appends [fn] with its header to the register code area and returns its
+ * offset.  A function that is its own body passes [is_body] instead of the
+ * offset it can not know yet.
+ */
+static uint32_t add_fn(struct wist_vm *vm, struct reg_fn *fn, uint8_t held,
+        uint8_t remaining, bool is_body, uint32_t body) {
+    /* Keep headers aligned, the operands after them are read byte-wise. */
+    while (WIST_VECTOR_LEN(&vm->reg_code_area, uint8_t)
+            % sizeof(uint32_t) != 0) {
+        uint8_t pad = 0;
+        WIST_VECTOR_PUSH(vm->ctx, &vm->reg_code_area, uint8_t, &pad);
+    }
+
+    uint32_t offset = WIST_VECTOR_LEN(&vm->reg_code_area, uint8_t);
+    struct wist_vm_reg_fn_hdr hdr = {
+        .frame_size = fn->max_reg,
+        .held = held,
+        .remaining = remaining,
+        .body = is_body ? offset : body,
+    };
+    WIST_VECTOR_PUSH_ARR(vm->ctx, &vm->reg_code_area, uint8_t,
+            (uint8_t *) &hdr, sizeof(hdr));
+    WIST_VECTOR_PUSH_ARR(vm->ctx, &vm->reg_code_area, uint8_t,
+            WIST_VECTOR_DATA(&fn->code, uint8_t),
+            WIST_VECTOR_LEN(&fn->code, uint8_t));
+
+    wist_vm_reg_print_fn(vm, offset);
+    return offset;
+}
+
+/* 
+ * Adds the stack tier code that enters [fn], and returns its offset in the 
+ * code area, or 0 (where wist_vm_apply's stub is) if there was no room. 
+ */
+static uint32_t add_stub(struct wist_vm *vm, uint32_t fn) {
+    uint32_t code[3] = {
+        WIST_VM_INSN(WIST_VM_OP_REGENTER, 0), fn,
+        WIST_VM_INSN(WIST_VM_OP_RETURN, 0),
+    };
+    uint32_t *stub = wist_vm_code_add(vm, code, 3);
+    if (stub == NULL) {
+        return 0;
+    }
+    return (uint32_t) WIST_VM_CODE_OFFSET(vm, stub);
+}
+
+static struct wist_handle *add_thunk(struct wist_vm *vm, uint32_t stub) {
+    if (stub == 0) {
+        return NULL;
+    }
+
+    struct wist_vm_obj clo = WIST_VM_GC_ALLOC(&vm->gc, 2, WIST_VM_OBJ_CLO);
+    WIST_VM_OBJ_FIELD1(clo) = WIST_VM_GC_ALLOC(&vm->gc, 0, WIST_VM_OBJ_ENV);
+    WIST_VM_OBJ_FIELD2(clo) = WIST_VM_OBJ_MAKE_CODE(
+            WIST_VM_CODE_AT(vm, stub));
+
+    struct wist_handle *handle = wist_vm_add_handle(vm);
+    handle->obj = clo;
+    return handle;
+}
+
+/*
+ * Adds the index, relative to [depth] binders above [expr], of every
+ * variable free in [expr] to [out] once.
+ */
+static void collect_free(struct wist_ctx *ctx, struct wist_lir_expr *expr, 
+        int depth, struct wist_vector *out) {
+    switch (expr->t) {
+        case WIST_LIR_EXPR_VAR: {
+            if (expr->var.index < depth) {
+                break;
+            }
+            int outer = expr->var.index - depth;
+            WIST_VECTOR_FOR_EACH(out, int, seen) {
+                if (*seen == outer) {
+                    return;
+                }
+            }
+            WIST_VECTOR_PUSH(ctx, out, int, &outer);
+            break;
+        }
+        case WIST_LIR_EXPR_LAM:
+            collect_free(ctx, expr->lam.body, depth + 1, out);
+            break;
+        case WIST_LIR_EXPR_LET:
+            collect_free(ctx, expr->let.val, depth, out);
+            collect_free(ctx, expr->let.body, depth + 1, out);
+            break;
+        case WIST_LIR_EXPR_APP:
+            collect_free(ctx, expr->app.fun, depth, out);
+            collect_free(ctx, expr->app.arg, depth, out);
+            break;
+        case WIST_LIR_EXPR_PRIM:
+            collect_free(ctx, expr->prim.lhs, depth, out);
+            collect_free(ctx, expr->prim.rhs, depth, out);
+            break;
+        case WIST_LIR_EXPR_MKB:
+            WIST_VECTOR_FOR_EACH(&expr->mkb.fields, struct wist_lir_expr *,
+                    field) {
+                collect_free(ctx, *field, depth, out);
+            }
+            break;
+        case WIST_LIR_EXPR_GVAR:
+        case WIST_LIR_EXPR_INT:
+            break;
+    }
+}
+
+/*
+ * Generates [expr] and returns the register holding its value.  Temporaries
+ * are allocated like a stack, so every register from the returned one up is
+ * free again once the caller has used it.
+ */
+static uint8_t gen_expr(struct wist_vm *vm, struct reg_fn *fn,
+        struct wist_lir_expr *expr) {
+    switch (expr->t) {
+        case WIST_LIR_EXPR_VAR:
+            return lookup_var(fn, expr->var.index);
+        case WIST_LIR_EXPR_INT: {
+            if (expr->i.val < WIST_VM_OBJ_INT_MIN
+                    || expr->i.val > WIST_VM_OBJ_INT_MAX) {
+                printf("Integer %" PRId64 " is too big for a value\n",
+                        expr->i.val);
+                fn->failed = true;
+                return 0;
+            }
+            uint8_t dst = alloc_reg(fn);
+            emit_8(fn, WIST_VM_REG_OP_LOADI);
+            emit_8(fn, dst);
+            emit_64(fn, expr->i.val);
+            return dst;
+        }
+        case WIST_LIR_EXPR_GVAR: {
+            uint8_t dst = alloc_reg(fn);
+            emit_8(fn, WIST_VM_REG_OP_GETGLOBAL);
+            emit_8(fn, dst);
+            emit_32(fn, expr->gvar.slot);
+            return dst;
+        }
+        case WIST_LIR_EXPR_LET: {
+            uint8_t val = gen_expr(vm, fn, expr->let.val);
+            push_local(fn, val);
+            uint8_t body = gen_expr(vm, fn, expr->let.body);
+            WIST_VECTOR_POP(&fn->locals, uint8_t);
+            return body;
+        }
+        case WIST_LIR_EXPR_LAM: {
+            struct wist_vector captures;
+            WIST_VECTOR_INIT(fn->ctx, &captures, int);
+            uint32_t stub = gen_lam_chain(vm, expr, &captures);
+            if (stub == 0) {
+                fn->failed = true;
+            }
+
+            uint8_t dst = alloc_reg(fn);
+            emit_8(fn, WIST_VM_REG_OP_CLOSURE);
+            emit_8(fn, dst);
+            emit_32(fn, stub);
+            emit_8(fn, WIST_VECTOR_LEN(&captures, int));
+            WIST_VECTOR_FOR_EACH(&captures, int, outer) {
+                emit_8(fn, lookup_var(fn, *outer));
+            }
+            WIST_VECTOR_FINISH(fn->ctx, &captures);
+            return dst;
+        }
+        case WIST_LIR_EXPR_APP: {
+            uint8_t args[UINT8_MAX];
+            int argc = 0;
+            struct wist_lir_expr *fun = expr;
+            while (fun->t == WIST_LIR_EXPR_APP) {
+                argc++;
+                fun = fun->app.fun;
+            }
+            if (argc > UINT8_MAX) {
+                printf("Cannot call with %d arguments\n", argc);
+                fn->failed = true;
+                return 0;
+            }
+
+            uint8_t dst = alloc_reg(fn);
+            uint8_t fun_reg = gen_expr(vm, fn, fun);
+            /* The outermost application holds the last argument. */
+            struct wist_lir_expr *app = expr;
+            for (int i = argc - 1; i >= 0; i--) {
+                args[i] = gen_expr(vm, fn, app->app.arg);
+                app = app->app.fun;
+            }
+            emit_8(fn, WIST_VM_REG_OP_CALL);
+            emit_8(fn, dst);
+            emit_8(fn, fun_reg);
+            emit_8(fn, argc);
+            for (int i = 0; i < argc; i++) {
+                emit_8(fn, args[i]);
+            }
+            fn->next_reg = dst + 1;
+            return dst;
+        }
+        case WIST_LIR_EXPR_MKB: {
+            uint8_t fields[UINT8_MAX];
+            int field_count = WIST_VECTOR_LEN(&expr->mkb.fields,
+                    struct wist_lir_expr *);
+            if (field_count > UINT8_MAX) {
+                printf("Cannot make a block of %d fields\n", field_count);
+                fn->failed = true;
+                return 0;
+            }
+
+            uint8_t dst = alloc_reg(fn);
+            for (int i = 0; i < field_count; i++) {
+                fields[i] = gen_expr(vm, fn, *WIST_VECTOR_INDEX(
+                            &expr->mkb.fields, struct wist_lir_expr *, i));
+            }
+            emit_8(fn, WIST_VM_REG_OP_MKB);
+            emit_8(fn, dst);
+            emit_8(fn, field_count);
+            for (int i = 0; i < field_count; i++) {
+                emit_8(fn, fields[i]);
+            }
+            fn->next_reg = dst + 1;
+            return dst;
+        }
+        case WIST_LIR_EXPR_PRIM: {
+            enum wist_lir_prim_kind imm_t;
+            struct wist_lir_expr *operand;
+            int32_t imm;
+
+            uint8_t dst = alloc_reg(fn);
+            if (wist_lir_prim_imm_form(expr, &imm_t, &operand, &imm)) {
+                uint8_t lhs = gen_expr(vm, fn, operand);
+                emit_8(fn, prim_to_imm_op[imm_t]);
+                emit_8(fn, dst);
+                emit_8(fn, lhs);
+                emit_32(fn, (uint32_t) imm);
+            } else {
+                uint8_t lhs = gen_expr(vm, fn, expr->prim.lhs);
+                uint8_t rhs = gen_expr(vm, fn, expr->prim.rhs);
+                emit_8(fn, prim_to_op[expr->prim.t]);
+                emit_8(fn, dst);
+                emit_8(fn, lhs);
+                emit_8(fn, rhs);
+            }
+            fn->next_reg = dst + 1;
+            return dst;
+        }
+    }
+    printf("Cannot generate register code for expression %d\n", expr->t);
+    fn->failed = true;
+    return 0;
+}
+
+/* Generates [expr] in tail position, ending the function. */
+static void gen_tail(struct wist_vm *vm, struct reg_fn *fn,
+        struct wist_lir_expr *expr) {
+    switch (expr->t) {
+        case WIST_LIR_EXPR_APP: {
+            uint8_t args[UINT8_MAX];
+            int argc = 0;
+            struct wist_lir_expr *fun = expr;
+            while (fun->t == WIST_LIR_EXPR_APP) {
+                argc++;
+                fun = fun->app.fun;
+            }
+            if (argc > UINT8_MAX) {
+                printf("Cannot call with %d arguments\n", argc);
+                fn->failed = true;
+                return;
+            }
+
+            uint8_t fun_reg = gen_expr(vm, fn, fun);
+            struct wist_lir_expr *app = expr;
+            for (int i = argc - 1; i >= 0; i--) {
+                args[i] = gen_expr(vm, fn, app->app.arg);
+                app = app->app.fun;
+            }
+            emit_8(fn, WIST_VM_REG_OP_TAILCALL);
+            emit_8(fn, fun_reg);
+            emit_8(fn, argc);
+            for (int i = 0; i < argc; i++) {
+                emit_8(fn, args[i]);
+            }
+            break;
+        }
+        case WIST_LIR_EXPR_LET: {
+            uint8_t val = gen_expr(vm, fn, expr->let.val);
+            push_local(fn, val);
+            gen_tail(vm, fn, expr->let.body);
+            WIST_VECTOR_POP(&fn->locals, uint8_t);
+            break;
+        }
+        default: {
+            uint8_t val = gen_expr(vm, fn, expr);
+            emit_8(fn, WIST_VM_REG_OP_RET);
+            emit_8(fn, val);
+            break;
+        }
+    }
+}
+
+/*
+ * Generates the functions for the chain of lambdas starting at [lam], and
+ * returns the stub of the first, or 0 if it failed.  [captures] gets the indices, in the scope
+ * around [lam], that the closure must capture in order.
+ */
+static uint32_t gen_lam_chain(struct wist_vm *vm, struct wist_lir_expr *lam,
+        struct wist_vector *captures) {
+    int arity = 0;
+    struct wist_lir_expr *body = lam;
+    while (body->t == WIST_LIR_EXPR_LAM && arity < UINT8_MAX) {
+        arity++;
+        body = body->lam.body;
+    }
+    collect_free(vm->ctx, body, arity, captures);
+    int capture_count = WIST_VECTOR_LEN(captures, int);
+    if (arity + capture_count > UINT8_MAX) {
+        printf("Closure captures too many variables (%d)\n", capture_count);
+        return 0;
+    }
+
+    /*
+     * The body gets the last argument in register 0 and the earlier ones in
+     * order after it, so x1 .. xn are bound to registers 1 .. n - 1, 0.
+     */
+    struct reg_fn fn;
+    reg_fn_init(vm->ctx, &fn, arity);
+    WIST_VECTOR_PUSH_ARR(vm->ctx, &fn.captures, int,
+            WIST_VECTOR_DATA(captures, int), capture_count);
+    fn.next_reg = fn.max_reg = arity + capture_count;
+    for (int i = 1; i < arity; i++) {
+        push_local(&fn, i);
+    }
+    push_local(&fn, 0);
+    gen_tail(vm, &fn, body);
+    if (fn.failed) {
+        reg_fn_finish(&fn);
+        return 0;
+    }
+    uint32_t body_fn = add_fn(vm, &fn, arity - 1, 1, true, 0);
+    reg_fn_finish(&fn);
+    uint32_t stub = add_stub(vm, body_fn);
+
+    /*
+     * Each earlier lambda k holds x1 .. x(k - 1) and the captures, and just
+     * returns a closure of lambda k + 1 that also holds xk.
+     */
+    for (int k = arity - 1; k >= 1 && stub != 0; k--) {
+        reg_fn_init(vm->ctx, &fn, k);
+        fn.next_reg = fn.max_reg = k + capture_count;
+        uint8_t dst = alloc_reg(&fn);
+        emit_8(&fn, WIST_VM_REG_OP_CLOSURE);
+        emit_8(&fn, dst);
+        emit_32(&fn, stub);
+        emit_8(&fn, k + capture_count);
+        for (int i = 1; i < k; i++) {
+            emit_8(&fn, i);
+        }
+        emit_8(&fn, 0);
+        for (int i = 0; i < capture_count; i++) {
+            emit_8(&fn, k + i);
+        }
+        emit_8(&fn, WIST_VM_REG_OP_RET);
+        emit_8(&fn, dst);
+        uint32_t curry_fn = add_fn(vm, &fn, k - 1, arity - k + 1, false,
+                body_fn);
+        reg_fn_finish(&fn);
+        stub = add_stub(vm, curry_fn);
+    }
+    return stub;
+}
@@ -13,6 +13,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /* === CONTEXT === */
 
@@ -62,9 +63,204 @@ struct wist_vm *wist_vm_create(struct wist_ctx *ctx);
 /* Destroys a VM freeing ALL resources allocated to it. */
 void wist_vm_destroy(struct wist_vm *vm);
 
-/* Evaluates a closure and returns the final value. */
+/* Errors that abort an evaluation. */
+enum wist_vm_err {
+    WIST_VM_ERR_NONE,
+    /* The argument or return stack grew past the VM's stack limit. */
+    WIST_VM_ERR_STACK_OVERFLOW,
+    /* An integer division or remainder by zero. */
+    WIST_VM_ERR_DIV_BY_ZERO,
+};
+
+/* 
+ * Evaluates a closure and returns the final value, or NULL if the evaluation 
+ * was aborted by an error (see wist_vm_get_err). 
+ */
 struct wist_handle *wist_vm_eval(struct wist_vm *vm, struct wist_handle *closure);
 
+/* Returns the error that aborted the last evaluation, if any. */
+enum wist_vm_err wist_vm_get_err(struct wist_vm *vm);
+
+/* 
+ * Sets the maximum number of entries each of the VM's stacks may grow to 
+ * before evaluation fails with WIST_VM_ERR_STACK_OVERFLOW. 
+ */
+void wist_vm_set_stack_limit(struct wist_vm *vm, size_t max_entries);
+
+/* The execution tiers a VM can compile code for. */
+enum wist_vm_tier {
+    /* The stack machine with an accumulator, which is the default. */
+    WIST_VM_TIER_STACK,
+    /* The register machine, see inc/wist/vm_reg.h. */
+    WIST_VM_TIER_REG,
+};
+
+/* 
+ * Chooses the tier that code compiled for [vm] from now on runs on.  Closures 
+ * and globals from both tiers can be freely mixed. 
+ */
+void wist_vm_set_tier(struct wist_vm *vm, enum wist_vm_tier tier);
+
+/*
+ * Turns the baseline JIT for hot stack tier closures on or off, and returns
+ * whether it is now on.  It is always off in builds without JIT support.
+ */
+bool wist_vm_set_jit(struct wist_vm *vm, bool enabled);
+
+/*
+ * Writes the pairs and triples of ops the interpreter has run most often one 
+ * after the other to [out], and returns true, in builds made with 
+ * OPSTATS=on.  Other builds do not count them and return false.  Native code 
+ * is not counted, so leave the JIT off while measuring. 
+ */
+bool wist_vm_write_op_stats(struct wist_vm *vm, FILE *out);
+
+/* 
+ * Frees every value that is no longer reachable from a handle or a global.  
+ * Evaluation also collects on its own as the heap grows. 
+ */
+void wist_vm_collect(struct wist_vm *vm);
+
+/*
+ * Collects like wist_vm_collect, then slides the surviving values together
+ * and frees the memory that leaves empty.  This takes about as long again as
+ * the collection, so it is meant for the odd quiet moment in long sessions.
+ */
+void wist_vm_compact(struct wist_vm *vm);
+
+/*
+ * Limits how long in microseconds the collector may stop evaluation for at
+ * once, or 0 (the default) to collect the whole heap when it is due.  With a
+ * budget, the heap is collected a little at a time as the program allocates,
+ * and the young generation is emptied as often as it takes for that to use
+ * about half of the budget.  Emptying it and handing over the roots when a
+ * collection starts are never split up, so a pause still runs over a budget
+ * shorter than copying 16KB of survivors, or when the stacks are very deep.
+ * Pauses do not count the time spent in the collection callback.
+ */
+void wist_vm_set_gc_budget(struct wist_vm *vm, size_t budget_us);
+
+/*
+ * Sets how many threads, counting the one collecting, mark and sweep the heap
+ * when it is collected all at once, and returns how many will.  That is never
+ * more than the CPUs online, and always 1 in builds without thread support.
+ */
+size_t wist_vm_set_gc_threads(struct wist_vm *vm, size_t threads);
+
+/*
+ * Turns marking the heap on a thread of its own, while evaluation goes on,
+ * on or off, and returns whether it is now on.  Evaluation then only stops to
+ * hand over its roots and for short steps of sweeping.  With only one CPU,
+ * the heap is marked in short steps as well instead.  The context's
+ * allocator is also called from the marking thread, so it must be thread
+ * safe.  It is always off in builds without thread support.
+ */
+bool wist_vm_set_gc_concurrent(struct wist_vm *vm, bool enabled);
+
+/*
+ * Turns asking the OS for transparent huge pages for the heap on or off, and
+ * returns whether it is now on.  This only changes memory mapped for the heap
+ * from then on, and is always off where the heap is not mapped with mmap or
+ * huge pages are not supported.
+ */
+bool wist_vm_set_gc_huge_pages(struct wist_vm *vm, bool enabled);
+
+#define WIST_VM_GC_PAUSE_BUCKETS 20
+
+/*
+ * Copies out how many times the collector has stopped evaluation for each
+ * length of time.  Bucket 0 counts pauses under 1 microsecond, bucket i
+ * those under 2^i microseconds, and the last bucket all the longer ones.
+ */
+void wist_vm_get_gc_pauses(struct wist_vm *vm,
+        size_t pauses[WIST_VM_GC_PAUSE_BUCKETS]);
+
+/* What the heap is used for, which allocation is broken down by. */
+enum wist_vm_gc_kind {
+    WIST_VM_GC_KIND_CLOSURE,
+    /* The variables closures capture, kept apart from the closure. */
+    WIST_VM_GC_KIND_ENV,
+    WIST_VM_GC_KIND_TUPLE,
+    /* Closures applied to too few arguments. */
+    WIST_VM_GC_KIND_PARTIAL,
+    WIST_VM_GC_KINDS,
+};
+
+/* What the collector of a VM has seen since the VM was created. */
+struct wist_vm_gc_stats {
+    /* How many values of each kind were allocated, and how many bytes. */
+    size_t allocated[WIST_VM_GC_KINDS];
+    size_t allocated_bytes[WIST_VM_GC_KINDS];
+    /* The bytes that survived the young generation and were copied out. */
+    size_t promoted_bytes;
+    /* The bytes in the old generation now, live or not. */
+    size_t heap_bytes;
+    /* The bytes the last major collection left in the old generation. */
+    size_t live_bytes;
+    size_t minor_collections, major_collections, compactions;
+    /* All the time evaluation was stopped for, and how it was split up. */
+    uint64_t pause_us;
+    size_t pauses[WIST_VM_GC_PAUSE_BUCKETS];
+};
+
+/* Fills in [stats] for [vm].  This does not stop or change anything. */
+void wist_vm_get_gc_stats(struct wist_vm *vm, struct wist_vm_gc_stats *stats);
+
+/* What has just finished when the collection callback is called. */
+enum wist_vm_gc_event {
+    /* The young generation was emptied. */
+    WIST_VM_GC_EVENT_MINOR,
+    /* The whole heap was collected, maybe a little at a time. */
+    WIST_VM_GC_EVENT_MAJOR,
+    WIST_VM_GC_EVENT_COMPACT,
+};
+
+/*
+ * [ud] will always be the ud passed to wist_vm_set_gc_callback.  It is
+ * called in the middle of evaluation, so it must not use the VM.
+ */
+typedef void (*wist_vm_gc_fn)(void *ud, enum wist_vm_gc_event event,
+        const struct wist_vm_gc_stats *stats);
+
+/*
+ * Calls [fn] with the stats of [vm] at the end of every collection, or stops
+ * calling anything if it is NULL.  Gathering the stats walks the young
+ * generation, so this is best kept for monitoring rather than left in hot
+ * loops.
+ */
+void wist_vm_set_gc_callback(struct wist_vm *vm, wist_vm_gc_fn fn, void *ud);
+
+/*
+ * Turns sampling which code allocates on or off.  About one value in every
+ * [sample_bytes] bytes allocated is sampled, or every value if it is 0 or 1.
+ * Only code compiled for the stack tier while profiling is on can be traced
+ * back to the source, and native code is not run while it is on, so turn it
+ * on before compiling anything.
+ */
+void wist_vm_set_heap_profile(struct wist_vm *vm, bool enabled, 
+        size_t sample_bytes);
+
+enum wist_vm_heap_profile {
+    WIST_VM_HEAP_PROFILE_ALLOCATED_BYTES,
+    WIST_VM_HEAP_PROFILE_ALLOCATED_OBJECTS,
+    /* The live profiles collect the whole heap to find what is live. */
+    WIST_VM_HEAP_PROFILE_LIVE_BYTES,
+    WIST_VM_HEAP_PROFILE_LIVE_OBJECTS,
+};
+
+/*
+ * Writes what the heap profiler has seen to [out] as folded stacks, the text 
+ * flamegraph.pl and speedscope read.  Each line is one place in the source 
+ * that allocates: the declaration, the lambdas it is in from the outside, 
+ * and what it allocates, separated by semicolons, then a space and how many 
+ * bytes or values it is estimated to have allocated or still have live.
+ */
+void wist_vm_write_heap_profile(struct wist_vm *vm, FILE *out, 
+        enum wist_vm_heap_profile what);
+
+/* Returns the size in bytes of one VM value in this build of the library. */
+size_t wist_vm_value_size(void);
+
 /* 
  * There are currently two types of wist handles, handles allocated on a 
  * handle stack, and persistent handles. 